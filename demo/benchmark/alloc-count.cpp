@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "ws-message.h"
+#include "buffer-pool.h"
+#include "echo-server.h"
+
+// count heap allocations of websocket send, read, ping and pong paths
+// over loopback with the bundled echo server. every case warms up first,
+// then must not allocate at all.
+// allocations hooked by malloc interposition on glibc, by replacing
+// operator new elsewhere. only the thread of the cases is counted.
+// usage: alloc-count [iterations]
+// return: 0 no allocation after warm up, 1 otherwise
+
+using namespace std;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static thread_local bool counting = false;
+static thread_local uint64_t allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size) {
+  if (counting)
+    ++allocations;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+  if (counting)
+    ++allocations;
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) {
+  if (counting)
+    ++allocations;
+  return __libc_realloc(p, size);
+}
+} // extern "C"
+#else
+void* operator new(size_t size) {
+  if (counting)
+    ++allocations;
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+#endif
+
+static const char mask_key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+
+class Client {
+public:
+  Client() : rbuf(4096), wbuf(4096) {
+    NodeArgs<Buffer> bufs;
+    ws.chain(&sock);
+    ws.set_masking_key(mask_key);
+    bufs.add(&rbuf);
+    ws.set_read_buffers(&bufs);
+    bufs.clear();
+    bufs.add(&wbuf);
+    ws.set_write_buffers(&bufs);
+  }
+
+  SocketNode sock;
+  WSNode ws;
+
+private:
+  PoolBuffer rbuf;
+  PoolBuffer wbuf;
+};
+
+// run 'func' 'iters' times after warm up.
+// return: allocations counted, UINT64_MAX if 'func' failed
+template <typename F>
+static uint64_t count_allocations(uint32_t iters, F func) {
+  uint32_t i;
+  for (i = 0; i < 16; ++i) {
+    if (!func())
+      return UINT64_MAX;
+  }
+  allocations = 0;
+  counting = true;
+  for (i = 0; i < iters; ++i) {
+    if (!func())
+      break;
+  }
+  counting = false;
+  return i == iters ? allocations : UINT64_MAX;
+}
+
+static bool report(const char* name, uint32_t iters, uint64_t n,
+    Client& client) {
+  if (n == UINT64_MAX) {
+    printf("%-16s failed: %s\n", name, client.ws.get_error()->desc);
+    return false;
+  }
+  printf("%-16s %8u %10llu %10.3f\n", name, iters, (unsigned long long)n,
+      (double)n / iters);
+  return n == 0;
+}
+
+int main(int argc, char** argv) {
+  uint32_t iters = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  vector<char> payload(128, 'p');
+  PoolBuffer out(4096);
+  EchoServer server;
+  Client client;
+  WSMessage msg;
+  rokid::Uri uri;
+  char str[64];
+  bool ok = true;
+  uint64_t n;
+
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", server.port());
+  uri.parse(str);
+  if (!client.ws.init(uri)) {
+    fprintf(stderr, "connect failed: %s\n", client.ws.get_error()->desc);
+    return 1;
+  }
+  WSNode& ws = client.ws;
+  printf("%-16s %8s %10s %10s\n", "case", "iters", "allocs", "per op");
+
+  n = count_allocations(iters, [&]() {
+    out.clear();
+    return ws.send_frame(payload.data(), payload.size())
+      && ws.read(&out) && out.size() == payload.size();
+  });
+  ok = report("send_read", iters, n, client) && ok;
+
+  n = count_allocations(iters, [&]() {
+    out.clear();
+    return ws.ping(payload.data(), 16) && ws.read(&out);
+  });
+  ok = report("ping", iters, n, client) && ok;
+
+  n = count_allocations(iters, [&]() {
+    out.clear();
+    return ws.pong(payload.data(), 16) && ws.read(&out);
+  });
+  ok = report("pong", iters, n, client) && ok;
+
+  n = count_allocations(iters, [&]() {
+    return ws.send_frame(payload.data(), payload.size())
+      && ws.read_message(&msg) && msg.size() == payload.size();
+  });
+  ok = report("read_message", iters, n, client) && ok;
+
+  // timeout of socket node given by args on stack every call
+  n = count_allocations(iters, [&]() {
+    NodeArgs<void> args;
+    int32_t timeout = 5000;
+    args.add(nullptr);
+    args.add(&timeout);
+    out.clear();
+    return ws.send_frame(payload.data(), payload.size())
+      && ws.read(&out, &args);
+  });
+  ok = report("read_args", iters, n, client) && ok;
+
+  // failure sets error of static description
+  n = count_allocations(iters, [&]() {
+    return !ws.ping(payload.data(), payload.size() + 1);
+  });
+  ok = report("error", iters, n, client) && ok;
+
+  ws.close();
+  server.stop();
+  return ok ? 0 : 1;
+}
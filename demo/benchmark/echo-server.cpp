@@ -0,0 +1,295 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_set>
+#include "ws-frame.h"
+#include "echo-server.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+#define READ_CHUNK 65536
+
+static const char* upgrade_response = "HTTP/1.1 101 Switching Protocols\r\n"
+  "Upgrade: websocket\r\n"
+  "Connection: Upgrade\r\n"
+  "Sec-WebSocket-Accept: HSmrc0sMlYUkAGmm5OPpG2HaGWk=\r\n"
+  "\r\n";
+
+class EchoConn {
+public:
+  int fd;
+  bool upgraded = false;
+  bool closing = false;
+  bool want_write = false;
+  std::vector<uint8_t> in;
+  size_t in_begin = 0;
+  size_t in_end = 0;
+  std::vector<uint8_t> out;
+  size_t out_begin = 0;
+};
+
+static void free_conn(EchoConn* c) {
+  ::close(c->fd);
+  delete c;
+}
+
+static void set_nonblock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void append(EchoConn* c, const void* data, size_t size) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  c->out.insert(c->out.end(), p, p + size);
+}
+
+// return: false  connection should be closed
+static bool process_input(EchoConn* c) {
+  if (!c->upgraded) {
+    const char* b = reinterpret_cast<const char*>(c->in.data() + c->in_begin);
+    size_t n = c->in_end - c->in_begin;
+    size_t i;
+    for (i = 3; i < n; ++i) {
+      if (memcmp(b + i - 3, "\r\n\r\n", 4) == 0)
+        break;
+    }
+    if (i >= n)
+      return true;
+    c->in_begin += i + 1;
+    append(c, upgrade_response, strlen(upgrade_response));
+    c->upgraded = true;
+  }
+  while (c->in_end > c->in_begin) {
+    uint8_t* p = c->in.data() + c->in_begin;
+    uint32_t avail = c->in_end - c->in_begin;
+    WSFrameHeader header;
+    int32_t hsz = lizard_ws_frame_parse_header(p, avail, &header);
+    if (hsz < 0)
+      return false;
+    if (hsz == 0)
+      break;
+    uint64_t fsz = lizard_ws_frame_size(&header);
+    if (fsz > avail) {
+      if (c->in.size() - c->in_begin < fsz)
+        c->in.resize(c->in_begin + fsz);
+      break;
+    }
+    uint8_t op = header.opcode;
+    if (op == OPCODE_PING)
+      op = OPCODE_PONG;
+    char hb[14];
+    int32_t hl = lizard_ws_frame_create(op, header.fin, 0, nullptr,
+        header.payload_length, hb, sizeof(hb));
+    append(c, hb, hl);
+    size_t pos = c->out.size();
+    c->out.resize(pos + header.payload_length);
+    if (header.mask) {
+      lizard_ws_frame_mask_payload((const char*)p + hsz, p + hsz + 4,
+          header.payload_length, c->out.data() + pos);
+    } else {
+      memcpy(c->out.data() + pos, p + hsz, header.payload_length);
+    }
+    c->in_begin += fsz;
+    if (header.opcode == OPCODE_CLOSE) {
+      c->closing = true;
+      break;
+    }
+  }
+  if (c->in_begin == c->in_end) {
+    c->in_begin = c->in_end = 0;
+  } else if (c->in_begin > c->in.size() / 2) {
+    memmove(c->in.data(), c->in.data() + c->in_begin,
+        c->in_end - c->in_begin);
+    c->in_end -= c->in_begin;
+    c->in_begin = 0;
+  }
+  return true;
+}
+
+static void update_events(int epfd, EchoConn* c, bool write) {
+  if (write == c->want_write)
+    return;
+  struct epoll_event ev;
+  ev.events = EPOLLIN | (write ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->want_write = write;
+}
+
+// return: false  connection should be closed
+static bool flush_output(int epfd, EchoConn* c) {
+  while (c->out_begin < c->out.size()) {
+    ssize_t r = ::write(c->fd, c->out.data() + c->out_begin,
+        c->out.size() - c->out_begin);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return false;
+      break;
+    }
+    c->out_begin += r;
+  }
+  bool pending = c->out_begin < c->out.size();
+  if (!pending) {
+    c->out.clear();
+    c->out_begin = 0;
+    if (c->closing)
+      return false;
+  }
+  update_events(epfd, c, pending);
+  return true;
+}
+
+// return: false  connection should be closed
+static bool read_input(EchoConn* c) {
+  while (true) {
+    if (c->in.size() - c->in_end < READ_CHUNK)
+      c->in.resize(c->in_end + READ_CHUNK);
+    ssize_t r = ::read(c->fd, c->in.data() + c->in_end,
+        c->in.size() - c->in_end);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN;
+    }
+    if (r == 0)
+      return false;
+    c->in_end += r;
+    if (!process_input(c))
+      return false;
+    if (c->closing)
+      return true;
+  }
+}
+
+EchoServer::~EchoServer() {
+  stop();
+}
+
+bool EchoServer::start(uint16_t port, uint32_t nthreads) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int on = 1;
+  uint32_t i;
+
+  if (listen_fd >= 0)
+    return false;
+  listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(listen_fd, 4096) < 0
+      || getsockname(listen_fd, (struct sockaddr*)&addr, &len) < 0) {
+    printf("echo server listen failed: %s\n", strerror(errno));
+    ::close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+  set_nonblock(listen_fd);
+  listen_port = ntohs(addr.sin_port);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  stopped = false;
+  if (nthreads == 0)
+    nthreads = 1;
+  for (i = 0; i < nthreads; ++i) {
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listen_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+      // kernel not support EPOLLEXCLUSIVE
+      ev.events = EPOLLIN;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wake_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+    epoll_fds.push_back(epfd);
+    threads.emplace_back([this, epfd]() { run(epfd); });
+  }
+  return true;
+}
+
+void EchoServer::stop() {
+  uint32_t i;
+  uint64_t v = 1;
+
+  if (listen_fd < 0)
+    return;
+  stopped = true;
+  if (::write(wake_fd, &v, sizeof(v)) < 0) {
+    printf("wakeup echo server failed: %s\n", strerror(errno));
+  }
+  for (i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+    ::close(epoll_fds[i]);
+  }
+  threads.clear();
+  epoll_fds.clear();
+  ::close(wake_fd);
+  ::close(listen_fd);
+  wake_fd = listen_fd = -1;
+}
+
+void EchoServer::run(int epfd) {
+  struct epoll_event events[128];
+  std::unordered_set<EchoConn*> conns;
+  int32_t n, i;
+  int on = 1;
+
+  while (!stopped) {
+    n = epoll_wait(epfd, events, 128, -1);
+    for (i = 0; i < n; ++i) {
+      void* ptr = events[i].data.ptr;
+      if (ptr == &wake_fd)
+        continue;
+      if (ptr == &listen_fd) {
+        while (true) {
+          int fd = accept(listen_fd, nullptr, nullptr);
+          if (fd < 0)
+            break;
+          set_nonblock(fd);
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+          EchoConn* c = new EchoConn();
+          c->fd = fd;
+          struct epoll_event ev;
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+          conns.insert(c);
+        }
+        continue;
+      }
+      EchoConn* c = reinterpret_cast<EchoConn*>(ptr);
+      bool ok = true;
+      uint32_t evs = events[i].events;
+      if (ok && (evs & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        ok = read_input(c);
+      if (ok)
+        ok = flush_output(epfd, c);
+      if (!ok) {
+        conns.erase(c);
+        free_conn(c);
+      }
+    }
+  }
+  for (auto it = conns.begin(); it != conns.end(); ++it) {
+    free_conn(*it);
+  }
+}
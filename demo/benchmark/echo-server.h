@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// in-process loopback websocket echo server for benchmarks.
+// echo every data frame back unmasked, answer ping with pong.
+class EchoServer {
+public:
+  ~EchoServer();
+
+  // listen on 127.0.0.1:'port', 0 pick a free port
+  bool start(uint16_t port = 0, uint32_t threads = 1);
+
+  void stop();
+
+  inline uint16_t port() const { return listen_port; }
+
+private:
+  void run(int epfd);
+
+private:
+  int listen_fd = -1;
+  uint16_t listen_port = 0;
+  int wake_fd = -1;
+  std::atomic<bool> stopped{false};
+  std::vector<std::thread> threads;
+  std::vector<int> epoll_fds;
+};
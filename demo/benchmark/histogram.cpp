@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include "histogram.h"
+
+// range 'b' (b >= 1) holds values [SUB_BUCKETS << b, SUB_BUCKETS << (b + 1))
+// in buckets of width 1 << b, index of value v is b * SUB_BUCKETS
+// + (v >> b). range 0 holds values below 2 * SUB_BUCKETS, one per bucket.
+#define RANGE_COUNT (Histogram::MAX_VALUE_BITS - Histogram::SUB_BUCKET_BITS)
+
+Histogram::Histogram() : counts((RANGE_COUNT + 1) * SUB_BUCKETS, 0) {
+}
+
+uint32_t Histogram::index_of(uint64_t value) {
+  uint32_t b = 0;
+  if (value >= 2 * SUB_BUCKETS)
+    b = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+  return b * SUB_BUCKETS + (uint32_t)(value >> b);
+}
+
+uint64_t Histogram::highest_value(uint32_t idx) {
+  if (idx < 2 * SUB_BUCKETS)
+    return idx;
+  uint32_t b = idx / SUB_BUCKETS - 1;
+  uint64_t sub = idx - b * SUB_BUCKETS;
+  return ((sub + 1) << b) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+  if (value > MAX_VALUE)
+    value = MAX_VALUE;
+  ++counts[index_of(value)];
+  ++total;
+  sum += value;
+  if (value < min_value)
+    min_value = value;
+  if (value > max_value)
+    max_value = value;
+}
+
+void Histogram::merge(const Histogram& other) {
+  size_t i;
+
+  for (i = 0; i < counts.size(); ++i)
+    counts[i] += other.counts[i];
+  total += other.total;
+  sum += other.sum;
+  if (other.min_value < min_value)
+    min_value = other.min_value;
+  if (other.max_value > max_value)
+    max_value = other.max_value;
+}
+
+void Histogram::clear() {
+  counts.assign(counts.size(), 0);
+  total = 0;
+  sum = 0;
+  min_value = UINT64_MAX;
+  max_value = 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+  uint64_t target, acc = 0;
+  size_t i;
+
+  if (total == 0)
+    return 0;
+  if (p >= 100)
+    return max_value;
+  target = (uint64_t)(p / 100 * total + 0.5);
+  if (target == 0)
+    target = 1;
+  for (i = 0; i < counts.size(); ++i) {
+    acc += counts[i];
+    if (acc >= target) {
+      uint64_t v = highest_value(i);
+      return v < max_value ? v : max_value;
+    }
+  }
+  return max_value;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// latency histogram in the layout of HdrHistogram: values below
+// 2 * SUB_BUCKETS are counted exactly, larger values in power of two
+// ranges each split into SUB_BUCKETS linear buckets, so relative error of
+// any recorded value is less than 1 / SUB_BUCKETS.
+// memory is fixed, record is O(1), histograms of threads are merged.
+class Histogram {
+public:
+  Histogram();
+
+  // values larger than MAX_VALUE counted as MAX_VALUE
+  void record(uint64_t value);
+
+  void merge(const Histogram& other);
+
+  void clear();
+
+  // 'p': 0 - 100
+  // return: highest value equivalent to the bucket holding 'p' percent
+  //         of recorded values, 0 if empty
+  uint64_t percentile(double p) const;
+
+  inline uint64_t count() const { return total; }
+
+  inline uint64_t min() const { return total ? min_value : 0; }
+
+  inline uint64_t max() const { return max_value; }
+
+  double mean() const { return total ? (double)sum / total : 0; }
+
+private:
+  static uint32_t index_of(uint64_t value);
+
+  static uint64_t highest_value(uint32_t idx);
+
+public:
+  static const uint32_t SUB_BUCKET_BITS = 7;
+  static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const uint32_t MAX_VALUE_BITS = 40;
+  static const uint64_t MAX_VALUE = (1ULL << MAX_VALUE_BITS) - 1;
+
+private:
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t min_value = UINT64_MAX;
+  uint64_t max_value = 0;
+};
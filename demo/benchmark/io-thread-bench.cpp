@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "ws-message.h"
+#include "ws-io-thread.h"
+#include "buffer-pool.h"
+#include "echo-server.h"
+#include "histogram.h"
+
+// echo over loopback with a lizard io thread reading the connection and a
+// slow consumer: sender thread sends timestamped messages at a fixed rate
+// by WSIoThread::send, consumer thread takes echoes by pop and spins
+// 'work' microseconds for each, as a heavy message handler.
+// prints echo round trip latency measured at consumer, which includes
+// time waiting in the ring behind earlier messages.
+// usage: io-thread-bench [messages] [message size] [messages per second]
+//                        [work microseconds]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static const char mask_key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+
+static int64_t now_ns() {
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin(int64_t ns) {
+  int64_t end = now_ns() + ns;
+  while (now_ns() < end)
+    ;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+  uint32_t size = argc > 2 ? strtoul(argv[2], nullptr, 10) : 256;
+  uint32_t rate = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10000;
+  uint32_t work = argc > 4 ? strtoul(argv[4], nullptr, 10) : 50;
+  EchoServer server;
+  SocketNode sock;
+  WSNode ws;
+  PoolBuffer rbuf(65536), wbuf(65536);
+  NodeArgs<Buffer> bufs;
+  WSIoThread io;
+  WSMessage msg;
+  Histogram latency;
+  rokid::Uri uri;
+  char str[64];
+
+  if (size < sizeof(int64_t))
+    size = sizeof(int64_t);
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", server.port());
+  uri.parse(str);
+  ws.chain(&sock);
+  ws.set_masking_key(mask_key);
+  bufs.add(&rbuf);
+  ws.set_read_buffers(&bufs);
+  bufs.clear();
+  bufs.add(&wbuf);
+  ws.set_write_buffers(&bufs);
+  if (!ws.init(uri)) {
+    fprintf(stderr, "connect failed: %s\n", ws.get_error()->desc);
+    return 1;
+  }
+  ws.set_nodelay(true);
+  if (!io.start(&ws)) {
+    fprintf(stderr, "start io thread failed\n");
+    return 1;
+  }
+
+  thread sender([&]() {
+    vector<char> payload(size, 's');
+    int64_t interval = 1000000000LL / (rate ? rate : 1);
+    int64_t next = now_ns();
+    uint32_t i = 0;
+    while (i < count && io.is_running()) {
+      int64_t ts = now_ns();
+      if (ts < next) {
+        this_thread::sleep_for(nanoseconds(next - ts));
+        continue;
+      }
+      memcpy(payload.data(), &ts, sizeof(ts));
+      if (io.send(payload.data(), size)) {
+        ++i;
+        next += interval;
+      } else {
+        this_thread::sleep_for(microseconds(100));
+      }
+    }
+  });
+
+  auto tp = steady_clock::now();
+  uint32_t received = 0;
+  while (received < count) {
+    if (!io.pop(&msg)) {
+      if (!io.wait(1000) && !io.is_running())
+        break;
+      continue;
+    }
+    if (msg.opcode() != OPCODE_BINARY || msg.size() != size)
+      continue;
+    int64_t ts;
+    memcpy(&ts, msg.data(), sizeof(ts));
+    latency.record((now_ns() - ts) / 1000);
+    spin(work * 1000LL);
+    ++received;
+  }
+  double sec = duration_cast<nanoseconds>(steady_clock::now() - tp).count()
+    / 1e9;
+  sender.join();
+  io.stop();
+  if (received < count) {
+    fprintf(stderr, "io thread stopped: %s\n", io.get_error()->desc);
+    return 1;
+  }
+  printf("messages %u of %u bytes, %u/s offered, consumer work %uus\n",
+      count, size, rate, work);
+  printf("%.0f msgs/s, latency us p50 %llu p99 %llu p999 %llu max %llu\n",
+      received / sec, (unsigned long long)latency.percentile(50),
+      (unsigned long long)latency.percentile(99),
+      (unsigned long long)latency.percentile(99.9),
+      (unsigned long long)latency.max());
+  msg.release();
+  ws.close();
+  server.stop();
+  return 0;
+}
@@ -0,0 +1,353 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "ws-message.h"
+#include "buffer-pool.h"
+#include "echo-server.h"
+
+// benchmark suite of lizard, results printed to stdout as json:
+//   micro benchmarks of frame create/parse, masking and buffer operations,
+//   ws echo over tcp (unmasked and masked) against in-process loopback
+//   echo server, one message in flight, message size 16B - 16MB.
+// ws echo results have msgs/s, MB/s of payload echoed and p50/p99/p999
+// round trip latency in microseconds.
+// usage: lizard_bench [name filter] [max messages per case]
+//                     [max message size]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+// payload bytes per ws echo case, messages of a case are at least
+// MIN_ECHO_MESSAGES and at most 'max messages per case'
+#define ECHO_BYTES_PER_CASE (256 * 1024 * 1024)
+#define MIN_ECHO_MESSAGES 16
+#define WARMUP_MESSAGES 4
+// bytes processed per micro benchmark case
+#define MICRO_BYTES_PER_CASE (256 * 1024 * 1024)
+#define MICRO_OPS_PER_CASE 2000000
+
+static const uint32_t message_sizes[] = {
+  16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304,
+  16777216
+};
+static const uint32_t message_size_count = sizeof(message_sizes)
+  / sizeof(uint32_t);
+
+class BenchResult {
+public:
+  string name;
+  uint32_t size = 0;
+  uint64_t iterations = 0;
+  double seconds = 0;
+  // latency percentiles of ws echo in microseconds, < 0 not measured
+  double p50 = -1;
+  double p99 = -1;
+  double p999 = -1;
+};
+
+static const char* name_filter = nullptr;
+static uint64_t max_messages = 10000;
+static uint32_t max_size = 16777216;
+static vector<BenchResult> results;
+static volatile uint64_t sink;
+
+static bool selected(const string& name) {
+  return name_filter == nullptr || name.find(name_filter) != string::npos;
+}
+
+static void add_result(const BenchResult& r) {
+  results.push_back(r);
+  fprintf(stderr, "%-32s %10u %10llu %14.1f ops/s\n", r.name.c_str(),
+      r.size, (unsigned long long)r.iterations,
+      r.seconds > 0 ? r.iterations / r.seconds : 0);
+}
+
+static void print_json() {
+  size_t i;
+
+  printf("{\n  \"mask_kernel\": \"%s\",\n",
+      lizard_ws_mask_kernel_name(lizard_ws_mask_get_kernel()));
+  printf("  \"results\": [");
+  for (i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    double ops = r.seconds > 0 ? r.iterations / r.seconds : 0;
+    printf("%s\n    {\"name\": \"%s\", \"size\": %u, \"iterations\": %llu, "
+        "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+        "\"ns_per_op\": %.2f", i ? "," : "", r.name.c_str(), r.size,
+        (unsigned long long)r.iterations, r.seconds, ops,
+        ops * r.size / (1024 * 1024), ops > 0 ? 1000000000.0 / ops : 0);
+    if (r.p50 >= 0) {
+      printf(", \"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f",
+          r.p50, r.p99, r.p999);
+    }
+    printf("}");
+  }
+  printf("\n  ]\n}\n");
+}
+
+// ==================micro benchmarks====================
+template <typename F>
+static void run_micro(const char* name, uint32_t size, F func) {
+  BenchResult r;
+  uint64_t iters = MICRO_BYTES_PER_CASE / (size ? size : 1);
+  uint64_t i;
+
+  r.name = name;
+  if (!selected(r.name))
+    return;
+  if (iters > MICRO_OPS_PER_CASE)
+    iters = MICRO_OPS_PER_CASE;
+  if (iters < 16)
+    iters = 16;
+  // warm up caches and page in buffers
+  for (i = 0; i < iters / 16; ++i)
+    func(i);
+  auto tp = steady_clock::now();
+  for (i = 0; i < iters; ++i)
+    func(i);
+  r.seconds = duration_cast<nanoseconds>(steady_clock::now() - tp).count()
+    / 1000000000.0;
+  r.size = size;
+  r.iterations = iters;
+  add_result(r);
+}
+
+static void bench_frame() {
+  const char key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+  static const uint32_t sizes[] = { 16, 1024, 1048576 };
+  uint8_t header[14];
+  WSFrameHeader h;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(uint32_t); ++i) {
+    uint32_t size = sizes[i];
+    // size of these cases is payload length in header, not bytes processed
+    run_micro("frame_create", size, [&](uint64_t n) {
+      sink += lizard_ws_frame_create(OPCODE_BINARY, 1, 1, key,
+          size + (n & 1), header, sizeof(header));
+    });
+    int32_t hsz = lizard_ws_frame_create(OPCODE_BINARY, 1, 1, key, size,
+        header, sizeof(header));
+    run_micro("frame_parse", size, [&](uint64_t n) {
+      sink += lizard_ws_frame_parse_header(header, hsz, &h);
+      sink += h.payload_length;
+    });
+  }
+}
+
+static void bench_mask() {
+  const char key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+  vector<uint8_t> in(max_size + 64);
+  vector<uint8_t> out(in.size());
+  uint32_t i;
+
+  for (i = 0; i < in.size(); ++i)
+    in[i] = rand();
+  for (i = 0; i < message_size_count && message_sizes[i] <= max_size; ++i) {
+    uint32_t size = message_sizes[i];
+    run_micro("mask", size, [&](uint64_t n) {
+      lizard_ws_frame_mask_payload(key, in.data(), size, out.data());
+    });
+    run_micro("mask_inplace", size, [&](uint64_t n) {
+      lizard_ws_frame_mask_payload(key, in.data(), size, in.data());
+    });
+  }
+}
+
+static void bench_buffer() {
+  static const uint32_t sizes[] = { 16, 256, 4096, 16384 };
+  vector<char> data(65536);
+  vector<char> mem(65536);
+  MmapBuffer ring(65536);
+  uint32_t i;
+
+  for (i = 0; i < sizeof(sizes) / sizeof(uint32_t); ++i) {
+    uint32_t size = sizes[i];
+    Buffer buf(mem.data(), mem.size());
+    // append then consume whole data, buffer cleared by consume
+    run_micro("buffer_append_consume", size, [&](uint64_t n) {
+      buf.append(data.data(), size);
+      buf.consume(size);
+    });
+    // half a frame left in buffer after every read, shift moves it to
+    // buffer begin
+    buf.clear();
+    buf.append(data.data(), size / 2);
+    run_micro("buffer_append_shift", size, [&](uint64_t n) {
+      buf.append(data.data(), size);
+      buf.consume(size);
+      buf.shift();
+    });
+    ring.clear();
+    ring.append(data.data(), size / 2);
+    run_micro("mmap_buffer_append_shift", size, [&](uint64_t n) {
+      ring.append(data.data(), size);
+      ring.consume(size);
+      ring.shift();
+    });
+  }
+
+  uint32_t cap;
+  run_micro("buffer_pool_get_put", 4096, [&](uint64_t n) {
+    void* p = BufferPool::instance()->get(4096, &cap);
+    BufferPool::instance()->put(p, cap);
+  });
+  PoolBuffer pbuf;
+  run_micro("pool_buffer_reserve_shrink", 1048576, [&](uint64_t n) {
+    pbuf.reserve(1048576);
+    pbuf.shrink();
+  });
+}
+
+// ==================ws echo benchmarks====================
+// websocket client chain over tcp, growable buffers
+class EchoClient {
+public:
+  ~EchoClient() {
+    ws.close();
+  }
+
+  bool connect(uint16_t port, bool masked) {
+    NodeArgs<Buffer> bufs;
+    Uri uri;
+    char str[64];
+    const char mask[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+
+    snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", port);
+    uri.parse(str);
+    ws.chain(&sock_node);
+    if (masked)
+      ws.set_masking_key(mask);
+    ws.set_max_message_size(max_size);
+    bufs.add(&read_buffer);
+    ws.set_read_buffers(&bufs);
+    bufs.clear();
+    bufs.add(&write_buffer);
+    ws.set_write_buffers(&bufs);
+    if (!ws.init(uri)) {
+      fprintf(stderr, "connect %s failed: %s\n", str,
+          ws.get_error()->desc);
+      return false;
+    }
+    // masked frames larger than write buffer are written in chunks
+    ws.set_nodelay(true);
+    return true;
+  }
+
+  // return: round trip nanoseconds of one message, -1 if failed
+  int64_t echo(const vector<char>& payload, uint32_t size) {
+    auto tp = steady_clock::now();
+    if (!ws.send_frame(payload.data(), size))
+      return -1;
+    if (!ws.read_message(&msg) || msg.opcode() != OPCODE_BINARY
+        || msg.size() != size)
+      return -1;
+    return duration_cast<nanoseconds>(steady_clock::now() - tp).count();
+  }
+
+  inline const NodeError* get_error() const { return ws.get_error(); }
+
+private:
+  SocketNode sock_node;
+  WSNode ws;
+  PoolBuffer read_buffer;
+  PoolBuffer write_buffer;
+  WSMessage msg;
+};
+
+static double percentile(const vector<int64_t>& sorted, double p) {
+  size_t idx = (size_t)(p * sorted.size());
+  if (idx >= sorted.size())
+    idx = sorted.size() - 1;
+  return sorted[idx] / 1000.0;
+}
+
+static bool bench_echo(const char* name, uint16_t port, bool masked) {
+  EchoClient client;
+  vector<char> payload(max_size);
+  vector<int64_t> lats;
+  uint32_t i;
+  uint64_t j;
+
+  if (!selected(name))
+    return true;
+  if (!client.connect(port, masked))
+    return false;
+  for (j = 0; j < payload.size(); ++j)
+    payload[j] = rand();
+  for (i = 0; i < message_size_count && message_sizes[i] <= max_size; ++i) {
+    BenchResult r;
+    uint32_t size = message_sizes[i];
+    uint64_t count = ECHO_BYTES_PER_CASE / size;
+    int64_t total = 0;
+
+    if (count > max_messages)
+      count = max_messages;
+    if (count < MIN_ECHO_MESSAGES)
+      count = MIN_ECHO_MESSAGES;
+    lats.resize(count);
+    for (j = 0; j < WARMUP_MESSAGES + count; ++j) {
+      int64_t ns = client.echo(payload, size);
+      if (ns < 0) {
+        fprintf(stderr, "%s echo %u bytes failed: %s\n", name, size,
+            client.get_error()->desc);
+        return false;
+      }
+      if (j >= WARMUP_MESSAGES) {
+        lats[j - WARMUP_MESSAGES] = ns;
+        total += ns;
+      }
+    }
+    sort(lats.begin(), lats.end());
+    r.name = name;
+    r.size = size;
+    r.iterations = count;
+    r.seconds = total / 1000000000.0;
+    r.p50 = percentile(lats, 0.5);
+    r.p99 = percentile(lats, 0.99);
+    r.p999 = percentile(lats, 0.999);
+    add_result(r);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  EchoServer server;
+  bool r;
+
+  if (argc > 1 && strcmp(argv[1], "all"))
+    name_filter = argv[1];
+  if (argc > 2)
+    max_messages = strtoull(argv[2], nullptr, 10);
+  if (argc > 3)
+    max_size = strtoul(argv[3], nullptr, 10);
+  if (max_messages == 0)
+    max_messages = 1;
+  if (max_size < message_sizes[0])
+    max_size = message_sizes[0];
+
+  bench_frame();
+  bench_mask();
+  bench_buffer();
+
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  r = bench_echo("ws_echo_tcp", server.port(), false)
+    && bench_echo("ws_echo_tcp_masked", server.port(), true);
+  server.stop();
+  print_json();
+  return r ? 0 : 1;
+}
@@ -0,0 +1,580 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "event-loop.h"
+#include "buffer-pool.h"
+#include "trace.h"
+#include "echo-server.h"
+#include "histogram.h"
+
+// load generator: N concurrent websocket sessions driven by one EventLoop
+// per thread, against the bundled loopback echo server or a remote uri.
+//   closed loop (rate 0): every session keeps one message in flight.
+//   open loop: messages sent at a constant or poisson rate regardless of
+//     replies, round trip measured from the time a message was scheduled,
+//     not the time it was sent, so a stalled server is not hidden by the
+//     generator waiting for it (coordinated omission).
+// connect, websocket upgrade and round trip latencies are recorded by hdr
+// histograms. only ws targets, wss is not supported.
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+#define CONNECT_TIMEOUT 10000
+// wait replies of messages in flight after sending stopped
+#define DRAIN_TIMEOUT 3000
+// nanoseconds, sleep between polls when next message is due in less than
+// one millisecond
+#define POLL_STEP 50000
+// max size of messages generated by exp size distribution
+#define MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+
+static int64_t now_ns() {
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+    .count();
+}
+
+// message size distribution
+class SizeDist {
+public:
+  // "N": fixed, "MIN-MAX": uniform, "exp:MEAN": exponential
+  bool parse(const char* str) {
+    char* end;
+    if (strncmp(str, "exp:", 4) == 0) {
+      type = EXP;
+      mean = strtod(str + 4, &end);
+      return *end == '\0' && mean >= 1;
+    }
+    lo = strtoul(str, &end, 10);
+    if (*end == '-') {
+      type = UNIFORM;
+      hi = strtoul(end + 1, &end, 10);
+      return *end == '\0' && hi >= lo && hi <= MAX_MESSAGE_SIZE;
+    }
+    type = FIXED;
+    hi = lo;
+    return *end == '\0' && lo <= MAX_MESSAGE_SIZE;
+  }
+
+  uint32_t next(mt19937_64& rng) const {
+    if (type == UNIFORM)
+      return uniform_int_distribution<uint32_t>(lo, hi)(rng);
+    if (type == EXP) {
+      double v = exponential_distribution<double>(1.0 / mean)(rng);
+      return v < MAX_MESSAGE_SIZE ? (uint32_t)v : MAX_MESSAGE_SIZE;
+    }
+    return lo;
+  }
+
+  uint32_t max() const {
+    return type == EXP ? MAX_MESSAGE_SIZE : hi;
+  }
+
+private:
+  static const int32_t FIXED = 0;
+  static const int32_t UNIFORM = 1;
+  static const int32_t EXP = 2;
+
+  int32_t type = FIXED;
+  uint32_t lo = 64;
+  uint32_t hi = 64;
+  double mean = 0;
+};
+
+class LoadOptions {
+public:
+  string uri;
+  uint32_t sessions = 100;
+  uint32_t threads = 0;
+  uint32_t server_threads = 0;
+  uint32_t seconds = 10;
+  uint32_t warmup = 1;
+  // total messages per second of all sessions, 0 closed loop
+  double rate = 0;
+  bool poisson = false;
+  SizeDist sizes;
+  bool masked = true;
+  bool json = false;
+  // chrome trace written to
+  string trace_file;
+};
+
+static LoadOptions options;
+
+// records time lower nodes connected, before http upgrade
+class TimedWSNode : public WSNode {
+public:
+  int64_t inited = 0;
+
+protected:
+  bool on_init(const rokid::Uri& uri, void* arg) {
+    inited = now_ns();
+    return WSNode::on_init(uri, arg);
+  }
+};
+
+class Worker;
+
+class InFlight {
+public:
+  Buffer in;
+  // scheduled send time, round trip measured from it
+  int64_t intended;
+};
+
+class LoadSession : public EventHandler {
+public:
+  SocketNode sock_node;
+  TimedWSNode ws;
+  PoolBuffer read_buffer;
+  PoolBuffer write_buffer;
+  PoolBuffer out;
+  uint32_t wflags = OPCODE_BINARY | WSFRAME_FIN;
+  uint32_t rflags = 0;
+  NodeArgs<void> wargs;
+  NodeArgs<void> rargs;
+  // messages sent or queued by loop, Buffers must stay valid until written.
+  // a reply means the message was completely written.
+  deque<InFlight> inflight;
+  int64_t next_send = 0;
+  Worker* worker = nullptr;
+  bool failed = false;
+
+  bool connect(const rokid::Uri& uri);
+
+  void send(int64_t intended);
+
+  void on_read(Node* node, Buffer* data);
+
+  void on_error(Node* node, const NodeError* err);
+};
+
+class Worker {
+public:
+  EventLoop loop;
+  vector<LoadSession*> sessions;
+  vector<char> payload;
+  mt19937_64 rng;
+  std::thread thread;
+  Histogram connect_hist;
+  Histogram upgrade_hist;
+  Histogram rtt_hist;
+  uint64_t connect_failures = 0;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+  uint64_t lost = 0;
+  // nanoseconds of measure period, replies of messages scheduled in it
+  // are recorded
+  int64_t measure_begin = 0;
+  int64_t measure_end = 0;
+  bool sending = true;
+
+  // interval to next message of a session in open loop
+  int64_t interval() {
+    double mean = 1000000000.0 * options.sessions / options.rate;
+    if (options.poisson)
+      return (int64_t)exponential_distribution<double>(1.0 / mean)(rng) + 1;
+    return (int64_t)mean;
+  }
+
+  void run(const rokid::Uri& uri, uint32_t count, atomic<uint32_t>* ready,
+      atomic<int64_t>* start);
+};
+
+bool LoadSession::connect(const rokid::Uri& uri) {
+  NodeArgs<Buffer> bufs;
+  const char mask[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+
+  ws.chain(&sock_node);
+  if (options.masked)
+    ws.set_masking_key(mask);
+  ws.set_max_message_size(MAX_MESSAGE_SIZE);
+  bufs.add(&read_buffer);
+  ws.set_read_buffers(&bufs);
+  bufs.clear();
+  bufs.add(&write_buffer);
+  ws.set_write_buffers(&bufs);
+  wargs.add(&wflags);
+  rargs.add(&rflags);
+  ws.set_deadline(CONNECT_TIMEOUT);
+  int64_t begin = now_ns();
+  bool r = ws.init(uri);
+  int64_t end = now_ns();
+  ws.set_deadline(0);
+  if (!r)
+    return false;
+  ws.set_nodelay(true);
+  worker->connect_hist.record((ws.inited - begin) / 1000);
+  worker->upgrade_hist.record((end - ws.inited) / 1000);
+  return true;
+}
+
+void LoadSession::send(int64_t intended) {
+  uint32_t size = options.sizes.next(worker->rng);
+  inflight.emplace_back();
+  InFlight& m = inflight.back();
+  m.intended = intended;
+  m.in.set_data(worker->payload.data(), size, 0, size);
+  if (intended >= worker->measure_begin && intended < worker->measure_end)
+    ++worker->sent;
+  if (!worker->loop.write(&ws, &m.in, &wargs)) {
+    on_error(&ws, ws.get_error());
+    worker->loop.remove(&ws);
+  }
+}
+
+void LoadSession::on_read(Node* node, Buffer* data) {
+  if ((rflags & OPCODE_MASK) != OPCODE_BINARY || inflight.empty())
+    return;
+  int64_t now = now_ns();
+  InFlight& m = inflight.front();
+  if (m.intended >= worker->measure_begin
+      && m.intended < worker->measure_end) {
+    worker->rtt_hist.record((now - m.intended) / 1000);
+    ++worker->received;
+    worker->bytes += data->size();
+  }
+  inflight.pop_front();
+  // closed loop, next message right after reply
+  if (options.rate <= 0 && worker->sending)
+    send(now);
+}
+
+void LoadSession::on_error(Node* node, const NodeError* err) {
+  if (failed)
+    return;
+  failed = true;
+  ++worker->errors;
+  worker->lost += inflight.size();
+  inflight.clear();
+  fprintf(stderr, "session failed: %s\n", err->desc);
+}
+
+void Worker::run(const rokid::Uri& uri, uint32_t count,
+    atomic<uint32_t>* ready, atomic<int64_t>* start) {
+  typedef pair<int64_t, LoadSession*> Timer;
+  priority_queue<Timer, vector<Timer>, greater<Timer> > timers;
+  uint32_t i;
+
+  if (!loop.init()) {
+    fprintf(stderr, "init event loop failed\n");
+    ++*ready;
+    return;
+  }
+  payload.resize(options.sizes.max());
+  for (i = 0; i < payload.size(); ++i)
+    payload[i] = rng();
+  for (i = 0; i < count; ++i) {
+    LoadSession* s = new LoadSession();
+    s->worker = this;
+    if (!s->connect(uri)) {
+      if (connect_failures++ == 0) {
+        fprintf(stderr, "connect failed: %s\n",
+            s->ws.get_error()->desc);
+      }
+      delete s;
+      continue;
+    }
+    sessions.push_back(s);
+  }
+  ++*ready;
+  while (start->load() == 0)
+    this_thread::sleep_for(milliseconds(1));
+  measure_begin = start->load() + options.warmup * 1000000000LL;
+  measure_end = measure_begin + options.seconds * 1000000000LL;
+
+  for (i = 0; i < sessions.size(); ++i) {
+    LoadSession* s = sessions[i];
+    if (!loop.add(&s->ws, &s->out, s, &s->rargs)) {
+      s->failed = true;
+      ++errors;
+      continue;
+    }
+    if (options.rate > 0) {
+      // random phase, sessions not sending in bursts
+      s->next_send = start->load() + uniform_int_distribution<int64_t>(0,
+          interval())(rng);
+      timers.push(Timer(s->next_send, s));
+    } else {
+      s->send(now_ns());
+    }
+  }
+
+  int64_t drain_end = measure_end + DRAIN_TIMEOUT * 1000000LL;
+  while (true) {
+    int64_t now = now_ns();
+    if (sending && now >= measure_end) {
+      sending = false;
+      timers = priority_queue<Timer, vector<Timer>, greater<Timer> >();
+    }
+    if (!sending) {
+      bool idle = true;
+      for (i = 0; i < sessions.size() && idle; ++i)
+        idle = sessions[i]->failed || sessions[i]->inflight.empty();
+      if (idle || now >= drain_end)
+        break;
+    }
+    while (!timers.empty() && timers.top().first <= now) {
+      LoadSession* s = timers.top().second;
+      timers.pop();
+      if (s->failed)
+        continue;
+      // catch up all messages scheduled before now, each keeps its own
+      // scheduled time
+      while (s->next_send <= now && s->next_send < measure_end) {
+        s->send(s->next_send);
+        s->next_send += interval();
+      }
+      if (!s->failed && s->next_send < measure_end)
+        timers.push(Timer(s->next_send, s));
+    }
+    int32_t timeout = 100;
+    if (!timers.empty()) {
+      int64_t wait = timers.top().first - now;
+      // timeout of epoll is in milliseconds. less than one millisecond to
+      // next message, poll and sleep in short steps instead of spinning,
+      // so the cpu is left for the server if it runs on the same host,
+      // and replies are still timestamped within a step
+      if (wait < 1000000) {
+        loop.run_once(0);
+        wait = timers.top().first - now_ns();
+        if (wait > 0)
+          this_thread::sleep_for(nanoseconds(wait < POLL_STEP ? wait
+                : POLL_STEP));
+        continue;
+      }
+      timeout = wait / 1000000 < timeout ? (int32_t)(wait / 1000000)
+        : timeout;
+    }
+    loop.run_once(timeout);
+  }
+
+  for (i = 0; i < sessions.size(); ++i) {
+    LoadSession* s = sessions[i];
+    lost += s->inflight.size();
+    if (!s->failed)
+      loop.remove(&s->ws);
+    s->inflight.clear();
+    s->ws.close();
+    delete s;
+  }
+  sessions.clear();
+}
+
+static void print_hist_text(const char* name, const Histogram& h) {
+  if (h.count() == 0)
+    return;
+  printf("%-10s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+      name, (unsigned long long)h.count(), h.min() / 1000.0,
+      h.percentile(50) / 1000.0, h.percentile(90) / 1000.0,
+      h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0,
+      h.percentile(99.99) / 1000.0, h.max() / 1000.0);
+}
+
+static void print_hist_json(const char* name, const Histogram& h,
+    bool last) {
+  printf("    \"%s\": {\"count\": %llu, \"min_us\": %llu, \"mean_us\": %.1f, "
+      "\"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, "
+      "\"p999_us\": %llu, \"p9999_us\": %llu, \"max_us\": %llu}%s\n", name,
+      (unsigned long long)h.count(), (unsigned long long)h.min(), h.mean(),
+      (unsigned long long)h.percentile(50),
+      (unsigned long long)h.percentile(90),
+      (unsigned long long)h.percentile(99),
+      (unsigned long long)h.percentile(99.9),
+      (unsigned long long)h.percentile(99.99),
+      (unsigned long long)h.max(), last ? "" : ",");
+}
+
+static void usage() {
+  printf("usage: load-gen [options]\n"
+      "  -u uri    target, default bundled loopback echo server\n"
+      "  -c N      sessions, default 100\n"
+      "  -t N      client threads, default cpus\n"
+      "  -T N      bundled echo server threads, default cpus\n"
+      "  -d SEC    measure seconds, default 10\n"
+      "  -w SEC    warmup seconds not measured, default 1\n"
+      "  -r RATE   total messages per second, 0 closed loop, default 0\n"
+      "  -a DIST   arrival of open loop: const | poisson, default const\n"
+      "  -m DIST   message size: N | MIN-MAX | exp:MEAN, default 64\n"
+      "  -U        send frames unmasked\n"
+      "  -j        report in json\n"
+      "  -x FILE   write chrome trace of latest node operations to FILE\n");
+}
+
+static bool parse_options(int argc, char** argv) {
+  int c;
+
+  while ((c = getopt(argc, argv, "u:c:t:T:d:w:r:a:m:Ujx:h")) != -1) {
+    switch (c) {
+      case 'u':
+        options.uri = optarg;
+        break;
+      case 'c':
+        options.sessions = strtoul(optarg, nullptr, 10);
+        break;
+      case 't':
+        options.threads = strtoul(optarg, nullptr, 10);
+        break;
+      case 'T':
+        options.server_threads = strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        options.seconds = strtoul(optarg, nullptr, 10);
+        break;
+      case 'w':
+        options.warmup = strtoul(optarg, nullptr, 10);
+        break;
+      case 'r':
+        options.rate = strtod(optarg, nullptr);
+        break;
+      case 'a':
+        if (strcmp(optarg, "poisson") && strcmp(optarg, "const"))
+          return false;
+        options.poisson = strcmp(optarg, "poisson") == 0;
+        break;
+      case 'm':
+        if (!options.sizes.parse(optarg))
+          return false;
+        break;
+      case 'U':
+        options.masked = false;
+        break;
+      case 'j':
+        options.json = true;
+        break;
+      case 'x':
+        options.trace_file = optarg;
+        break;
+      default:
+        return false;
+    }
+  }
+  return options.sessions > 0 && options.seconds > 0;
+}
+
+int main(int argc, char** argv) {
+  EchoServer server;
+  rokid::Uri uri;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t i;
+  char buf[64];
+
+  if (!parse_options(argc, argv)) {
+    usage();
+    return 1;
+  }
+  if (options.threads == 0)
+    options.threads = cpus > 0 ? cpus : 1;
+  if (options.threads > options.sessions)
+    options.threads = options.sessions;
+  if (options.server_threads == 0)
+    options.server_threads = cpus > 0 ? cpus : 1;
+  if (options.uri.empty()) {
+    if (!server.start(0, options.server_threads))
+      return 1;
+    snprintf(buf, sizeof(buf), "ws://127.0.0.1:%u/", server.port());
+    options.uri = buf;
+  }
+  if (!uri.parse(options.uri.c_str()) || uri.scheme != "ws") {
+    printf("invalid uri %s, only ws supported\n", options.uri.c_str());
+    return 1;
+  }
+
+  // every thread ring keeps its latest events, so trace shows end of
+  // the run
+  if (!options.trace_file.empty())
+    Trace::enable(true);
+  vector<Worker*> workers;
+  atomic<uint32_t> ready{0};
+  atomic<int64_t> start{0};
+  for (i = 0; i < options.threads; ++i) {
+    Worker* w = new Worker();
+    uint32_t count = options.sessions / options.threads
+      + (i < options.sessions % options.threads ? 1 : 0);
+    w->rng.seed(i + 1);
+    w->thread = std::thread(&Worker::run, w, uri, count, &ready, &start);
+    workers.push_back(w);
+  }
+  while (ready < options.threads)
+    this_thread::sleep_for(milliseconds(1));
+  start = now_ns();
+  fprintf(stderr, "%s: %u sessions, %u threads, %s, message size up to "
+      "%u, warmup %us, measure %us\n", options.uri.c_str(), options.sessions,
+      options.threads, options.rate > 0 ? (options.poisson ? "poisson rate"
+        : "constant rate") : "closed loop", options.sizes.max(),
+      options.warmup, options.seconds);
+
+  Histogram connect_hist, upgrade_hist, rtt_hist;
+  uint64_t connect_failures = 0, sent = 0, received = 0, bytes = 0;
+  uint64_t errors = 0, lost = 0;
+  for (i = 0; i < workers.size(); ++i) {
+    Worker* w = workers[i];
+    w->thread.join();
+    connect_hist.merge(w->connect_hist);
+    upgrade_hist.merge(w->upgrade_hist);
+    rtt_hist.merge(w->rtt_hist);
+    connect_failures += w->connect_failures;
+    sent += w->sent;
+    received += w->received;
+    bytes += w->bytes;
+    errors += w->errors;
+    lost += w->lost;
+    delete w;
+  }
+  server.stop();
+  if (!options.trace_file.empty()) {
+    Trace::enable(false);
+    if (!Trace::write_chrome_trace(options.trace_file.c_str()))
+      fprintf(stderr, "write trace %s failed\n", options.trace_file.c_str());
+  }
+
+  double rate = (double)received / options.seconds;
+  double mbps = (double)bytes / options.seconds / (1024 * 1024);
+  if (options.json) {
+    printf("{\n  \"uri\": \"%s\",\n  \"sessions\": %u,\n  \"threads\": %u,\n"
+        "  \"target_rate\": %.1f,\n  \"seconds\": %u,\n"
+        "  \"connect_failures\": %llu,\n  \"sent\": %llu,\n"
+        "  \"received\": %llu,\n  \"errors\": %llu,\n  \"lost\": %llu,\n"
+        "  \"msgs_per_sec\": %.1f,\n  \"mb_per_sec\": %.2f,\n"
+        "  \"latency\": {\n", options.uri.c_str(), options.sessions,
+        options.threads, options.rate, options.seconds,
+        (unsigned long long)connect_failures, (unsigned long long)sent,
+        (unsigned long long)received, (unsigned long long)errors,
+        (unsigned long long)lost, rate, mbps);
+    print_hist_json("connect", connect_hist, false);
+    print_hist_json("ws_upgrade", upgrade_hist, false);
+    print_hist_json("round_trip", rtt_hist, true);
+    printf("  }\n}\n");
+  } else {
+    printf("connect failures %llu, sent %llu, received %llu, "
+        "session errors %llu, lost %llu\n",
+        (unsigned long long)connect_failures, (unsigned long long)sent,
+        (unsigned long long)received, (unsigned long long)errors,
+        (unsigned long long)lost);
+    printf("%.1f msgs/s, %.2f MB/s\n", rate, mbps);
+    printf("%-10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "ms", "count",
+        "min", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    print_hist_text("connect", connect_hist);
+    print_hist_text("upgrade", upgrade_hist);
+    print_hist_text("rtt", rtt_hist);
+  }
+  return errors || connect_failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "loop-group.h"
+#include "echo-server.h"
+
+// throughput scaling of LoopGroup with 1, 2, 4 ... N loop threads.
+// every session keeps one message in flight against the loopback echo
+// server.
+// usage: loop-bench [sessions] [message size] [seconds] [max threads]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+class BenchContext {
+public:
+  LoopGroup* group;
+  vector<char> payload;
+  atomic<bool> running{true};
+};
+
+// every session is the event handler of its own node chain
+class BenchSession : public EventHandler {
+public:
+  SocketNode sock_node;
+  WSNode ws_node;
+  vector<char> rdata;
+  vector<char> wdata;
+  vector<char> odata;
+  Buffer rbuf;
+  Buffer wbuf;
+  Buffer out;
+  Buffer in;
+  uint32_t wflags = OPCODE_BINARY | WSFRAME_FIN;
+  uint32_t rflags = 0;
+  NodeArgs<void> wargs;
+  NodeArgs<void> rargs;
+  BenchContext* context;
+  int32_t shard = -1;
+  // written only by the shard thread owns this session
+  uint64_t messages = 0;
+
+  void send() {
+    in.set_data(context->payload.data(), context->payload.size(), 0,
+        context->payload.size());
+    context->group->write(shard, &ws_node, &in, &wargs);
+  }
+
+  void on_read(Node* node, Buffer* data) {
+    ++messages;
+    if (context->running.load(memory_order_relaxed))
+      send();
+  }
+
+  void on_error(Node* node, const NodeError* err) {
+    printf("session failed: %s\n", err->desc);
+  }
+};
+
+static double run_case(uint32_t threads, uint32_t count, uint32_t msg_size,
+    uint32_t seconds, const Uri& uri) {
+  LoopGroup group;
+  BenchContext context;
+  vector<BenchSession*> sessions;
+  uint32_t i;
+  uint32_t bufsize = msg_size + 16;
+
+  if (!group.start(threads)) {
+    printf("start loop group failed\n");
+    return 0;
+  }
+  context.group = &group;
+  context.payload.resize(msg_size, 'x');
+  for (i = 0; i < count; ++i) {
+    BenchSession* s = new BenchSession();
+    s->context = &context;
+    s->rdata.resize(bufsize);
+    s->wdata.resize(bufsize);
+    s->odata.resize(bufsize);
+    s->rbuf.set_data(s->rdata.data(), bufsize, 0, 0);
+    s->wbuf.set_data(s->wdata.data(), bufsize, 0, 0);
+    s->out.set_data(s->odata.data(), bufsize, 0, 0);
+    s->ws_node.chain(&s->sock_node);
+    s->ws_node.set_read_buffer(&s->rbuf);
+    s->ws_node.set_write_buffer(&s->wbuf);
+    s->wargs.add(&s->wflags);
+    s->rargs.add(&s->rflags);
+    if (!s->ws_node.init(uri)) {
+      printf("session init failed: %s\n", s->ws_node.get_error()->desc);
+      delete s;
+      break;
+    }
+    s->shard = group.add(&s->ws_node, &s->out, s, &s->rargs);
+    sessions.push_back(s);
+  }
+  auto tp = steady_clock::now();
+  for (i = 0; i < sessions.size(); ++i) {
+    sessions[i]->send();
+  }
+  this_thread::sleep_for(std::chrono::seconds(seconds));
+  context.running = false;
+  auto d = duration_cast<microseconds>(steady_clock::now() - tp).count();
+  group.stop();
+
+  uint64_t total = 0;
+  for (i = 0; i < sessions.size(); ++i) {
+    total += sessions[i]->messages;
+    sessions[i]->ws_node.close();
+    delete sessions[i];
+  }
+  return d ? total * 1000000.0 / d : 0;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = argc > 1 ? atoi(argv[1]) : 256;
+  uint32_t msg_size = argc > 2 ? atoi(argv[2]) : 64;
+  uint32_t seconds = argc > 3 ? atoi(argv[3]) : 3;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t max_threads = argc > 4 ? atoi(argv[4]) : (cpus > 0 ? cpus : 1);
+  EchoServer server;
+  Uri uri;
+  char buf[64];
+
+  if (!server.start(0, max_threads))
+    return 1;
+  snprintf(buf, sizeof(buf), "ws://127.0.0.1:%u/", server.port());
+  uri.parse(buf);
+  printf("sessions %u, message size %u, %u seconds per case, %ld cpus\n",
+      count, msg_size, seconds, cpus);
+  printf("%8s %14s %12s %10s %12s\n", "threads", "msgs/s", "MB/s",
+      "speedup", "efficiency");
+  double base = 0;
+  uint32_t t = 1;
+  while (true) {
+    double r = run_case(t, count, msg_size, seconds, uri);
+    if (t == 1)
+      base = r;
+    double speedup = base > 0 ? r / base : 0;
+    printf("%8u %14.0f %12.2f %9.2fx %11.1f%%\n", t, r,
+        r * msg_size / 1048576, speedup, speedup * 100 / t);
+    if (t >= max_threads)
+      break;
+    t = t * 2 > max_threads ? max_threads : t * 2;
+  }
+  server.stop();
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "ws-frame.h"
+
+// compare websocket payload masking kernels. output of every supported
+// kernel is checked against scalar kernel before timing: payload sizes
+// 0..300, buffer offsets 0..7, in-place and out-of-place, mask phases
+// 0..3, and a payload masked in two chunks. exit 1 on mismatch.
+// usage: mask-bench [total MB per case]
+
+using namespace std;
+using namespace std::chrono;
+
+static const uint32_t payload_sizes[] = { 16, 125, 1024, 4096, 65536, 1048576 };
+
+#define CHECK_MAX_SIZE 300
+#define CHECK_MAX_OFFSET 8
+#define CHECK_GUARD 32
+
+// mask 'size' bytes at 'offset' of 'src' copied to 'buf' with 'kernel',
+// mask phase 'phase', split into two chunks at 'split' if not 0.
+// bytes around payload filled with 0xa5 to catch overrun
+static void mask_case(int32_t kernel, const vector<uint8_t>& src,
+    uint32_t size, uint32_t offset, uint32_t phase, uint32_t split,
+    bool inplace, vector<uint8_t>& buf) {
+  const char key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+  vector<uint8_t> in(src);
+  uint8_t* ip = in.data() + CHECK_GUARD + offset;
+  uint8_t* op;
+  uint32_t next;
+
+  memset(buf.data(), 0xa5, buf.size());
+  if (inplace) {
+    memcpy(buf.data() + CHECK_GUARD + offset, ip, size);
+    ip = buf.data() + CHECK_GUARD + offset;
+  }
+  op = buf.data() + CHECK_GUARD + offset;
+  lizard_ws_mask_set_kernel(kernel);
+  next = lizard_ws_frame_mask_payload_at(key, phase, ip, split, op);
+  lizard_ws_frame_mask_payload_at(key, next, ip + split, size - split,
+      op + split);
+}
+
+// return: false if any kernel differs from scalar kernel
+static bool check_kernels() {
+  vector<uint8_t> src(CHECK_GUARD * 2 + CHECK_MAX_OFFSET + CHECK_MAX_SIZE);
+  vector<uint8_t> expect(src.size());
+  vector<uint8_t> got(src.size());
+  uint32_t size, offset, phase, split, i;
+  int32_t k, inplace;
+  uint64_t cases = 0;
+
+  for (i = 0; i < src.size(); ++i)
+    src[i] = rand();
+  for (k = WSMASK_KERNEL_SCALAR; k < WSMASK_KERNEL_COUNT; ++k) {
+    if (!lizard_ws_mask_kernel_supported(k))
+      continue;
+    for (size = 0; size <= CHECK_MAX_SIZE; ++size) {
+      for (offset = 0; offset < CHECK_MAX_OFFSET; ++offset) {
+        for (phase = 0; phase < 4; ++phase) {
+          for (inplace = 0; inplace < 2; ++inplace) {
+            // whole payload at once, then split in two chunks
+            for (split = 0; split <= size; split += size / 3 + 1) {
+              mask_case(WSMASK_KERNEL_SCALAR, src, size, offset, phase, 0,
+                  inplace, expect);
+              mask_case(k, src, size, offset, phase, split, inplace, got);
+              ++cases;
+              if (memcmp(expect.data(), got.data(), got.size()) == 0)
+                continue;
+              printf("kernel %s mismatch: size %u offset %u phase %u "
+                  "inplace %d split %u\n", lizard_ws_mask_kernel_name(k),
+                  size, offset, phase, inplace, split);
+              lizard_ws_mask_set_kernel(WSMASK_KERNEL_AUTO);
+              return false;
+            }
+          }
+        }
+      }
+    }
+  }
+  lizard_ws_mask_set_kernel(WSMASK_KERNEL_AUTO);
+  printf("kernels match scalar in %llu cases\n", (unsigned long long)cases);
+  return true;
+}
+
+static double run_case(int32_t kernel, uint32_t size, uint32_t offset,
+    bool inplace, uint64_t total, vector<uint8_t>& in, vector<uint8_t>& out) {
+  const char key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+  uint64_t iters = total / size;
+  uint64_t i;
+  uint8_t* ip = in.data() + offset;
+  uint8_t* op = inplace ? ip : out.data() + offset;
+
+  if (iters == 0)
+    iters = 1;
+  lizard_ws_mask_set_kernel(kernel);
+  auto tp = steady_clock::now();
+  for (i = 0; i < iters; ++i) {
+    lizard_ws_frame_mask_payload(key, ip, size, op);
+  }
+  auto d = duration_cast<nanoseconds>(steady_clock::now() - tp).count();
+  // MB/s
+  return d ? (double)iters * size * 1000.0 / d : 0;
+}
+
+int main(int argc, char** argv) {
+  uint64_t total = 256;
+  uint32_t i;
+  int32_t k;
+
+  if (argc > 1)
+    total = strtoul(argv[1], nullptr, 10);
+  total *= 1024 * 1024;
+  vector<uint8_t> in(payload_sizes[sizeof(payload_sizes) / sizeof(uint32_t) - 1] + 64);
+  vector<uint8_t> out(in.size());
+  for (i = 0; i < in.size(); ++i)
+    in[i] = rand();
+
+  if (!check_kernels())
+    return 1;
+  printf("auto selected kernel: %s\n",
+      lizard_ws_mask_kernel_name(lizard_ws_mask_get_kernel()));
+  printf("%-8s %10s %8s %8s %12s %8s\n", "kernel", "size", "offset",
+      "inplace", "MB/s", "speedup");
+  for (i = 0; i < sizeof(payload_sizes) / sizeof(uint32_t); ++i) {
+    uint32_t offset;
+    for (offset = 0; offset < 2; ++offset) {
+      int32_t inplace;
+      for (inplace = 0; inplace < 2; ++inplace) {
+        double base = run_case(WSMASK_KERNEL_SCALAR, payload_sizes[i],
+            offset * 3, inplace, total, in, out);
+        for (k = WSMASK_KERNEL_SCALAR; k < WSMASK_KERNEL_COUNT; ++k) {
+          if (!lizard_ws_mask_kernel_supported(k))
+            continue;
+          double r = k == WSMASK_KERNEL_SCALAR ? base : run_case(k,
+              payload_sizes[i], offset * 3, inplace, total, in, out);
+          printf("%-8s %10u %8u %8s %12.1f %7.2fx\n",
+              lizard_ws_mask_kernel_name(k), payload_sizes[i], offset * 3,
+              inplace ? "yes" : "no", r, base > 0 ? r / base : 0);
+        }
+      }
+    }
+  }
+  lizard_ws_mask_set_kernel(WSMASK_KERNEL_AUTO);
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "ws-message.h"
+#include "buffer-pool.h"
+#include "echo-server.h"
+
+// regression of non-blocking write: unmasked frames written by
+// Node::write to a socket with a tiny send buffer, so gather writes of
+// WSNode often find the socket not writable before any byte of a frame
+// is written. a frame retried after would block must be sent again from
+// its header, echoes of the loopback echo server are checked frame by
+// frame for size and content.
+// usage: nonblock-write [frames] [small frame size] [large frame size]
+
+using namespace std;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static uint32_t frame_size(uint32_t i, uint32_t small, uint32_t large) {
+  return i % 3 == 2 ? large : small;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+  uint32_t small = argc > 2 ? strtoul(argv[2], nullptr, 10) : 300;
+  uint32_t large = argc > 3 ? strtoul(argv[3], nullptr, 10) : 5000;
+  EchoServer server;
+  SocketNode sock;
+  WSNode ws;
+  PoolBuffer rbuf(65536), wbuf(65536);
+  NodeArgs<Buffer> bufs;
+  WSMessage msg;
+  rokid::Uri uri;
+  vector<char> payload;
+  Buffer in;
+  struct pollfd pfd;
+  char str[64];
+  uint32_t sent = 0, received = 0, blocked = 0;
+  bool pending = false;
+  int sndbuf = 4096;
+
+  if (small == 0)
+    small = 1;
+  if (large == 0)
+    large = 1;
+  payload.resize(small > large ? small : large);
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", server.port());
+  uri.parse(str);
+  // no masking key, payload written by gather write of WSNode
+  ws.chain(&sock);
+  bufs.add(&rbuf);
+  ws.set_read_buffers(&bufs);
+  bufs.clear();
+  bufs.add(&wbuf);
+  ws.set_write_buffers(&bufs);
+  if (!ws.init(uri) || !ws.set_nonblock(true)) {
+    fprintf(stderr, "connect failed: %s\n", ws.get_error()->desc);
+    return 1;
+  }
+  if (setsockopt(ws.get_fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf,
+        sizeof(sndbuf)) < 0)
+    perror("setsockopt");
+
+  pfd.fd = ws.get_fd();
+  while (received < count) {
+    while (sent < count) {
+      if (!pending) {
+        uint32_t sz = frame_size(sent, small, large);
+        memset(payload.data(), 'a' + sent % 26, sz);
+        in.set_data(payload.data(), payload.size(), 0, sz);
+        pending = true;
+      }
+      // same buffer given again after would block, flush if all of it
+      // consumed
+      if (!(in.empty() ? ws.flush() : ws.write(&in))) {
+        if (!ws.would_block()) {
+          fprintf(stderr, "write failed: %s\n", ws.get_error()->desc);
+          return 1;
+        }
+        ++blocked;
+        break;
+      }
+      pending = false;
+      ++sent;
+    }
+    while (received < count) {
+      if (!ws.read_message(&msg)) {
+        if (!ws.would_block()) {
+          fprintf(stderr, "read failed: %s\n", ws.get_error()->desc);
+          return 1;
+        }
+        break;
+      }
+      uint32_t sz = frame_size(received, small, large);
+      const char* p = reinterpret_cast<const char*>(msg.data());
+      if (msg.opcode() != OPCODE_BINARY || msg.size() != sz
+          || p[0] != (char)('a' + received % 26) || p[sz - 1] != p[0]) {
+        fprintf(stderr, "echo %u corrupted: opcode %u, size %u of %u\n",
+            received, msg.opcode(), msg.size(), sz);
+        return 1;
+      }
+      ++received;
+    }
+    if (received >= count)
+      break;
+    pfd.events = POLLIN | (sent < count ? POLLOUT : 0);
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 1000) <= 0) {
+      fprintf(stderr, "no progress, %u frames sent, %u echoed\n",
+          sent, received);
+      return 1;
+    }
+  }
+  printf("frames %u of %u/%u bytes echoed intact, write blocked %u times\n",
+      count, small, large, blocked);
+  msg.release();
+  ws.close();
+  server.stop();
+  return 0;
+}
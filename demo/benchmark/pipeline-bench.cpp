@@ -0,0 +1,258 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "buffer-pool.h"
+#include "pipeline.h"
+#include "echo-server.h"
+
+// compare static Pipeline<WSLayer, ...> with the virtual WSNode chain:
+//   mem: bottom layer/node writes to nowhere and reads a canned frame, so
+//        only framing, masking and dispatch are measured.
+//   tcp: echo round trip over loopback with the bundled echo server.
+// usage: pipeline-bench [iterations of mem case] [iterations of tcp case]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static const uint32_t message_sizes[] = { 16, 128, 1024, 16384 };
+static const char mask_key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+static volatile uint64_t sink;
+
+// unmasked server frame with payload of 'size' bytes
+static vector<char> canned_frame(uint32_t size) {
+  vector<char> frame(size + 14);
+  int32_t c = lizard_ws_frame_create(OPCODE_BINARY, 1, 0, nullptr, size,
+      frame.data(), frame.size());
+  memset(frame.data() + c, 'a', size);
+  frame.resize(c + size);
+  return frame;
+}
+
+class MemNode : public Node {
+public:
+  const char* name() const { return "mem"; }
+
+  vector<char> frame;
+
+protected:
+  bool on_init(const rokid::Uri& uri, void* arg) { return true; }
+
+  int32_t on_write(Buffer* in, Buffer* out, void* arg) {
+    sink += in->size();
+    in->consume(in->size());
+    return 0;
+  }
+
+  // like a socket, deliver as much of the frame stream as fits
+  int32_t on_read(Buffer* out, Buffer* in, void* arg) {
+    uint32_t n = frame.size() - pos;
+    if (n > out->remain_space())
+      n = out->remain_space();
+    if (n == 0)
+      return -1;
+    out->append(frame.data() + pos, n);
+    pos = (pos + n) % frame.size();
+    return 0;
+  }
+
+  void on_close() {}
+
+private:
+  uint32_t pos = 0;
+};
+
+class MemLayer {
+public:
+  class Options {
+  };
+
+  static const bool CAN_WRITEV = false;
+
+  static const char* name() { return "mem"; }
+
+  template <typename Next>
+  bool init(Next& next, const rokid::Uri& uri, Options& opts) {
+    return true;
+  }
+
+  template <typename Next>
+  inline bool write(Next& next, const void* data, uint32_t size,
+      Options& opts) {
+    sink += size;
+    return true;
+  }
+
+  template <typename Next>
+  inline bool read(Next& next, Buffer* out, Options& opts) {
+    uint32_t n = frame.size() - pos;
+    if (n > out->remain_space())
+      n = out->remain_space();
+    if (n == 0)
+      return false;
+    out->append(frame.data() + pos, n);
+    pos = (pos + n) % frame.size();
+    return true;
+  }
+
+  void close() {}
+
+  vector<char> frame;
+
+private:
+  uint32_t pos = 0;
+};
+
+static void report(const char* name, uint32_t size, uint64_t iters,
+    int64_t ns) {
+  printf("%-16s %8u %10llu %12.1f ns/op\n", name, size,
+      (unsigned long long)iters, (double)ns / iters);
+}
+
+template <typename F>
+static int64_t timed(uint64_t iters, F func) {
+  uint64_t i;
+  for (i = 0; i < iters / 16 + 1; ++i) {
+    if (!func())
+      return -1;
+  }
+  auto tp = steady_clock::now();
+  for (i = 0; i < iters; ++i) {
+    if (!func())
+      return -1;
+  }
+  return duration_cast<nanoseconds>(steady_clock::now() - tp).count();
+}
+
+static bool bench_mem(uint32_t size, uint64_t iters) {
+  vector<char> payload(size, 'p');
+  PoolBuffer out(size + 64);
+  int64_t ns;
+
+  {
+    MemNode mem;
+    WSNode ws;
+    PoolBuffer rbuf, wbuf;
+    NodeArgs<Buffer> bufs;
+    mem.frame = canned_frame(size);
+    ws.chain(&mem);
+    ws.set_masking_key(mask_key);
+    bufs.add(&rbuf);
+    ws.set_read_buffers(&bufs);
+    bufs.clear();
+    bufs.add(&wbuf);
+    ws.set_write_buffers(&bufs);
+    ns = timed(iters, [&]() {
+      out.clear();
+      return ws.send_frame(payload.data(), size) && ws.read(&out);
+    });
+    if (ns < 0)
+      return false;
+    report("mem_node_chain", size, iters, ns);
+  }
+  {
+    Pipeline<WSLayer, MemLayer> pipe;
+    pipe.layer<0>().set_masking_key(mask_key);
+    pipe.layer<1>().frame = canned_frame(size);
+    ns = timed(iters, [&]() {
+      out.clear();
+      return pipe.write(payload.data(), size) && pipe.read(&out);
+    });
+    if (ns < 0)
+      return false;
+    report("mem_pipeline", size, iters, ns);
+  }
+  return true;
+}
+
+static bool bench_tcp(uint16_t port, uint32_t size, uint64_t iters) {
+  vector<char> payload(size, 'p');
+  PoolBuffer out(size + 64);
+  rokid::Uri uri;
+  char str[64];
+  int64_t ns;
+
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", port);
+  uri.parse(str);
+  {
+    SocketNode sock;
+    WSNode ws;
+    PoolBuffer rbuf, wbuf;
+    NodeArgs<Buffer> bufs;
+    ws.chain(&sock);
+    ws.set_masking_key(mask_key);
+    bufs.add(&rbuf);
+    ws.set_read_buffers(&bufs);
+    bufs.clear();
+    bufs.add(&wbuf);
+    ws.set_write_buffers(&bufs);
+    if (!ws.init(uri)) {
+      fprintf(stderr, "node chain connect failed: %s\n",
+          ws.get_error()->desc);
+      return false;
+    }
+    ws.set_nodelay(true);
+    ns = timed(iters, [&]() {
+      out.clear();
+      return ws.send_frame(payload.data(), size) && ws.read(&out)
+        && out.size() == size;
+    });
+    ws.close();
+    if (ns < 0)
+      return false;
+    report("tcp_node_chain", size, iters, ns);
+  }
+  {
+    Pipeline<WSLayer, TcpLayer> pipe;
+    pipe.layer<0>().set_masking_key(mask_key);
+    std::get<1>(pipe.options).nodelay = true;
+    if (!pipe.init(uri)) {
+      fprintf(stderr, "pipeline connect failed: %s: %s\n",
+          pipe.error_layer_name(), pipe.get_error()->desc);
+      return false;
+    }
+    ns = timed(iters, [&]() {
+      out.clear();
+      return pipe.write(payload.data(), size) && pipe.read(&out)
+        && out.size() == size;
+    });
+    if (ns < 0)
+      return false;
+    report("tcp_pipeline", size, iters, ns);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  uint64_t mem_iters = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  uint64_t tcp_iters = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000;
+  EchoServer server;
+  uint32_t i;
+
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  printf("%-16s %8s %10s %12s\n", "case", "size", "iters", "time");
+  for (i = 0; i < sizeof(message_sizes) / sizeof(uint32_t); ++i) {
+    if (!bench_mem(message_sizes[i], mem_iters)) {
+      fprintf(stderr, "mem case %u failed\n", message_sizes[i]);
+      return 1;
+    }
+  }
+  for (i = 0; i < sizeof(message_sizes) / sizeof(uint32_t); ++i) {
+    if (!bench_tcp(server.port(), message_sizes[i], tcp_iters)) {
+      fprintf(stderr, "tcp case %u failed\n", message_sizes[i]);
+      return 1;
+    }
+  }
+  server.stop();
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "resolver.h"
+
+// checks of Resolver cache and lookup sharing, with a stub lookup
+// function in place of getaddrinfo: hosts beginning with "fail" are not
+// found, others resolve to 10.0.0.<length of host name>. each lookup
+// sleeps 'lookup_delay' milliseconds and is counted.
+// usage: resolver-check
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid::lizard;
+
+static atomic<uint32_t> lookup_count{0};
+static atomic<uint32_t> lookup_delay{0};
+static uint32_t failures = 0;
+
+static int32_t stub_lookup(const char* host, vector<ResolvedAddr>& addrs) {
+  ++lookup_count;
+  if (lookup_delay.load())
+    this_thread::sleep_for(milliseconds(lookup_delay.load()));
+  if (strncmp(host, "fail", 4) == 0)
+    return EAI_NONAME;
+  ResolvedAddr ra;
+  memset(&ra.addr, 0, sizeof(ra.addr));
+  struct sockaddr_in* in4 = (struct sockaddr_in*)&ra.addr;
+  in4->sin_family = AF_INET;
+  in4->sin_addr.s_addr = htonl(0x0a000000 | (strlen(host) & 0xff));
+  ra.len = sizeof(*in4);
+  addrs.push_back(ra);
+  return 0;
+}
+
+static int64_t now_ms() {
+  return duration_cast<milliseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+static void check(bool ok, const char* what) {
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    ++failures;
+}
+
+// resolved to address given by stub lookup
+static bool stub_addr(const string& host, const vector<ResolvedAddr>& addrs) {
+  if (addrs.size() != 1 || addrs[0].addr.ss_family != AF_INET)
+    return false;
+  const struct sockaddr_in* in4 = (const struct sockaddr_in*)&addrs[0].addr;
+  return ntohl(in4->sin_addr.s_addr) == (0x0a000000 | host.size());
+}
+
+static int32_t resolve(const string& host, vector<ResolvedAddr>& addrs,
+    int64_t deadline = 0) {
+  addrs.clear();
+  return Resolver::instance()->resolve(host, addrs, deadline);
+}
+
+static void check_cache() {
+  vector<ResolvedAddr> addrs;
+  uint32_t n = lookup_count;
+  int32_t r = resolve("cache.test", addrs);
+  check(r == 0 && stub_addr("cache.test", addrs) && lookup_count == n + 1,
+      "miss: looked up");
+  r = resolve("cache.test", addrs);
+  check(r == 0 && stub_addr("cache.test", addrs) && lookup_count == n + 1,
+      "hit: served from cache");
+  this_thread::sleep_for(milliseconds(150));
+  r = resolve("cache.test", addrs);
+  check(r == 0 && stub_addr("cache.test", addrs) && lookup_count == n + 2,
+      "ttl expired: looked up again");
+  r = resolve("127.0.0.1", addrs);
+  check(r == 0 && addrs.size() == 1 && lookup_count == n + 2,
+      "numeric address: no lookup");
+}
+
+static void check_negative() {
+  vector<ResolvedAddr> addrs;
+  uint32_t n = lookup_count;
+  int32_t r = resolve("fail.test", addrs);
+  check(r == EAI_NONAME && addrs.empty() && lookup_count == n + 1,
+      "failure: error returned");
+  r = resolve("fail.test", addrs);
+  check(r == EAI_NONAME && lookup_count == n + 1,
+      "failure: cached for negative ttl");
+  // negative ttl 50ms, positive ttl 100ms
+  this_thread::sleep_for(milliseconds(70));
+  r = resolve("fail.test", addrs);
+  check(r == EAI_NONAME && lookup_count == n + 2,
+      "negative ttl expired: looked up again");
+}
+
+static void check_shared() {
+  uint32_t n = lookup_count;
+  atomic<uint32_t> ok{0};
+  vector<thread> threads;
+  lookup_delay = 100;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&ok]() {
+      vector<ResolvedAddr> addrs;
+      if (resolve("shared.test", addrs) == 0
+          && stub_addr("shared.test", addrs))
+        ++ok;
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  lookup_delay = 0;
+  check(ok == 4 && lookup_count == n + 1,
+      "concurrent resolves: one lookup shared");
+}
+
+static void check_deadline() {
+  vector<ResolvedAddr> addrs;
+  uint32_t n = lookup_count;
+  lookup_delay = 200;
+  int64_t tp = now_ms();
+  int32_t r = resolve("deadline.test", addrs, now_ms() + 30);
+  int64_t elapsed = now_ms() - tp;
+  check(r == EAI_AGAIN && addrs.empty() && elapsed < 150,
+      "deadline passed: EAI_AGAIN before lookup done");
+  // lookup continued after deadline, result cached
+  r = resolve("deadline.test", addrs);
+  lookup_delay = 0;
+  check(r == 0 && stub_addr("deadline.test", addrs) && lookup_count == n + 1,
+      "lookup after deadline: result of same lookup");
+}
+
+class AsyncResult {
+public:
+  mutex lock;
+  condition_variable cond;
+  bool done = false;
+  int32_t err = -1;
+  bool addr_ok = false;
+  thread::id tid;
+  string host;
+};
+
+static void on_resolved(int32_t err, const vector<ResolvedAddr>* addrs,
+    void* arg) {
+  AsyncResult* res = reinterpret_cast<AsyncResult*>(arg);
+  lock_guard<mutex> locker(res->lock);
+  res->err = err;
+  res->addr_ok = err == 0 && stub_addr(res->host, *addrs);
+  res->tid = this_thread::get_id();
+  res->done = true;
+  res->cond.notify_all();
+}
+
+static bool wait_result(AsyncResult* res) {
+  unique_lock<mutex> locker(res->lock);
+  return res->cond.wait_for(locker, seconds(2),
+      [res]() { return res->done; });
+}
+
+static void check_async() {
+  uint32_t n = lookup_count;
+  AsyncResult miss, hit, fail;
+
+  miss.host = "async.test";
+  lookup_delay = 50;
+  Resolver::instance()->resolve_async(miss.host, on_resolved, &miss);
+  {
+    lock_guard<mutex> locker(miss.lock);
+    check(!miss.done, "async miss: callback deferred");
+  }
+  check(wait_result(&miss) && miss.err == 0 && miss.addr_ok
+      && miss.tid != this_thread::get_id() && lookup_count == n + 1,
+      "async miss: callback in worker thread");
+  lookup_delay = 0;
+  hit.host = "async.test";
+  Resolver::instance()->resolve_async(hit.host, on_resolved, &hit);
+  check(hit.done && hit.err == 0 && hit.addr_ok
+      && hit.tid == this_thread::get_id() && lookup_count == n + 1,
+      "async hit: callback before return");
+  fail.host = "fail.async.test";
+  Resolver::instance()->resolve_async(fail.host, on_resolved, &fail);
+  check(wait_result(&fail) && fail.err == EAI_NONAME,
+      "async failure: error passed to callback");
+}
+
+int main(int argc, char** argv) {
+  Resolver* resolver = Resolver::instance();
+  resolver->set_lookup(stub_lookup);
+  resolver->set_ttl(100, 50);
+  resolver->set_max_workers(2);
+  resolver->clear_cache();
+
+  check_cache();
+  check_negative();
+  check_shared();
+  check_deadline();
+  check_async();
+
+  resolver->set_lookup(nullptr);
+  resolver->clear_cache();
+  if (failures) {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "ws-node.h"
+#include "ws-frame.h"
+
+// compare websocket frame reading with plain Buffer (Buffer::shift
+// memmove the unconsumed bytes) and mirrored ring MmapBuffer as read
+// buffer of WSNode. frames are fed by an in-memory node in chunks like
+// socket reads.
+// usage: ring-bench [total MB per case]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static const uint32_t frame_sizes[] = { 125, 1024, 8192, 30000 };
+static const uint32_t chunk_sizes[] = { 1500, 16384, 65536 };
+
+#define READ_BUFSIZE 65536
+
+// bottom node give bytes of a prebuilt frame stream, at most 'chunk'
+// bytes per read
+class StreamNode : public Node {
+public:
+  StreamNode(const vector<uint8_t>& s, uint32_t c) : stream(s), chunk(c) {
+  }
+
+  const char* name() const { return "stream"; }
+
+protected:
+  bool on_init(const rokid::Uri& uri, void* arg) { return true; }
+
+  int32_t on_write(Buffer* in, Buffer* out, void* arg) { return 0; }
+
+  int32_t on_read(Buffer* out, Buffer* in, void* arg) {
+    uint32_t n = out->remain_space();
+    if (n > chunk)
+      n = chunk;
+    if (n > stream.size() - pos)
+      n = stream.size() - pos;
+    out->append(stream.data() + pos, n);
+    pos += n;
+    if (pos == stream.size())
+      pos = 0;
+    return 0;
+  }
+
+  void on_close() {}
+
+private:
+  const vector<uint8_t>& stream;
+  uint32_t chunk;
+  size_t pos = 0;
+};
+
+static void build_stream(uint32_t frame_size, vector<uint8_t>& stream) {
+  char header[14];
+  uint32_t i, count = 1048576 / frame_size + 1;
+  int32_t hl = lizard_ws_frame_create(OPCODE_BINARY, 1, 0, nullptr,
+      frame_size, header, sizeof(header));
+
+  stream.clear();
+  for (i = 0; i < count; ++i) {
+    stream.insert(stream.end(), header, header + hl);
+    stream.resize(stream.size() + frame_size, (uint8_t)i);
+  }
+}
+
+// return: MB/s of frame payload
+static double run_case(Buffer* rbuf, const vector<uint8_t>& stream,
+    uint32_t frame_size, uint32_t chunk, uint64_t total) {
+  StreamNode snode(stream, chunk);
+  WSNode ws;
+  vector<uint8_t> odata(frame_size);
+  Buffer out(odata.data(), odata.size());
+  uint64_t frames = total / frame_size;
+  uint64_t i;
+
+  if (frames == 0)
+    frames = 1;
+  rbuf->clear();
+  ws.chain(&snode);
+  ws.set_read_buffer(rbuf);
+  auto tp = steady_clock::now();
+  for (i = 0; i < frames; ++i) {
+    out.clear();
+    if (!ws.read(&out)) {
+      printf("read frame failed: %s\n", ws.get_error()->desc);
+      return 0;
+    }
+  }
+  auto d = duration_cast<nanoseconds>(steady_clock::now() - tp).count();
+  return d ? (double)frames * frame_size * 1000.0 / d : 0;
+}
+
+int main(int argc, char** argv) {
+  uint64_t total = 512;
+  vector<uint8_t> stream;
+  vector<uint8_t> pdata(READ_BUFSIZE);
+  Buffer plain(pdata.data(), pdata.size());
+  MmapBuffer ring(READ_BUFSIZE);
+  uint32_t i, j;
+
+  if (argc > 1)
+    total = strtoul(argv[1], nullptr, 10);
+  total *= 1024 * 1024;
+  if (!ring.is_ring())
+    printf("mirrored mapping not supported, MmapBuffer is not a ring\n");
+  printf("read buffer %u bytes\n", READ_BUFSIZE);
+  printf("%10s %10s %12s %12s %8s\n", "frame", "chunk", "plain MB/s",
+      "ring MB/s", "speedup");
+  for (i = 0; i < sizeof(frame_sizes) / sizeof(uint32_t); ++i) {
+    build_stream(frame_sizes[i], stream);
+    for (j = 0; j < sizeof(chunk_sizes) / sizeof(uint32_t); ++j) {
+      double p = run_case(&plain, stream, frame_sizes[i], chunk_sizes[j],
+          total);
+      double r = run_case(&ring, stream, frame_sizes[i], chunk_sizes[j],
+          total);
+      printf("%10u %10u %12.1f %12.1f %7.2fx\n", frame_sizes[i],
+          chunk_sizes[j], p, r, p > 0 ? r / p : 0);
+    }
+  }
+  return 0;
+}
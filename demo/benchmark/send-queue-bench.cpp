@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "buffer-pool.h"
+#include "echo-server.h"
+
+// several producer threads send on one websocket connection by the send
+// queue of WSNode. a writer thread owns the chain in non-blocking mode,
+// woken by eventfd from queue notify, drains the queue and reads echoes
+// of the loopback echo server. producers back off on SEND_QUEUE_FULL
+// until SEND_QUEUE_LOW.
+// usage: send-queue-bench [producers] [messages per producer]
+//                         [message size] [queue limit bytes]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+static const char mask_key[4] = { 0x37, (char)0xfa, 0x21, 0x3d };
+
+class Bench {
+public:
+  Bench() : rbuf(65536), wbuf(65536) {
+    NodeArgs<Buffer> bufs;
+    ws.chain(&sock);
+    ws.set_masking_key(mask_key);
+    bufs.add(&rbuf);
+    ws.set_read_buffers(&bufs);
+    bufs.clear();
+    bufs.add(&wbuf);
+    ws.set_write_buffers(&bufs);
+  }
+
+  static void on_queue(WSNode* node, uint32_t event, void* arg) {
+    Bench* b = reinterpret_cast<Bench*>(arg);
+    if (event == WSNode::SEND_QUEUE_READY) {
+      uint64_t v = 1;
+      if (write(b->event_fd, &v, sizeof(v)) < 0)
+        perror("write eventfd");
+    } else {
+      lock_guard<std::mutex> locker(b->low_mutex);
+      b->low_cond.notify_all();
+    }
+  }
+
+  void produce(uint32_t count, uint32_t size) {
+    vector<char> payload(size, 'q');
+    uint32_t i = 0;
+    while (i < count) {
+      if (ws.enqueue_frame(payload.data(), size)) {
+        ++i;
+        continue;
+      }
+      if (ws.get_error()->code != WSNode::SEND_QUEUE_FULL) {
+        fprintf(stderr, "enqueue failed: %s\n", ws.get_error()->desc);
+        failed = true;
+        return;
+      }
+      ++full_count;
+      unique_lock<std::mutex> locker(low_mutex);
+      low_cond.wait_for(locker, milliseconds(10));
+    }
+  }
+
+  // writer thread, until 'total' echoes received
+  bool run_writer(uint64_t total) {
+    PoolBuffer out(65536);
+    struct pollfd pfds[2];
+    bool want_write = false;
+    uint64_t v;
+
+    pfds[0].fd = ws.get_fd();
+    pfds[1].fd = event_fd;
+    pfds[1].events = POLLIN;
+    while (received < total && !failed) {
+      if (!ws.drain_send_queue()) {
+        if (!ws.would_block())
+          return fail("drain");
+        want_write = true;
+      } else {
+        want_write = false;
+      }
+      while (true) {
+        out.clear();
+        if (ws.read(&out)) {
+          ++received;
+          continue;
+        }
+        if (!ws.would_block())
+          return fail("read");
+        break;
+      }
+      if (received >= total)
+        break;
+      pfds[0].events = POLLIN | (want_write ? POLLOUT : 0);
+      pfds[0].revents = pfds[1].revents = 0;
+      // queue notify only sent when queue was empty, wait shortly if not
+      if (poll(pfds, 2, ws.send_queue_frames() ? 0 : 100) < 0)
+        return fail("poll");
+      if (pfds[1].revents & POLLIN) {
+        if (read(event_fd, &v, sizeof(v)) < 0)
+          return fail("read eventfd");
+      }
+    }
+    return !failed;
+  }
+
+  bool fail(const char* what) {
+    fprintf(stderr, "%s failed: %s\n", what, ws.get_error()->desc);
+    failed = true;
+    return false;
+  }
+
+  SocketNode sock;
+  WSNode ws;
+  int event_fd = -1;
+  std::mutex low_mutex;
+  std::condition_variable low_cond;
+  std::atomic<uint64_t> full_count{0};
+  std::atomic<bool> failed{false};
+  uint64_t received = 0;
+
+private:
+  PoolBuffer rbuf;
+  PoolBuffer wbuf;
+};
+
+int main(int argc, char** argv) {
+  uint32_t producers = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+  uint32_t count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+  uint32_t size = argc > 3 ? strtoul(argv[3], nullptr, 10) : 128;
+  uint32_t limit = argc > 4 ? strtoul(argv[4], nullptr, 10) : 256 * 1024;
+  uint64_t total = (uint64_t)producers * count;
+  EchoServer server;
+  Bench bench;
+  rokid::Uri uri;
+  char str[64];
+  uint32_t i;
+
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", server.port());
+  uri.parse(str);
+  bench.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (bench.event_fd < 0 || !bench.ws.init(uri)
+      || !bench.ws.set_nonblock(true)) {
+    fprintf(stderr, "connect failed: %s\n", bench.ws.get_error()->desc);
+    return 1;
+  }
+  bench.ws.enable_send_queue(limit, Bench::on_queue, &bench);
+
+  auto tp = steady_clock::now();
+  vector<thread> threads;
+  for (i = 0; i < producers; ++i)
+    threads.emplace_back([&]() { bench.produce(count, size); });
+  bool ok = bench.run_writer(total);
+  for (auto& t : threads)
+    t.join();
+  double sec = duration_cast<nanoseconds>(steady_clock::now() - tp).count()
+    / 1e9;
+  if (ok) {
+    printf("producers %u, messages %llu of %u bytes, queue limit %u\n",
+        producers, (unsigned long long)total, size, limit);
+    printf("%.0f msgs/s, %.1f MB/s, queue full %llu times\n", total / sec,
+        total * size / sec / 1e6,
+        (unsigned long long)bench.full_count.load());
+  }
+  bench.ws.close();
+  close(bench.event_fd);
+  server.stop();
+  return ok ? 0 : 1;
+}
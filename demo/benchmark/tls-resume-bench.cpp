@@ -0,0 +1,283 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef HAS_SSL
+
+#include "ssl.h"
+#include "ssl_cache.h"
+#include "net.h"
+#include "certs.h"
+#include "pk.h"
+#include "entropy.h"
+#include "ctr_drbg.h"
+#include "ssl-node.h"
+
+// reconnect SSLNode to a local polarssl server:
+//   a new SSLConfig for every connection (ca parsed and random generator
+//   seeded per connection), a shared SSLConfig, and a shared SSLConfig
+//   with tls session cache.
+// server counts flights it sent before handshake finished, client waits
+// one round trip for each of them. a delay before every flight emulates
+// network round trip time. an abbreviated handshake is one flight of
+// server, so resumptions counted by server check hits of client session
+// cache (detected by unchanged master secret). cases with cache are run
+// against server session id cache and against session tickets only
+// (resumed only if ticket renewed by server is saved), then a failed
+// handshake must drop the session it offered. exit 1 if a check failed.
+// usage: tls-resume-bench [connects per case] [rtt ms]
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid;
+using namespace rokid::lizard;
+
+#define SERVER_PORT 38443
+
+class ServerConn {
+public:
+  int fd;
+  bool sending = false;
+  uint32_t flights = 0;
+};
+
+static int32_t rtt_ms = 0;
+static atomic<bool> server_running{true};
+static atomic<uint64_t> server_flights{0};
+static atomic<uint32_t> server_handshakes{0};
+static atomic<uint32_t> server_resumed{0};
+// close connections before handshake
+static atomic<bool> server_abort{false};
+// resume by session tickets instead of session id cache
+static atomic<bool> server_tickets{false};
+
+static int server_send(void* ctx, const unsigned char* buf, size_t len) {
+  ServerConn* conn = (ServerConn*)ctx;
+  if (!conn->sending) {
+    conn->sending = true;
+    ++conn->flights;
+    if (rtt_ms)
+      usleep(rtt_ms * 1000);
+  }
+  return net_send(&conn->fd, buf, len);
+}
+
+static int server_recv(void* ctx, unsigned char* buf, size_t len) {
+  ServerConn* conn = (ServerConn*)ctx;
+  conn->sending = false;
+  return net_recv(&conn->fd, buf, len);
+}
+
+static void run_server(int listen_fd) {
+  entropy_context entropy;
+  ctr_drbg_context ctr_drbg;
+  x509_crt srvcert;
+  pk_context pkey;
+  ssl_cache_context cache;
+  unsigned char buf[1024];
+  static const char* pers = "lizard_tls_bench";
+
+  entropy_init(&entropy);
+  ctr_drbg_init(&ctr_drbg, entropy_func, &entropy,
+      (const unsigned char*)pers, strlen(pers));
+  x509_crt_init(&srvcert);
+  x509_crt_parse(&srvcert, (const unsigned char*)test_srv_crt,
+      strlen(test_srv_crt));
+  pk_init(&pkey);
+  pk_parse_key(&pkey, (const unsigned char*)test_srv_key,
+      strlen(test_srv_key), nullptr, 0);
+  ssl_cache_init(&cache);
+
+  while (server_running) {
+    ServerConn conn;
+    ssl_context ssl;
+    if (net_accept(listen_fd, &conn.fd, nullptr) != 0)
+      continue;
+    if (server_abort) {
+      net_close(conn.fd);
+      continue;
+    }
+    memset(&ssl, 0, sizeof(ssl));
+    ssl_init(&ssl);
+    ssl_set_endpoint(&ssl, SSL_IS_SERVER);
+    ssl_set_authmode(&ssl, SSL_VERIFY_NONE);
+    ssl_set_rng(&ssl, ctr_drbg_random, &ctr_drbg);
+    ssl_set_bio(&ssl, server_recv, &conn, server_send, &conn);
+    if (server_tickets) {
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+      ssl_set_session_tickets(&ssl, SSL_SESSION_TICKETS_ENABLED);
+#endif
+    } else {
+      ssl_set_session_cache(&ssl, ssl_cache_get, &cache, ssl_cache_set,
+          &cache);
+    }
+    ssl_set_own_cert(&ssl, &srvcert, &pkey);
+    if (ssl_handshake(&ssl) == 0) {
+      server_flights += conn.flights;
+      // server hello, change cipher spec and finished in one flight
+      if (conn.flights == 1)
+        ++server_resumed;
+      ++server_handshakes;
+      // wait client close
+      while (ssl_read(&ssl, buf, sizeof(buf)) > 0);
+    }
+    net_close(conn.fd);
+    ssl_free(&ssl);
+  }
+  ssl_cache_free(&cache);
+  pk_free(&pkey);
+  x509_crt_free(&srvcert);
+  ctr_drbg_free(&ctr_drbg);
+  entropy_free(&entropy);
+}
+
+static double thread_cpu_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static bool run_case(const Uri& uri, uint32_t count, bool shared,
+    bool cache, bool tickets) {
+  SSLConfig shared_config;
+  SSLNode node;
+  uint32_t i;
+
+  // verify optional: certificate of test server is not issued for ip
+  if (!shared_config.init(test_ca_crt, SSLConfig::VERIFY_OPTIONAL)) {
+    printf("ssl config init failed\n");
+    return false;
+  }
+
+  SSLNode::set_session_cache(cache);
+  SSLNode::clear_session_cache();
+  server_tickets = tickets;
+  uint64_t hits = SSLNode::get_session_cache_hits();
+  uint64_t misses = SSLNode::get_session_cache_misses();
+  server_flights = 0;
+  server_handshakes = 0;
+  server_resumed = 0;
+  double cpu = thread_cpu_ms();
+  auto tp = steady_clock::now();
+  for (i = 0; i < count; ++i) {
+    SSLConfig config;
+    if (shared) {
+      node.set_config(&shared_config);
+    } else {
+      config.init(test_ca_crt, SSLConfig::VERIFY_OPTIONAL);
+      node.set_config(&config);
+    }
+    if (!node.init(uri)) {
+      printf("connect failed: %s\n", node.get_error()->desc);
+      return false;
+    }
+    node.close();
+  }
+  double ms = duration_cast<microseconds>(steady_clock::now() - tp).count()
+    / 1000.0;
+  cpu = thread_cpu_ms() - cpu;
+  // last handshake may be still finishing by server
+  while (server_handshakes < count)
+    usleep(1000);
+  hits = SSLNode::get_session_cache_hits() - hits;
+  misses = SSLNode::get_session_cache_misses() - misses;
+  printf("%10s %8s %12.3f %12.3f %12.2f %8llu %8llu %8u\n",
+      shared ? "shared" : "per-conn",
+      cache ? (tickets ? "ticket" : "on") : "off", ms / count, cpu / count,
+      (double)server_flights / count, (unsigned long long)hits,
+      (unsigned long long)misses, server_resumed.load());
+  // first connect of a case is a full handshake, all others resumed
+  bool ok = cache ? hits == count - 1 && misses == 1
+    : hits == 0 && misses == 0;
+  if (!ok || hits != server_resumed) {
+    printf("session cache hits %llu, resumed by server %u, expected %u\n",
+        (unsigned long long)hits, server_resumed.load(),
+        cache ? count - 1 : 0);
+    return false;
+  }
+  return true;
+}
+
+// a handshake failed after a cached session offered drops the session,
+// next connect is a full handshake and caches a new one
+static bool run_failure_case(const Uri& uri) {
+  SSLConfig config;
+  SSLNode node;
+
+  if (!config.init(test_ca_crt, SSLConfig::VERIFY_OPTIONAL))
+    return false;
+  node.set_config(&config);
+  SSLNode::set_session_cache(true);
+  SSLNode::clear_session_cache();
+  server_tickets = false;
+  bool ok = node.init(uri);
+  node.close();
+  server_abort = true;
+  ok = ok && !node.init(uri);
+  node.close();
+  server_abort = false;
+  uint64_t hits = SSLNode::get_session_cache_hits();
+  uint64_t misses = SSLNode::get_session_cache_misses();
+  ok = ok && node.init(uri);
+  node.close();
+  ok = ok && SSLNode::get_session_cache_hits() == hits
+    && SSLNode::get_session_cache_misses() == misses + 1;
+  ok = ok && node.init(uri);
+  node.close();
+  ok = ok && SSLNode::get_session_cache_hits() == hits + 1;
+  printf("failed handshake drops offered session: %s\n",
+      ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = 200;
+  int listen_fd;
+  Uri uri;
+
+  if (argc > 1)
+    count = strtoul(argv[1], nullptr, 10);
+  if (argc > 2)
+    rtt_ms = atoi(argv[2]);
+  if (count == 0)
+    count = 1;
+  if (net_bind(&listen_fd, "127.0.0.1", SERVER_PORT) != 0) {
+    printf("bind port %d failed\n", SERVER_PORT);
+    return 1;
+  }
+  thread server(run_server, listen_fd);
+  uri.parse("wss://127.0.0.1:38443/");
+  printf("%u connects per case, emulated rtt %d ms\n", count, rtt_ms);
+  printf("%10s %8s %12s %12s %12s %8s %8s %8s\n", "config", "cache",
+      "connect ms", "client cpu", "flights", "hits", "misses", "resumed");
+  bool r = run_case(uri, count, false, false, false)
+    && run_case(uri, count, true, false, false)
+    && run_case(uri, count, true, true, false)
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    && run_case(uri, count, true, true, true)
+#endif
+    && run_failure_case(uri);
+  server_running = false;
+  // wake server blocked in accept
+  SSLNode node;
+  node.init(uri);
+  node.close();
+  server.join();
+  net_close(listen_fd);
+  return r ? 0 : 1;
+}
+
+#else // HAS_SSL
+
+int main(int argc, char** argv) {
+  printf("not support ssl\n");
+  return 1;
+}
+
+#endif // HAS_SSL
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ws-pool.h"
+#include "ws-frame.h"
+#include "echo-server.h"
+
+// checks of WSPool against the loopback echo server: warm and get hit,
+// get miss, put reuse, idle session kept by ping/pong, stale idle
+// session dropped by get and by health check after server closed, and
+// refill with backoff after connect failed.
+// usage: ws-pool-check
+
+using namespace std;
+using namespace std::chrono;
+using namespace rokid::lizard;
+
+static uint32_t failures = 0;
+
+static void check(bool ok, const char* what) {
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    ++failures;
+}
+
+// wait until 'uri' has 'count' idle sessions, at most 'timeout' ms
+static bool wait_idle(WSPool& pool, const string& uri, uint32_t count,
+    int32_t timeout) {
+  auto end = steady_clock::now() + milliseconds(timeout);
+  while (pool.idle_count(uri) != count) {
+    if (steady_clock::now() >= end)
+      return false;
+    this_thread::sleep_for(milliseconds(5));
+  }
+  return true;
+}
+
+// one echo round trip on session
+static bool echo(WSSession* session) {
+  static const char msg[] = "pooled";
+  char data[64];
+  Buffer out(data, sizeof(data));
+  WSNode* ws = session->node();
+  if (!ws->send_frame(msg, sizeof(msg)))
+    return false;
+  if (!ws->read(&out))
+    return false;
+  return out.size() == sizeof(msg)
+    && memcmp(out.data_begin(), msg, sizeof(msg)) == 0;
+}
+
+// pong frames received by websocket node of session
+static uint64_t pongs(WSSession* session) {
+  vector<NodeStatsSnapshot> stats;
+  session->node()->snapshot_stats(stats);
+  return stats.empty() ? 0 : stats[0].frames_in[OPCODE_PONG];
+}
+
+int main(int argc, char** argv) {
+  EchoServer server;
+  WSPool pool;
+  NodeError err;
+  uint16_t port;
+  char str[64];
+
+  if (!server.start()) {
+    fprintf(stderr, "start echo server failed\n");
+    return 1;
+  }
+  port = server.port();
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/", port);
+  string uri = str;
+  snprintf(str, sizeof(str), "ws://127.0.0.1:%u/other", port);
+  string other = str;
+  // no periodic check until health check case
+  pool.set_check_interval(30000, 500);
+  pool.set_connect_timeout(1000);
+
+  check(pool.warm(uri, 1) && wait_idle(pool, uri, 1, 3000),
+      "warm: idle session connected");
+  WSSession* s = pool.get(uri);
+  check(s && pool.get_hits() == 1 && pool.get_misses() == 0 && echo(s),
+      "get: idle session handed out");
+  pool.put(s);
+  WSSession* again = pool.get(uri);
+  check(again == s && pool.get_hits() == 2, "put: session reused by get");
+  pool.put(again);
+
+  WSSession* m = pool.get(other, 1000);
+  check(m && pool.get_misses() == 1 && echo(m),
+      "get miss: connected in caller thread");
+  pool.put(m);
+
+  // idle session answers ping of health check, kept
+  uint64_t before = pongs(again);
+  pool.set_check_interval(50, 500);
+  this_thread::sleep_for(milliseconds(200));
+  s = pool.get(uri);
+  check(s == again && echo(s), "health check: live session kept");
+#ifndef LIZARD_NO_STATS
+  check(s && pongs(s) > before, "health check: pong received");
+#endif
+  pool.put(s);
+  pool.set_check_interval(30000, 500);
+  check(wait_idle(pool, uri, 1, 1000), "put: session idle again");
+
+  // remote closed idle session, get drops it and connect fails
+  server.stop();
+  this_thread::sleep_for(milliseconds(50));
+  uint64_t misses = pool.get_misses();
+  s = pool.get(uri, 500, &err);
+  check(s == nullptr && pool.get_misses() == misses + 1 && err.code != 0,
+      "get: stale session dropped, connect failed");
+
+  // refill retried with backoff until server back
+  this_thread::sleep_for(milliseconds(300));
+  check(pool.idle_count(uri) == 0, "refill: nothing while server down");
+  if (!server.start(port)) {
+    fprintf(stderr, "restart echo server failed\n");
+    return 1;
+  }
+  check(wait_idle(pool, uri, 1, 5000), "refill: reconnected after failures");
+  s = pool.get(uri);
+  check(s && echo(s), "refill: new session works");
+  pool.put(s);
+  check(wait_idle(pool, uri, 1, 1000), "refill: session idle again");
+
+  // remote closed idle session, health check drops it without get
+  server.stop();
+  pool.set_check_interval(50, 500);
+  check(wait_idle(pool, uri, 0, 2000), "health check: dead session dropped");
+
+  pool.stop();
+  if (failures) {
+    printf("%u checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
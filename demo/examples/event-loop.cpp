@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "sock-node.h"
+#include "ws-node.h"
+#include "ws-frame.h"
+#include "event-loop.h"
+
+// open many websocket sessions and echo "hello" on all of them
+// in one thread
+// usage: event-loop [session count]
+
+#define SERVER_URI "ws://localhost:3000/"
+#define ECHO_TIMES 10
+
+using namespace rokid;
+using namespace rokid::lizard;
+
+class Session {
+public:
+  SocketNode sock_node;
+  WSNode ws_node;
+  char rdata[256];
+  char wdata[256];
+  char odata[256];
+  Buffer rbuf{rdata, sizeof(rdata)};
+  Buffer wbuf{wdata, sizeof(wdata)};
+  Buffer out{odata, sizeof(odata)};
+  Buffer in;
+  uint32_t wflags = OPCODE_TEXT | WSFRAME_FIN;
+  uint32_t rflags = 0;
+  NodeArgs<void> wargs;
+  NodeArgs<void> rargs;
+  uint32_t echo_count = 0;
+};
+
+class EchoHandler : public EventHandler {
+public:
+  EventLoop* loop;
+  uint32_t finished = 0;
+  uint32_t total = 0;
+
+  void on_read(Node* node, Buffer* data) {
+    Session* s = find(node);
+    if (++s->echo_count == ECHO_TIMES) {
+      done(s);
+      return;
+    }
+    send(s);
+  }
+
+  void on_error(Node* node, const NodeError* err) {
+    printf("node %s failed: %s\n", err->node ? err->node->name() : "",
+        err->desc);
+    done(find(node));
+  }
+
+  void send(Session* s) {
+    s->in.set_data((void*)"hello", 5, 0, 5);
+    if (!loop->write(&s->ws_node, &s->in, &s->wargs)) {
+      printf("write failed: %s\n", s->ws_node.get_error()->desc);
+      done(s);
+    }
+  }
+
+  Session* find(Node* node) {
+    uint32_t i;
+    for (i = 0; i < sessions.size(); ++i) {
+      if (&sessions[i]->ws_node == node)
+        return sessions[i];
+    }
+    return nullptr;
+  }
+
+  void done(Session* s) {
+    loop->remove(&s->ws_node);
+    s->ws_node.close();
+    if (++finished == total)
+      loop->stop();
+  }
+
+  std::vector<Session*> sessions;
+};
+
+int main(int argc, char** argv) {
+  uint32_t count = argc > 1 ? atoi(argv[1]) : 100;
+  uint32_t i;
+  EventLoop loop;
+  EchoHandler handler;
+  Uri uri;
+
+  if (!uri.parse(SERVER_URI)) {
+    printf("parse server uri failed\n");
+    return 1;
+  }
+  if (!loop.init()) {
+    printf("event loop init failed\n");
+    return 1;
+  }
+  handler.loop = &loop;
+  for (i = 0; i < count; ++i) {
+    Session* s = new Session();
+    s->ws_node.chain(&s->sock_node);
+    s->ws_node.set_read_buffer(&s->rbuf);
+    s->ws_node.set_write_buffer(&s->wbuf);
+    s->wargs.add(&s->wflags);
+    s->rargs.add(&s->rflags);
+    if (!s->ws_node.init(uri)) {
+      printf("session %u init failed: %s\n", i,
+          s->ws_node.get_error()->desc);
+      delete s;
+      continue;
+    }
+    handler.sessions.push_back(s);
+    loop.add(&s->ws_node, &s->out, &handler, &s->rargs);
+  }
+  handler.total = handler.sessions.size();
+  if (handler.total == 0)
+    return 1;
+  for (i = 0; i < handler.sessions.size(); ++i) {
+    handler.send(handler.sessions[i]);
+  }
+  loop.run();
+  printf("%u sessions finished\n", handler.finished);
+  for (i = 0; i < handler.sessions.size(); ++i) {
+    delete handler.sessions[i];
+  }
+  return 0;
+}
@@ -15,20 +15,20 @@ int main(int argc, char** argv) {
     return 1;
   }
   if (!cli.init(uri)) {
-    printf("node init failed: %s\n", cli.get_error()->desc.c_str());
+    printf("node init failed: %s\n", cli.get_error()->desc);
     return 1;
   }
   buf.set_data((char*)"hello", 5, 0, 5);
   if (!cli.write(&buf)) {
     cli.close();
-    printf("node write failed: %s\n", cli.get_error()->desc.c_str());
+    printf("node write failed: %s\n", cli.get_error()->desc);
     return 1;
   }
   char data[32];
   buf.set_data(data, sizeof(data), 0, 0);
   if (!cli.read(&buf)) {
     cli.close();
-    printf("node read failed: %s\n", cli.get_error()->desc.c_str());
+    printf("node read failed: %s\n", cli.get_error()->desc);
     return 1;
   }
   data[buf.size()] = '\0';
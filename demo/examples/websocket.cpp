@@ -10,6 +10,29 @@
 using namespace rokid;
 using namespace rokid::lizard;
 
+static void print_stats(const Node& node) {
+  std::vector<NodeStatsSnapshot> stats;
+  uint32_t i;
+
+  node.snapshot_stats(stats);
+  for (auto& s : stats) {
+    printf("%s:", s.name);
+    for (i = 0; i < NodeStats::COUNT; ++i) {
+      if (s.counters[i])
+        printf(" %s=%llu", NodeStats::counter_name(i),
+            (unsigned long long)s.counters[i]);
+    }
+    for (i = 0; i < NodeStats::OPCODE_SLOTS; ++i) {
+      if (s.frames_in[i] || s.frames_out[i])
+        printf(" op%u=%llu/%llu", i, (unsigned long long)s.frames_in[i],
+            (unsigned long long)s.frames_out[i]);
+    }
+    for (auto& e : s.errors)
+      printf(" error(%d)=%llu", e.first, (unsigned long long)e.second);
+    printf("\n");
+  }
+}
+
 int main(int argc, char** argv) {
   SocketNode sock_node;
 #ifdef HAS_SSL
@@ -45,7 +68,7 @@ int main(int argc, char** argv) {
   cli.set_write_buffers(&bufs);
   if (!cli.init(uri)) {
     err = cli.get_error();
-    printf("node %s init failed: %s\n", err->node->name(), err->desc.c_str());
+    printf("node %s init failed: %s\n", err->node->name(), err->desc);
     return 1;
   }
 
@@ -55,13 +78,13 @@ int main(int argc, char** argv) {
   if (!cli.send_frame("hello", 5)) {
     cli.close();
     err = cli.get_error();
-    printf("node %s write failed: %s\n", err->node->name(), err->desc.c_str());
+    printf("node %s write failed: %s\n", err->node->name(), err->desc);
     return 1;
   }
   if (!cli.read(&buf)) {
     cli.close();
     err = cli.get_error();
-    printf("node %s read failed: %s\n", err->node->name(), err->desc.c_str());
+    printf("node %s read failed: %s\n", err->node->name(), err->desc);
     return 1;
   }
   reinterpret_cast<char *>(buf.data_end())[0] = '\0';
@@ -72,13 +95,13 @@ int main(int argc, char** argv) {
   if (!cli.send_frame("world", 5)) {
     cli.close();
     err = cli.get_error();
-    printf("node %s write failed: %s\n", err->node->name(), err->desc.c_str());
+    printf("node %s write failed: %s\n", err->node->name(), err->desc);
     return 1;
   }
   if (!cli.read(&buf)) {
     cli.close();
     err = cli.get_error();
-    printf("node %s read failed: %s\n", err->node->name(), err->desc.c_str());
+    printf("node %s read failed: %s\n", err->node->name(), err->desc);
     return 1;
   }
   reinterpret_cast<char *>(buf.data_end())[0] = '\0';
@@ -109,9 +132,10 @@ int main(int argc, char** argv) {
   args.add(&timeout);
   if (!cli.read(&buf, &args)) {
     err = cli.get_error();
-    printf("%s\n", err->desc.c_str());
+    printf("%s\n", err->desc);
   }
 
+  print_stats(cli);
   cli.close();
   return 0;
 }
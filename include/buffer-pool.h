@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+#include "node.h"
+
+namespace rokid {
+namespace lizard {
+
+// process wide allocator of node buffers, power of two size classes from
+// 2KB to 64MB. every thread caches a few free blocks of each class, so
+// get/put in steady state take no lock and no malloc.
+// blocks may be carved from an optional arena backed by hugepages.
+class BufferPool {
+public:
+  static BufferPool* instance();
+
+  // return: block of at least 'size' bytes, '*cap' is real size of block.
+  //         nullptr if 'size' larger than MAX_SIZE or out of memory
+  void* get(uint32_t size, uint32_t* cap);
+
+  // 'cap' must be the size returned by get
+  void put(void* p, uint32_t cap);
+
+  // reserve 'size' bytes for blocks not larger than ARENA_MAX_SIZE.
+  // 'hugepage': map with MAP_HUGETLB, fallback to transparent hugepages.
+  // should be called before any buffer allocated, only once.
+  bool init_arena(size_t size, bool hugepage = true);
+
+  // free blocks cached by central lists, arena blocks are kept
+  void trim();
+
+  static uint32_t class_size(uint32_t size);
+
+public:
+  static const uint32_t MIN_SHIFT = 11;
+  static const uint32_t MAX_SHIFT = 26;
+  static const uint32_t CLASS_COUNT = MAX_SHIFT - MIN_SHIFT + 1;
+  static const uint32_t MIN_SIZE = 1u << MIN_SHIFT;
+  static const uint32_t MAX_SIZE = 1u << MAX_SHIFT;
+  static const uint32_t ARENA_MAX_SIZE = 64 * 1024;
+
+private:
+  BufferPool() {}
+
+  static uint32_t class_index(uint32_t size);
+
+  void* arena_alloc(uint32_t cls);
+
+  bool in_arena(void* p) const;
+
+  // move blocks between thread cache and central list
+  uint32_t fetch(uint32_t cls, void** blocks, uint32_t count);
+
+  void release(uint32_t cls, void** blocks, uint32_t count);
+
+  friend class ThreadCache;
+
+private:
+  std::mutex mutexes[CLASS_COUNT];
+  std::vector<void*> free_lists[CLASS_COUNT];
+  std::mutex arena_mutex;
+  int8_t* arena = nullptr;
+  size_t arena_size = 0;
+  size_t arena_used = 0;
+};
+
+// Buffer owns a block of BufferPool. a node chain using PoolBuffers grows
+// its buffers when a frame larger than buffer arrived, and shrinks them
+// back to initial size by Node::shrink_buffers when idle.
+class PoolBuffer : public Buffer {
+public:
+  PoolBuffer(uint32_t size = BufferPool::MIN_SIZE);
+
+  ~PoolBuffer();
+
+  PoolBuffer(const PoolBuffer&) = delete;
+
+  PoolBuffer& operator=(const PoolBuffer&) = delete;
+
+  bool reserve(uint32_t size);
+
+  void shrink();
+
+private:
+  // size of block allocated by constructor, shrink back to it
+  uint32_t base_size;
+};
+
+} // namespace lizard
+} // namespace rokid
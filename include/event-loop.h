@@ -0,0 +1,119 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "node.h"
+
+namespace rokid {
+namespace lizard {
+
+// callbacks of node chains registered to EventLoop, invoked in loop thread
+class EventHandler {
+public:
+  virtual ~EventHandler() = default;
+
+  // 'node' read a complete result into 'data',
+  // 'data' is cleared after callback returned
+  virtual void on_read(Node* node, Buffer* data) = 0;
+
+  // all pending writes of 'node' finished
+  virtual void on_drain(Node* node) {}
+
+  // read or write of 'node' failed, include remote closed.
+  // 'node' already removed from loop, but not closed
+  virtual void on_error(Node* node, const NodeError* err) = 0;
+};
+
+// epoll reactor drive many initialized node chains in one thread.
+// all methods except stop must be called in loop thread.
+class EventLoop {
+public:
+  EventLoop();
+
+  ~EventLoop();
+
+  bool init();
+
+  // register an initialized node chain, socket of chain switched to
+  // non-blocking mode.
+  // 'out': read results of chain
+  // 'read_args': args passed to Node::read
+  bool add(Node* node, Buffer* out, EventHandler* handler,
+      NodeArgs<void>* read_args = nullptr);
+
+  // unregister node chain, pending writes dropped, chain keeps in
+  // non-blocking mode
+  void remove(Node* node);
+
+  // write to a node chain registered in this loop.
+  // if write could not finish immediately, it is queued and resumed when
+  // socket writable, 'in' and 'args' must be valid until on_drain.
+  // return: false  write failed, 'node' not removed
+  bool write(Node* node, Buffer* in, NodeArgs<void>* args = nullptr);
+
+  // wait events for at most 'timeout' milliseconds, -1 wait forever
+  // return: count of events handled, -1 if failed
+  int32_t run_once(int32_t timeout);
+
+  // run until stop
+  void run();
+
+  // thread safe, wakeup loop and let run return
+  void stop();
+
+  // thread safe, let waiting run_once return
+  void wakeup();
+
+  inline uint32_t size() const { return channel_count; }
+
+private:
+  class PendingWrite {
+  public:
+    Buffer* in;
+    NodeArgs<void>* args;
+  };
+
+  class Channel {
+  public:
+    Node* node;
+    int fd;
+    Buffer* out;
+    EventHandler* handler;
+    NodeArgs<void>* read_args;
+    std::deque<PendingWrite> writes;
+    uint32_t events;
+    bool removed;
+    bool read_pending;
+  };
+
+  Channel* find_channel(Node* node);
+
+  bool update_events(Channel* ch, uint32_t events);
+
+  void handle_read(Channel* ch);
+
+  void handle_write(Channel* ch);
+
+  void fail(Channel* ch);
+
+  void drop(Channel* ch);
+
+private:
+  int epoll_fd = -1;
+  int event_fd = -1;
+  std::atomic<bool> stopped{false};
+  uint32_t channel_count = 0;
+  std::vector<Channel*> channels;
+  // channels with data remained in node buffers, not signaled by epoll
+  std::vector<Channel*> ready_channels;
+  // removed channels, freed after events handled
+  std::vector<Channel*> dead_channels;
+};
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
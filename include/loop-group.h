@@ -0,0 +1,70 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "event-loop.h"
+
+namespace rokid {
+namespace lizard {
+
+class LoopShard;
+
+// N EventLoop threads, each thread pinned to a cpu core and owns a shard of
+// node chains. a node chain, include its buffers and error state, is only
+// touched by the thread of its shard after added. requests from other
+// threads are handed off to the owner thread by a lock-free queue.
+class LoopGroup {
+public:
+  LoopGroup();
+
+  ~LoopGroup();
+
+  // start 'count' loop threads, 0 means count of online cpus
+  // 'pin': bind thread i to cpu i % cpus
+  bool start(uint32_t count = 0, bool pin = true);
+
+  // stop and join all loop threads, node chains are removed but not closed
+  void stop();
+
+  // thread safe. place an initialized node chain on the least loaded shard,
+  // 'handler' is invoked in thread of the shard.
+  // return: shard index, -1 if failed
+  int32_t add(Node* node, Buffer* out, EventHandler* handler,
+      NodeArgs<void>* read_args = nullptr);
+
+  // thread safe. remove node chain from its shard asynchronously,
+  // 'done' is invoked in shard thread after removed
+  bool remove(int32_t shard, Node* node, void (*done)(Node*, void*) = nullptr,
+      void* arg = nullptr);
+
+  // thread safe. write to node chain in its shard thread, same as
+  // EventLoop::write, 'in' and 'args' must be valid until on_drain.
+  // a write failed immediately is reported by on_error and node removed.
+  bool write(int32_t shard, Node* node, Buffer* in,
+      NodeArgs<void>* args = nullptr);
+
+  // thread safe. run 'func' in thread of the shard
+  bool call(int32_t shard, void (*func)(void*), void* arg);
+
+  // count of node chains owned by the shard
+  uint32_t load(int32_t shard) const;
+
+  inline uint32_t size() const { return shards.size(); }
+
+  // thread index of current thread, -1 if not a loop thread of this group
+  int32_t current_shard() const;
+
+private:
+  LoopShard* get_shard(int32_t shard) const;
+
+private:
+  std::vector<LoopShard*> shards;
+};
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <sys/uio.h>
+#include <atomic>
+#include <utility>
 #include <vector>
 #include <string>
 #include "uri.h"
@@ -11,7 +14,8 @@ class Node;
 typedef struct {
   Node* node;
   int32_t code;
-  std::string desc;
+  // static string, never freed, so setting error never allocates
+  const char* desc = "";
 } NodeError;
 
 class Buffer {
@@ -21,13 +25,17 @@ public:
   Buffer(void* p, uint32_t size) : datap((int8_t*)p), capacity(size) {
   }
 
+  virtual ~Buffer() = default;
+
   void set_data(void* p, uint32_t size, uint32_t b, uint32_t e);
 
   void obtain(uint32_t size);
 
   void consume(uint32_t size);
 
-  void shift();
+  // move data to buffer begin
+  // return: bytes moved
+  uint32_t shift();
 
   void clear();
 
@@ -45,62 +53,203 @@ public:
 
   void* data_end() { return datap + end; }
 
-  uint32_t remain_space() const { return capacity - end; }
+  // ring buffer: free space is 'capacity' minus size, always contiguous
+  // after data_end()
+  uint32_t remain_space() const {
+    return ring ? capacity - (end - begin) : capacity - end;
+  }
 
   uint32_t total_space() const { return capacity; }
 
+  bool is_ring() const { return ring; }
+
+  // make total space at least 'size', data kept.
+  // return: false  buffer not growable and smaller than 'size'
+  virtual bool reserve(uint32_t size) { return size <= capacity; }
+
+  // give back memory grown by reserve if buffer idle
+  virtual void shrink() {}
+
 protected:
   int8_t* datap = nullptr;
   uint32_t begin = 0;
   uint32_t end = 0;
   uint32_t capacity = 0;
+  // memory at [datap + capacity, datap + capacity * 2) mirrors
+  // [datap, datap + capacity), data never moved by shift
+  bool ring = false;
 };
 
-/**
+// ring buffer of a memfd mapped twice back to back, data wrapped around
+// buffer end is still contiguous, so shift() never memmove.
+// size rounded up to page size. fallback to a plain anonymous mapping if
+// mirrored mapping not supported, is_ring() return false then.
 class MmapBuffer : public Buffer {
 public:
   MmapBuffer(uint32_t size);
 
   ~MmapBuffer();
+
+  MmapBuffer(const MmapBuffer&) = delete;
+
+  MmapBuffer& operator=(const MmapBuffer&) = delete;
+
+private:
+  bool map_ring(uint32_t size);
+
+private:
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
 };
-*/
 
+// args of nodes of a chain, top node first.
+// first INLINE_COUNT args stored in place, args on stack of a send or read
+// call cost no heap allocation
 template <typename T>
 class NodeArgs {
 public:
-  NodeArgs() {
-    queue.reserve(4);
-  }
-
   void add(T *v) {
-    queue.push_back(v);
+    if (count < INLINE_COUNT)
+      inline_queue[count] = v;
+    else
+      more.push_back(v);
+    ++count;
   }
 
   T* get(uint32_t* idx = nullptr) {
     if (idx)
       *idx = queue_index;
-    if (queue.size() <= queue_index)
+    if (count <= queue_index)
       return nullptr;
-    T *v = queue[queue_index];
+    T *v = at(queue_index);
     ++queue_index;
     return v;
   }
 
   void restore(uint32_t idx) {
-    if (idx < queue.size())
+    if (idx < count)
       queue_index = idx;
   }
 
   void clear() {
-    queue.clear();
+    more.clear();
+    count = 0;
     queue_index = 0;
   }
 
+public:
+  static const uint32_t INLINE_COUNT = 4;
+
+private:
+  inline T* at(uint32_t i) const {
+    return i < INLINE_COUNT ? inline_queue[i] : more[i - INLINE_COUNT];
+  }
+
 private:
-  std::vector<T*> queue;
+  T* inline_queue[INLINE_COUNT];
+  std::vector<T*> more;
+  uint32_t count{0};
   uint32_t queue_index{0};
 };
 
+// counters of a node. only updated by the thread operating the chain, and
+// may be read by any thread, so counters are relaxed atomics updated by
+// plain load and store, no locked instruction.
+// counting is compiled out if library built with LIZARD_NO_STATS, counters
+// stay zero then.
+class NodeStats {
+public:
+  NodeStats() { reset(); }
+
+  NodeStats(const NodeStats&) = delete;
+
+  NodeStats& operator=(const NodeStats&) = delete;
+
+  inline void add(uint32_t idx, uint64_t n = 1) { bump(counters[idx], n); }
+
+  inline void add_frame_in(uint32_t op) {
+    bump(frames_in[op & OPCODE_SLOTS_MASK], 1);
+  }
+
+  inline void add_frame_out(uint32_t op) {
+    bump(frames_out[op & OPCODE_SLOTS_MASK], 1);
+  }
+
+  // count ERRORS and error 'code'
+  void add_error(int32_t code);
+
+  void reset();
+
+  inline uint64_t get(uint32_t idx) const {
+    return counters[idx].load(std::memory_order_relaxed);
+  }
+
+  static const char* counter_name(uint32_t idx);
+
+private:
+  static inline void bump(std::atomic<uint64_t>& c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+  }
+
+public:
+  // Node::read calls
+  static const uint32_t READS = 0;
+  // Node::write and Node::writev calls
+  static const uint32_t WRITES = 1;
+  // bytes delivered by read to caller
+  static const uint32_t BYTES_IN = 2;
+  // bytes taken from caller by write and writev
+  static const uint32_t BYTES_OUT = 3;
+  // on_read not finished, super node read again
+  static const uint32_t READ_LOOPS = 4;
+  // read, write, writev and poll system calls
+  static const uint32_t SYSCALLS = 5;
+  // reads delivered only part of a frame
+  static const uint32_t PARTIAL_READS = 6;
+  // writes to socket or super node took only part of data given
+  static const uint32_t PARTIAL_WRITES = 7;
+  // operations returned would block in non-blocking mode
+  static const uint32_t WOULD_BLOCKS = 8;
+  // shifts moved data to buffer begin, and bytes moved
+  static const uint32_t SHIFTS = 9;
+  static const uint32_t SHIFT_BYTES = 10;
+  // no room in a buffer: buffer grown, or a read filled all free space
+  static const uint32_t BUFFER_FULL = 11;
+  // operations failed by this node
+  static const uint32_t ERRORS = 12;
+  static const uint32_t COUNT = 13;
+  // frames counted by opcode
+  static const uint32_t OPCODE_SLOTS = 16;
+  static const uint32_t OPCODE_SLOTS_MASK = 15;
+  // distinct error codes counted, more codes only counted by ERRORS
+  static const uint32_t ERROR_SLOTS = 8;
+
+private:
+  std::atomic<uint64_t> counters[COUNT];
+  std::atomic<uint64_t> frames_in[OPCODE_SLOTS];
+  std::atomic<uint64_t> frames_out[OPCODE_SLOTS];
+  // error code of slot, 0 if slot unused
+  std::atomic<int32_t> error_codes[ERROR_SLOTS];
+  std::atomic<uint64_t> error_counts[ERROR_SLOTS];
+
+  friend class NodeStatsSnapshot;
+};
+
+// counters of one node copied at a moment
+class NodeStatsSnapshot {
+public:
+  NodeStatsSnapshot(const char* n, const NodeStats& stats);
+
+  // name() of node
+  const char* name;
+  uint64_t counters[NodeStats::COUNT];
+  uint64_t frames_in[NodeStats::OPCODE_SLOTS];
+  uint64_t frames_out[NodeStats::OPCODE_SLOTS];
+  // error code and count, code is errno or error code of the node
+  std::vector<std::pair<int32_t, uint64_t> > errors;
+};
+
 class Node {
 public:
   virtual ~Node() = default;
@@ -119,12 +268,70 @@ public:
 
   bool read(Buffer *out, NodeArgs<void> *args = nullptr);
 
+  // gather write 'iov' to socket without copy, data is not transformed by
+  // this node, only valid if can_writev() is true.
+  // in non-blocking mode, return count of bytes written before socket
+  // became not writable, or -1 and would_block() if nothing written.
+  // return: bytes written, -1 if failed
+  int64_t writev(const struct iovec* iov, int32_t iovcnt,
+      NodeArgs<void> *args = nullptr);
+
+  virtual bool can_writev() const { return false; }
+
+  // shrink grown read/write buffers of chain, call when chain idle
+  void shrink_buffers();
+
+  // write data remained in write buffers of chain to bottom node.
+  // used to finish a non-blocking write that returned false with
+  // would_block() after all input data consumed.
+  bool flush(NodeArgs<void> *args = nullptr);
+
   void close();
 
   void chain(Node* node);
 
+  // deadline of following operations of the chain, include init, so a
+  // message read or written by several socket operations is bounded as a
+  // whole. per operation timeout given by args of socket node still
+  // applied, whichever expires first.
+  // 'timeout': milliseconds from now, <= 0 clear deadline
+  void set_deadline(int32_t timeout);
+
+  // switch the socket of chain to non-blocking mode, must be called after
+  // init success. read/write/flush return false and would_block() is true
+  // if the operation could not be finished without blocking. data already
+  // consumed is kept in node buffers, call read again or write again with
+  // same 'in' buffer (flush if 'in' is empty) when socket is ready.
+  bool set_nonblock(bool nb);
+
+  inline bool is_nonblock() const { return nonblock; }
+
+  // set TCP_NODELAY of the socket of chain, must be called after init
+  // success. off by default. a masked frame larger than write buffer is
+  // written in write buffer sized chunks, nagle holds the last chunk
+  // until delayed ack of remote (about 40ms), so request/response
+  // traffic of such frames wants it on.
+  bool set_nodelay(bool nd);
+
+  // file descriptor of socket at bottom of chain, -1 if not connected
+  virtual int get_fd() const;
+
   inline const NodeError *get_error() const { return &err_info; }
 
+  // last failure of read/write/flush is caused by non-blocking socket not
+  // ready yet
+  bool would_block() const;
+
+  // counters of this node
+  inline const NodeStats& get_stats() const { return stats; }
+
+  // append snapshots of this node and all super nodes, top node first.
+  // may be called by any thread.
+  void snapshot_stats(std::vector<NodeStatsSnapshot>& out) const;
+
+  // reset counters of this node and all super nodes
+  void reset_stats();
+
   virtual const char* name() const = 0;
 
 protected:
@@ -139,13 +346,38 @@ protected:
 
   virtual void on_close() = 0;
 
+  virtual int64_t on_writev(const struct iovec* iov, int32_t iovcnt,
+      void* arg);
+
   void clear_node_error();
 
+  void set_would_block();
+
+  // shift 'buf', counted by stats if data moved
+  void shift_buffer(Buffer* buf);
+
+  // count failure of this node by err_info
+  void count_failure();
+
+  // deadline of an operation with timeout 'arg' (int32_t milliseconds,
+  // <= 0 or nullptr no timeout) and deadline of chain, 0 if none
+  int64_t get_deadline(void* arg) const;
+
 protected:
   Node* super_node = nullptr;
   Buffer *read_buffer = nullptr;
   Buffer *write_buffer = nullptr;
+  bool nonblock = false;
+  // absolute deadline by steady_now_ms(), 0 if none
+  int64_t deadline = 0;
+  // args of write in progress, for nodes write to super node by writev
+  NodeArgs<void> *write_args = nullptr;
+  NodeStats stats;
   static thread_local NodeError err_info;
+
+public:
+  // max count of iovec passed to writev
+  static const int32_t MAX_IOV = 64;
 };
 
 } // namespace lizard
@@ -0,0 +1,624 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include "node.h"
+#include "buffer-pool.h"
+#include "ws-frame.h"
+
+namespace rokid {
+namespace lizard {
+
+// layer stack resolved at compile time, alternative of a Node chain
+// without virtual calls, super_node pointers and NodeArgs:
+//   Pipeline<WSLayer, TcpLayer> pipe;
+//   Pipeline<WSLayer, TcpLayer>::Options opts;
+//   std::get<0>(opts).flags = OPCODE_TEXT | WSFRAME_FIN;
+//   std::get<1>(opts).timeout = 1000;
+//   pipe.init(uri, opts);
+//   pipe.write(data, size, opts);
+// every layer calls the layer below by a PipelineStage given as template
+// argument 'Next', so the whole send/receive path could be inlined.
+// options of a call are typed per layer: tuple of Layer::Options.
+// a Node is used as bottom layer by NodeLayer, e.g. tls by
+// NodeLayer<SSLNode>.
+// blocking mode only, not thread safe.
+//
+// a layer class has:
+//   class Options;
+//   static const bool CAN_WRITEV;
+//   static const char* name();
+//   template <typename Next>
+//   bool init(Next& next, const rokid::Uri& uri, Options& opts);
+//   template <typename Next>
+//   bool write(Next& next, const void* data, uint32_t size, Options& opts);
+//   template <typename Next>
+//   bool writev(Next& next, const struct iovec* iov, int32_t iovcnt,
+//       Options& opts);  // only if CAN_WRITEV
+//   template <typename Next>
+//   bool read(Next& next, Buffer* out, Options& opts);
+//   void close();
+// failed layer sets next.error() and returns false, or returns false
+// without error if the layer below failed.
+
+class PipelineError {
+public:
+  inline void set(int32_t c, const char* d) {
+    code = c;
+    desc = d;
+  }
+
+  inline void clear() {
+    layer = -1;
+    code = 0;
+    desc = "";
+  }
+
+  // index of failed layer, 0 is the top layer
+  int32_t layer = -1;
+  // errno or error code of the layer
+  int32_t code = 0;
+  // static string
+  const char* desc = "";
+};
+
+template <typename... Layers>
+class Pipeline;
+
+// entry of layer 'I' of pipeline 'P'
+template <typename P, size_t I, bool END = (I == P::LAYERS)>
+class PipelineStage {
+public:
+  typedef typename P::template Layer<I> L;
+  typedef PipelineStage<P, I + 1> Next;
+
+  static const bool CAN_WRITEV = L::CAN_WRITEV;
+
+  inline PipelineStage(P& p, typename P::Options& o) : pipe(p), opts(o) {}
+
+  inline bool init(const rokid::Uri& uri) {
+    Next next(pipe, opts);
+    return check(layer().init(next, uri, std::get<I>(opts)));
+  }
+
+  inline bool write(const void* data, uint32_t size) {
+    Next next(pipe, opts);
+    return check(layer().write(next, data, size, std::get<I>(opts)));
+  }
+
+  inline bool writev(const struct iovec* iov, int32_t iovcnt) {
+    Next next(pipe, opts);
+    return check(layer().writev(next, iov, iovcnt, std::get<I>(opts)));
+  }
+
+  inline bool read(Buffer* out) {
+    Next next(pipe, opts);
+    return check(layer().read(next, out, std::get<I>(opts)));
+  }
+
+  inline void close() {
+    layer().close();
+    Next(pipe, opts).close();
+  }
+
+  inline PipelineError& error() { return pipe.err; }
+
+private:
+  inline L& layer() { return std::get<I>(pipe.layers); }
+
+  inline bool check(bool r) {
+    // error set by the deepest failed layer
+    if (!r && pipe.err.layer < 0)
+      pipe.err.layer = I;
+    return r;
+  }
+
+private:
+  P& pipe;
+  typename P::Options& opts;
+};
+
+// below the bottom layer, no transport
+template <typename P, size_t I>
+class PipelineStage<P, I, true> {
+public:
+  static const bool CAN_WRITEV = false;
+
+  inline PipelineStage(P& p, typename P::Options& o) : pipe(p) {}
+
+  inline bool init(const rokid::Uri& uri) { return true; }
+
+  inline bool write(const void* data, uint32_t size) { return fail(); }
+
+  inline bool writev(const struct iovec* iov, int32_t iovcnt) {
+    return fail();
+  }
+
+  inline bool read(Buffer* out) { return fail(); }
+
+  inline void close() {}
+
+  inline PipelineError& error() { return pipe.err; }
+
+private:
+  inline bool fail() {
+    pipe.err.layer = I;
+    pipe.err.set(ENOTCONN, "no transport layer");
+    return false;
+  }
+
+private:
+  P& pipe;
+};
+
+template <typename... Layers>
+class Pipeline {
+public:
+  typedef std::tuple<typename Layers::Options...> Options;
+
+  template <size_t I>
+  using Layer = typename std::tuple_element<I, std::tuple<Layers...> >::type;
+
+  static const size_t LAYERS = sizeof...(Layers);
+
+  ~Pipeline() { close(); }
+
+  template <size_t I>
+  inline Layer<I>& layer() { return std::get<I>(layers); }
+
+  // init layers from bottom, every layer inits the layer below first
+  bool init(const rokid::Uri& uri, Options& opts) {
+    err.clear();
+    return top(opts).init(uri);
+  }
+
+  bool init(const rokid::Uri& uri) { return init(uri, options); }
+
+  inline bool write(const void* data, uint32_t size, Options& opts) {
+    err.clear();
+    return top(opts).write(data, size);
+  }
+
+  inline bool write(const void* data, uint32_t size) {
+    return write(data, size, options);
+  }
+
+  inline bool read(Buffer* out, Options& opts) {
+    err.clear();
+    return top(opts).read(out);
+  }
+
+  inline bool read(Buffer* out) { return read(out, options); }
+
+  void close() { top(options).close(); }
+
+  inline const PipelineError* get_error() const { return &err; }
+
+  // name of layer 'err.layer'
+  const char* error_layer_name() const {
+    return layer_name<0>(err.layer);
+  }
+
+public:
+  // options used by calls without options
+  Options options;
+
+private:
+  inline PipelineStage<Pipeline, 0> top(Options& opts) {
+    return PipelineStage<Pipeline, 0>(*this, opts);
+  }
+
+  template <size_t I>
+  static typename std::enable_if<(I < LAYERS), const char*>::type
+  layer_name(int32_t idx) {
+    return idx == (int32_t)I ? Layer<I>::name() : layer_name<I + 1>(idx);
+  }
+
+  template <size_t I>
+  static typename std::enable_if<(I == LAYERS), const char*>::type
+  layer_name(int32_t idx) {
+    return "none";
+  }
+
+private:
+  std::tuple<Layers...> layers;
+  PipelineError err;
+
+  template <typename P, size_t I, bool END>
+  friend class PipelineStage;
+};
+
+// tcp socket, bottom layer. socket is non-blocking, blocking mode waits
+// by poll like SocketNode.
+class TcpLayer {
+public:
+  class Options {
+  public:
+    // connect, read and write timeout in milliseconds, 0 no timeout
+    int32_t timeout = 0;
+    // set TCP_NODELAY of socket, see Node::set_nodelay
+    bool nodelay = false;
+  };
+
+  static const bool CAN_WRITEV = true;
+  static const int32_t ERROR_CODE_BEGIN = -10000;
+  static const int32_t REMOTE_CLOSED = -10000;
+  static const int32_t TIMEOUT = -10001;
+
+  ~TcpLayer() { close(); }
+
+  static const char* name() { return "tcp"; }
+
+  inline int get_fd() const { return socket; }
+
+  template <typename Next>
+  bool init(Next& next, const rokid::Uri& uri, Options& opts) {
+    close();
+    return connect(uri, opts.timeout, opts.nodelay, next.error());
+  }
+
+  template <typename Next>
+  inline bool write(Next& next, const void* data, uint32_t size,
+      Options& opts) {
+    const char* p = reinterpret_cast<const char*>(data);
+    int64_t dl = -1;
+    while (size) {
+      ssize_t r = ::write(socket, p, size);
+      if (r > 0) {
+        p += r;
+        size -= r;
+      } else if (!retry(r, false, opts, &dl, next.error())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename Next>
+  inline bool writev(Next& next, const struct iovec* iov, int32_t iovcnt,
+      Options& opts) {
+    struct iovec vec[MAX_IOV];
+    int32_t idx = 0;
+    int64_t dl = -1;
+
+    if (iovcnt > MAX_IOV) {
+      next.error().set(EINVAL, "too many iovecs");
+      return false;
+    }
+    for (idx = 0; idx < iovcnt; ++idx)
+      vec[idx] = iov[idx];
+    idx = 0;
+    while (idx < iovcnt) {
+      ssize_t r = ::writev(socket, vec + idx, iovcnt - idx);
+      if (r <= 0) {
+        if (!retry(r, false, opts, &dl, next.error()))
+          return false;
+        continue;
+      }
+      while (idx < iovcnt && (size_t)r >= vec[idx].iov_len) {
+        r -= vec[idx].iov_len;
+        ++idx;
+      }
+      if (idx < iovcnt) {
+        vec[idx].iov_base = reinterpret_cast<char*>(vec[idx].iov_base) + r;
+        vec[idx].iov_len -= r;
+      }
+    }
+    return true;
+  }
+
+  template <typename Next>
+  inline bool read(Next& next, Buffer* out, Options& opts) {
+    int64_t dl = -1;
+    while (true) {
+      ssize_t r = ::read(socket, out->data_end(), out->remain_space());
+      if (r > 0) {
+        out->obtain(r);
+        return true;
+      }
+      if (!retry(r, true, opts, &dl, next.error()))
+        return false;
+    }
+  }
+
+  void close();
+
+private:
+  bool connect(const rokid::Uri& uri, int32_t timeout, bool nodelay,
+      PipelineError& err);
+
+  // 'r': result of read/write
+  // return: true  call again, socket ready
+  inline bool retry(ssize_t r, bool rd, Options& opts, int64_t* dl,
+      PipelineError& err) {
+    if (r < 0 && errno == EINTR)
+      return true;
+    if (r < 0 && errno == EAGAIN)
+      return wait(rd, opts.timeout, dl, err);
+    fail(r, err);
+    return false;
+  }
+
+  bool wait(bool rd, int32_t timeout, int64_t* dl, PipelineError& err);
+
+  void fail(ssize_t r, PipelineError& err);
+
+private:
+  static const int32_t MAX_IOV = 16;
+  int socket = -1;
+};
+
+// websocket client, frames of write masked by masking key, read returns a
+// whole frame. no extension negotiated.
+class WSLayer {
+public:
+  class Options {
+  public:
+    // write: opcode and WSFRAME_FIN of frame sent
+    // read: opcode and WSFRAME_FIN of frame received
+    uint32_t flags = OPCODE_BINARY | WSFRAME_FIN;
+  };
+
+  static const bool CAN_WRITEV = false;
+  static const int32_t ERROR_CODE_BEGIN = -10000;
+  static const int32_t HANDSHAKE_FAILED = -10000;
+  static const int32_t INVALID_FRAME = -10001;
+  static const int32_t INSUFF_READ_BUFFER = -10002;
+  static const int32_t MESSAGE_TOO_LARGE = -10003;
+  static const int32_t INSUFF_WRITE_BUFFER = -10004;
+
+  static const char* name() { return "websocket"; }
+
+  inline void set_masking_key(const char* key) {
+    memcpy(masking_key, key, 4);
+  }
+
+  inline void set_max_message_size(uint32_t size) { max_message_size = size; }
+
+  template <typename Next>
+  bool init(Next& next, const rokid::Uri& uri, Options& opts) {
+    char buf[1024];
+    int32_t len, r;
+
+    read_buffer.clear();
+    if (!next.init(uri))
+      return false;
+    len = build_request(uri, buf, sizeof(buf));
+    if (len <= 0) {
+      next.error().set(HANDSHAKE_FAILED, "build handshake request failed");
+      return false;
+    }
+    if (!next.write(buf, len))
+      return false;
+    while (true) {
+      if (read_buffer.remain_space() == 0
+          && !read_buffer.reserve(read_buffer.size() + sizeof(buf)))
+        break;
+      if (!next.read(&read_buffer))
+        return false;
+      r = parse_response(reinterpret_cast<char*>(read_buffer.data_begin()),
+          read_buffer.size());
+      if (r < 0)
+        break;
+      if (r > 0) {
+        // frames may follow the response
+        read_buffer.consume(r);
+        return true;
+      }
+    }
+    next.error().set(HANDSHAKE_FAILED, "websocket handshake failed");
+    return false;
+  }
+
+  template <typename Next>
+  inline bool write(Next& next, const void* data, uint32_t size,
+      Options& opts) {
+    char header[MAX_FRAME_HEADER];
+    const char* p = reinterpret_cast<const char*>(data);
+    uint8_t mask = *(int32_t*)masking_key ? 1 : 0;
+    uint32_t offset = 0, n;
+    int32_t c = lizard_ws_frame_create(opts.flags & OPCODE_MASK,
+        opts.flags & WSFRAME_FIN ? 1 : 0, mask, masking_key, size, header,
+        sizeof(header));
+
+    if (c < 0) {
+      next.error().set(INVALID_FRAME, "invalid websocket frame flags");
+      return false;
+    }
+    if (!mask && Next::CAN_WRITEV && size >= GATHER_MIN_PAYLOAD) {
+      struct iovec iov[2];
+      iov[0].iov_base = header;
+      iov[0].iov_len = c;
+      iov[1].iov_base = const_cast<char*>(p);
+      iov[1].iov_len = size;
+      return gather(next, iov,
+          std::integral_constant<bool, Next::CAN_WRITEV>());
+    }
+    // header and payload sent with one write, large payload in chunks
+    if (write_buffer.total_space() < c + size
+        && write_buffer.total_space() < MAX_WRITE_CHUNK
+        && !write_buffer.reserve(c + size < MAX_WRITE_CHUNK ? c + size
+          : MAX_WRITE_CHUNK)) {
+      next.error().set(INSUFF_WRITE_BUFFER, "insufficient write buffer");
+      return false;
+    }
+    write_buffer.clear();
+    write_buffer.append(header, c);
+    do {
+      n = write_buffer.remain_space();
+      if (n > size)
+        n = size;
+      if (mask) {
+        offset = lizard_ws_frame_mask_payload_at(masking_key, offset, p, n,
+            write_buffer.data_end());
+        write_buffer.obtain(n);
+      } else {
+        write_buffer.append(p, n);
+      }
+      p += n;
+      size -= n;
+      if (!next.write(write_buffer.data_begin(), write_buffer.size()))
+        return false;
+      write_buffer.clear();
+    } while (size);
+    return true;
+  }
+
+  template <typename Next>
+  inline bool read(Next& next, Buffer* out, Options& opts) {
+    WSFrameHeader header;
+    int32_t hsz;
+    uint64_t fsize;
+
+    while (true) {
+      uint8_t* p = reinterpret_cast<uint8_t*>(read_buffer.data_begin());
+      hsz = lizard_ws_frame_parse_header(p, read_buffer.size(), &header);
+      if (hsz < 0 || (hsz > 0 && header.rsv1)) {
+        next.error().set(INVALID_FRAME, "invalid websocket frame");
+        return false;
+      }
+      if (hsz > 0) {
+        fsize = lizard_ws_frame_size(&header);
+        if (fsize <= read_buffer.size())
+          return deliver(next, out, p + hsz, header, fsize, opts);
+        if (fsize > read_buffer.total_space()
+            && (header.payload_length > max_message_size
+              || !read_buffer.reserve(fsize))) {
+          next.error().set(MESSAGE_TOO_LARGE, "websocket frame too large");
+          return false;
+        }
+      }
+      read_buffer.shift();
+      if (read_buffer.remain_space() == 0
+          && !read_buffer.reserve(read_buffer.total_space() * 2))
+        return false;
+      if (!next.read(&read_buffer))
+        return false;
+    }
+  }
+
+  void close() {
+    read_buffer.clear();
+    write_buffer.clear();
+  }
+
+private:
+  template <typename Next>
+  inline bool gather(Next& next, const struct iovec* iov, std::true_type) {
+    return next.writev(iov, 2);
+  }
+
+  // not reached, layer below can't writev
+  template <typename Next>
+  inline bool gather(Next& next, const struct iovec* iov, std::false_type) {
+    return false;
+  }
+
+  template <typename Next>
+  inline bool deliver(Next& next, Buffer* out, uint8_t* p,
+      const WSFrameHeader& header, uint64_t fsize, Options& opts) {
+    uint32_t size = header.payload_length;
+    if (out->remain_space() < size && !out->reserve(out->size() + size)) {
+      next.error().set(INSUFF_READ_BUFFER, "insufficient read buffer");
+      return false;
+    }
+    if (header.mask) {
+      lizard_ws_frame_mask_payload_at(reinterpret_cast<char*>(p), 0, p + 4,
+          size, out->data_end());
+      out->obtain(size);
+    } else {
+      out->append(p, size);
+    }
+    read_buffer.consume(fsize);
+    opts.flags = header.opcode | (header.fin ? WSFRAME_FIN : 0);
+    return true;
+  }
+
+  static int32_t build_request(const rokid::Uri& uri, char* buf,
+      uint32_t size);
+
+  // return: > 0  size of response, upgraded
+  //         0    response not complete
+  //         -1   upgrade refused or response invalid
+  static int32_t parse_response(const char* data, uint32_t size);
+
+private:
+  static const uint32_t MAX_FRAME_HEADER = 14;
+  // payload smaller than this is copied to write buffer with header
+  static const uint32_t GATHER_MIN_PAYLOAD = 256;
+  static const uint32_t MAX_WRITE_CHUNK = 64 * 1024;
+
+  char masking_key[4] = {0};
+  uint32_t max_message_size = 16 * 1024 * 1024;
+  PoolBuffer read_buffer;
+  PoolBuffer write_buffer;
+};
+
+// Node 'N' as bottom layer of a pipeline, e.g. NodeLayer<SSLNode> for
+// tls. calls to the node are virtual, with NodeArgs of timeout.
+template <typename N>
+class NodeLayer {
+public:
+  class Options {
+  public:
+    // read and write timeout in milliseconds, 0 no timeout
+    int32_t timeout = 0;
+    // args of init
+    NodeArgs<void>* init_args = nullptr;
+  };
+
+  static const bool CAN_WRITEV = false;
+
+  static const char* name() { return "node"; }
+
+  inline N& get_node() { return node; }
+
+  template <typename Next>
+  bool init(Next& next, const rokid::Uri& uri, Options& opts) {
+    return check(node.init(uri, opts.init_args), next);
+  }
+
+  template <typename Next>
+  inline bool write(Next& next, const void* data, uint32_t size,
+      Options& opts) {
+    NodeArgs<void> args;
+    Buffer in;
+    if (opts.timeout)
+      args.add(&opts.timeout);
+    in.set_data(const_cast<void*>(data), size, 0, size);
+    return check(node.write(&in, opts.timeout ? &args : nullptr), next);
+  }
+
+  template <typename Next>
+  inline bool read(Next& next, Buffer* out, Options& opts) {
+    NodeArgs<void> args;
+    if (opts.timeout)
+      args.add(&opts.timeout);
+    return check(node.read(out, opts.timeout ? &args : nullptr), next);
+  }
+
+  void close() { node.close(); }
+
+private:
+  template <typename Next>
+  inline bool check(bool r, Next& next) {
+    if (!r) {
+      const NodeError* e = node.get_error();
+      next.error().set(e->code, e->desc);
+    }
+    return r;
+  }
+
+private:
+  N node;
+};
+
+} // namespace lizard
+} // namespace rokid
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rokid {
+namespace lizard {
+
+class ResolvedAddr {
+public:
+  // port is 0, set by caller before connect
+  struct sockaddr_storage addr;
+  socklen_t len;
+};
+
+// process wide host name resolver, thread safe.
+// results cached for a fixed ttl, since getaddrinfo does not report ttl
+// of dns records. failures are cached for a shorter ttl. lookups run by
+// a small pool of worker threads, concurrent requests of a host share
+// one lookup.
+class Resolver {
+public:
+  // 'err': 0 or EAI_* error code
+  typedef void (*Callback)(int32_t err, const std::vector<ResolvedAddr>* addrs,
+      void* arg);
+
+  // lookup function run by workers, getaddrinfo by default.
+  // may be replaced by a stub resolver for test.
+  // return: 0 or EAI_* error code
+  typedef int32_t (*LookupFunc)(const char* host,
+      std::vector<ResolvedAddr>& addrs);
+
+  static Resolver* instance();
+
+  // resolve 'host', numeric address returned directly.
+  // wait lookup no later than 'deadline' (steady clock milliseconds,
+  // 0 wait forever), lookup continues after deadline and result cached.
+  // return: 0 success, EAI_AGAIN if deadline passed, or EAI_* error code
+  int32_t resolve(const std::string& host, std::vector<ResolvedAddr>& addrs,
+      int64_t deadline = 0);
+
+  // resolve 'host' without blocking. 'cb' invoked in caller thread before
+  // return if result cached, else in a worker thread.
+  void resolve_async(const std::string& host, Callback cb, void* arg);
+
+  // 'ttl', 'negative_ttl': milliseconds, default 60s and 5s
+  void set_ttl(uint32_t ttl, uint32_t negative_ttl);
+
+  // max count of worker threads, default 2
+  void set_max_workers(uint32_t count);
+
+  void set_lookup(LookupFunc func);
+
+  void clear_cache();
+
+  static const char* error_string(int32_t err);
+
+  static const uint32_t MAX_CACHE_ENTRIES = 1024;
+
+private:
+  class Waiter {
+  public:
+    Callback cb;
+    void* arg;
+  };
+
+  class Entry {
+  public:
+    std::vector<ResolvedAddr> addrs;
+    int32_t err = 0;
+    int64_t expire = 0;
+    bool pending = false;
+    std::vector<Waiter> waiters;
+  };
+
+  Resolver() {}
+
+  static bool parse_numeric(const std::string& host,
+      std::vector<ResolvedAddr>& addrs);
+
+  // lock held
+  Entry* lookup(const std::string& host, bool* fresh);
+
+  // lock held
+  void start_lookup(const std::string& host, Entry* entry);
+
+  void evict(int64_t now);
+
+  void run_worker();
+
+private:
+  std::mutex mutex;
+  std::condition_variable done_cond;
+  std::condition_variable task_cond;
+  std::unordered_map<std::string, Entry> cache;
+  std::deque<std::string> tasks;
+  uint32_t ttl = 60000;
+  uint32_t negative_ttl = 5000;
+  uint32_t max_workers = 2;
+  uint32_t workers = 0;
+  uint32_t idle_workers = 0;
+  LookupFunc lookup_func = nullptr;
+};
+
+} // namespace lizard
+} // namespace rokid
@@ -11,6 +11,10 @@ public:
 
   const char* name() const { return "socket"; }
 
+  int get_fd() const;
+
+  bool can_writev() const { return true; }
+
 protected:
   bool on_init(const rokid::Uri& uri, void* arg);
 
@@ -20,21 +24,27 @@ protected:
 
   void on_close();
 
+  int64_t on_writev(const struct iovec* iov, int32_t iovcnt, void* arg);
+
 private:
   void set_node_error_by_errno();
 
   void set_node_error(int32_t code);
 
+  bool wait(bool rd, void* arg, int64_t* dl);
+
 public:
   static const int32_t ERROR_CODE_BEGIN = -10000;
   static const int32_t NOT_READY = -10000;
   static const int32_t REMOTE_CLOSED = -10001;
   static const int32_t INSUFF_BUFFER = -10002;
   static const int32_t READ_TIMEOUT = -10003;
+  static const int32_t WRITE_TIMEOUT = -10004;
+  static const int32_t CONNECT_TIMEOUT = -10005;
 
 private:
   int socket = -1;
-  static const char* error_messages[4];
+  static const char* error_messages[6];
 };
 
 } // namespace lizard
@@ -2,18 +2,71 @@
 
 #ifdef HAS_SSL
 
+#include <stdint.h>
 #include <mutex>
 #include "node.h"
 
 namespace rokid {
 namespace lizard {
 
+// tls settings shared by many SSLNodes: parsed ca chain, auth mode and a
+// random generator seeded once. immutable after init, must outlive the
+// SSLNodes using it. thread safe.
+class SSLConfig {
+public:
+  SSLConfig() {}
+
+  ~SSLConfig();
+
+  SSLConfig(const SSLConfig&) = delete;
+
+  SSLConfig& operator=(const SSLConfig&) = delete;
+
+  // 'ca_list': PEM certificates, nullptr no verification and 'authmode'
+  //            ignored
+  // return: false  random generator seed failed or 'ca_list' invalid
+  bool init(const char* ca_list, int32_t authmode = VERIFY_REQUIRED);
+
+public:
+  static const int32_t VERIFY_NONE = 0;
+  static const int32_t VERIFY_OPTIONAL = 1;
+  static const int32_t VERIFY_REQUIRED = 2;
+
+private:
+  void* config_data = nullptr;
+
+  friend class SSLNode;
+};
+
 class SSLNode : public Node {
 public:
   ~SSLNode();
 
+  // use 'config' instead of ca list given by init args.
+  // without a config, SSLNodes given no ca list share one config. a ca
+  // list given by init args is parsed by this node and kept for next init
+  // with the same ca list address, text at the address must not change.
+  // set a shared config to parse ca list once for many SSLNodes, and to
+  // resume tls sessions across them.
+  inline void set_config(SSLConfig* c) { config = c; }
+
   const char* name() const { return "mbedtls"; }
 
+  int get_fd() const;
+
+  // tls session cache shared by all SSLNodes, keyed by server host:port.
+  // sessions saved after handshake and presented by next on_init to the
+  // same server, so handshake is abbreviated if server still has it.
+  // enabled by default.
+  static void set_session_cache(bool enable);
+
+  static void clear_session_cache();
+
+  // count of handshakes resumed by a cached session / full handshakes
+  static uint64_t get_session_cache_hits();
+
+  static uint64_t get_session_cache_misses();
+
 protected:
   bool on_init(const rokid::Uri& uri, void* arg);
 
@@ -26,6 +79,17 @@ protected:
 private:
   void set_node_error(int32_t code);
 
+  // config of ca list given by init args
+  // return: nullptr if init failed
+  SSLConfig* args_config(const char* ca_list);
+
+  bool wait(bool rd, void* arg, int64_t* dl, int32_t timeout_code);
+
+  // socket io of ssl context, 'ctx' is the SSLNode
+  static int bio_recv(void* ctx, unsigned char* buf, size_t len);
+
+  static int bio_send(void* ctx, const unsigned char* buf, size_t len);
+
 public:
   static const int32_t ERROR_CODE_BEGIN = -10000;
   static const int32_t SSL_INIT_FAILED = -10000;
@@ -36,9 +100,15 @@ public:
   static const int32_t INSUFF_READ_BUFFER = -10005;
   static const int32_t REMOTE_CLOSED = -10006;
   static const int32_t SSL_READ_TIMEOUT = -10007;
+  static const int32_t SSL_WRITE_TIMEOUT = -10008;
+  static const int32_t SSL_HANDSHAKE_TIMEOUT = -10009;
 
 private:
-  static const char* error_messages[8];
+  static const char* error_messages[10];
+  SSLConfig* config = nullptr;
+  // parsed from 'own_ca' of init args, if no config set
+  SSLConfig* own_config = nullptr;
+  const char* own_ca = nullptr;
   void *ssl_data;
   int socket = -1;
 };
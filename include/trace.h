@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+namespace rokid {
+namespace lizard {
+
+// latency tracing of node operations: read/write of every node, framing,
+// masking, tls encryption and system calls are recorded as timed events
+// when tracing enabled.
+// every thread records to its own ring of RING_SIZE events without lock,
+// oldest events overwritten. events of all threads exported in chrome
+// trace event format, opened by chrome://tracing or ui.perfetto.dev.
+// disabled by default, a disabled trace point costs one relaxed load.
+// trace points compiled out if library built with LIZARD_NO_TRACE.
+class Trace {
+public:
+  static void enable(bool on);
+
+  static inline bool enabled() {
+    return on.load(std::memory_order_relaxed);
+  }
+
+  // drop events recorded by all threads
+  static void clear();
+
+  // write events recorded by all threads as chrome trace json.
+  // may be called by any thread, events being recorded meanwhile may be
+  // missed.
+  static bool write_chrome_trace(FILE* fp);
+
+  static bool write_chrome_trace(const char* path);
+
+  // record event of current thread.
+  // 'name', 'cat': must be static strings, stored without copy
+  // 'begin': nanoseconds of now_ns()
+  static void record(const char* name, const char* cat, int64_t begin,
+      int64_t end);
+
+  // nanoseconds of monotonic clock
+  static int64_t now_ns();
+
+public:
+  // events of a thread ring, power of 2
+  static const uint32_t RING_SIZE = 16384;
+
+private:
+  static std::atomic<bool> on;
+};
+
+// record an event lasting from construction to destruction
+class TraceScope {
+public:
+  // 'n': nullptr not recorded
+  inline TraceScope(const char* n, const char* c) {
+    if (n && Trace::enabled()) {
+      name = n;
+      cat = c;
+      begin = Trace::now_ns();
+    }
+  }
+
+  inline ~TraceScope() {
+    if (name)
+      Trace::record(name, cat, begin, Trace::now_ns());
+  }
+
+  TraceScope(const TraceScope&) = delete;
+
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name = nullptr;
+  const char* cat = nullptr;
+  int64_t begin = 0;
+};
+
+} // namespace lizard
+} // namespace rokid
@@ -7,6 +7,11 @@
 #define OPCODE_PING 9
 #define OPCODE_PONG 10
 #define WSFRAME_FIN 0x10
+// read flag of streaming read, more payload of the frame follows
+#define WSFRAME_PARTIAL 0x20
+// RSV1 bit of frame, first frame of a message compressed by
+// permessage-deflate
+#define WSFRAME_RSV1 0x40
 
 #define OPCODE_MASK 0x0f
 #define FIN_MASK 0x10
@@ -20,18 +25,49 @@ int32_t check_opcode(uint8_t op);
 
 int32_t is_control_opcode(uint8_t op);
 
+// 'op': opcode, may be or'ed with WSFRAME_RSV1
 // return frame length if success
 int32_t lizard_ws_frame_create(uint16_t op, uint8_t fin, uint8_t mask,
     const char* mask_key, uint64_t payload_len, void* out, uint32_t out_size);
 
 void lizard_ws_frame_mask_payload(const char* mask_key, const void* in, uint32_t in_size, void* out);
 
+// mask payload bytes starting at byte 'offset' of frame payload, so a large
+// payload could be masked in several chunks. 'in' and 'out' may be the same
+// buffer (in-place), but must not partially overlap.
+// return: mask offset of next chunk
+uint32_t lizard_ws_frame_mask_payload_at(const char* mask_key, uint32_t offset,
+    const void* in, uint32_t in_size, void* out);
+
+#define WSMASK_KERNEL_AUTO 0
+#define WSMASK_KERNEL_SCALAR 1
+#define WSMASK_KERNEL_WORD 2
+#define WSMASK_KERNEL_SSE2 3
+#define WSMASK_KERNEL_AVX2 4
+#define WSMASK_KERNEL_NEON 5
+#define WSMASK_KERNEL_COUNT 6
+
+// select masking kernel, WSMASK_KERNEL_AUTO pick the fastest one supported
+// by current cpu. selected automatically at first use if never called.
+// return: 0  success
+//         -1 kernel not supported by this cpu or build
+int32_t lizard_ws_mask_set_kernel(int32_t kernel);
+
+int32_t lizard_ws_mask_get_kernel();
+
+// return: 1  kernel supported
+//         0  kernel not supported
+int32_t lizard_ws_mask_kernel_supported(int32_t kernel);
+
+const char* lizard_ws_mask_kernel_name(int32_t kernel);
+
 typedef struct {
   uint64_t payload_length;
   uint8_t fin:1;
   uint8_t mask:1;
   uint8_t type:2;
   uint8_t opcode:4;
+  uint8_t rsv1:1;
 } WSFrameHeader;
 // return: > 0  success, header size
 //         0  data not completed
@@ -0,0 +1,109 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <atomic>
+#include <thread>
+#include "ws-node.h"
+#include "ws-message.h"
+
+namespace rokid {
+namespace lizard {
+
+template <typename T>
+class SPSCRing;
+class WSIoMessage;
+
+// a lizard owned thread operating an initialized websocket chain, so slow
+// consumers never delay pong replies and tcp window updates:
+// * keeps reading messages while ring of received messages has room,
+//   answers ping with pong itself, ping not delivered. close frame
+//   delivered as a message, answered by consumer if wanted.
+// * hands messages to one consumer thread through a wait-free spsc ring,
+//   message buffers taken from message pool of the WSNode, returned to it
+//   by WSMessage::release of consumer.
+// * sends frames enqueued by send (WSNode::enqueue_frame) of any thread.
+// event fd is readable when messages arrived or the thread ended, for
+// poll/epoll of consumer loop.
+// chain must not be touched by other threads while started, except
+// enqueue_frame of the WSNode.
+class WSIoThread {
+public:
+  WSIoThread();
+
+  ~WSIoThread();
+
+  // start thread operating 'ws', socket switched to non-blocking mode.
+  // send queue of 'ws' enabled by this, must not be enabled before.
+  // 'ring_size': received messages not consumed yet at most, rounded up
+  //              to power of 2. socket not read while ring full.
+  // 'send_queue_limit': max bytes of send queue
+  bool start(WSNode* ws, uint32_t ring_size = 256,
+      uint32_t send_queue_limit = 1024 * 1024);
+
+  // stop and join thread, chain switched back to blocking mode but not
+  // closed. messages not consumed are kept until next start or destroy.
+  // must be called before start again, also if thread ended by error.
+  void stop();
+
+  // consumer thread only. take next received message, never blocks.
+  // buffer held by 'msg' released first.
+  // event fd cleared if no message.
+  // return: false if no message
+  bool pop(WSMessage* msg);
+
+  // consumer thread only. wait until a message received or thread ended.
+  // 'timeout': milliseconds, -1 wait forever
+  // return: false if timeout or thread ended with no message left
+  bool wait(int32_t timeout = -1);
+
+  // thread safe, same as WSNode::enqueue_frame
+  bool send(const void* payload, uint32_t size, uint32_t flags = 0x12);
+
+  // readable when messages arrived or thread ended
+  inline int get_event_fd() const { return event_fd; }
+
+  // thread ended by error, include remote closed, or not started
+  inline bool is_running() const {
+    return running.load(std::memory_order_acquire);
+  }
+
+  // error ended the thread, valid after is_running() turned false
+  inline const NodeError* get_error() const { return &error; }
+
+private:
+  void run();
+
+  // return: false if failed, 'error' set
+  bool read_messages(WSMessage* msg);
+
+  void signal(int fd);
+
+  void fail();
+
+  static void on_send_queue(WSNode* node, uint32_t event, void* arg);
+
+private:
+  WSNode* ws = nullptr;
+  // node send queue enabled for, by first start
+  WSNode* queue_node = nullptr;
+  SPSCRing<WSIoMessage>* ring = nullptr;
+  std::thread thread;
+  // written by io thread for consumer
+  int event_fd = -1;
+  // written by consumer and send queue for io thread
+  int wake_fd = -1;
+  std::atomic<bool> running{false};
+  std::atomic<bool> stopping{false};
+  // io thread stopped reading because ring full
+  std::atomic<bool> reader_blocked{false};
+  NodeError error;
+  // payload of ping not answered yet, queued when send queue has room
+  char pong_payload[125];
+  int32_t pong_size = -1;
+};
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "buffer-pool.h"
+#include "ws-frame.h"
+
+namespace rokid {
+namespace lizard {
+
+// reusable message buffers, in power of two size classes from 4KB.
+// thread safe, a buffer may be returned by any thread.
+class WSMessagePool {
+public:
+  // 'max_free': max idle buffers kept for every size class
+  WSMessagePool(uint32_t max_free = 16);
+
+  ~WSMessagePool();
+
+  // return: buffer with capacity at least 'size', empty
+  PoolBuffer* get(uint32_t size);
+
+  void put(PoolBuffer* buf);
+
+  // grow 'buf' in place to capacity at least 'size', data kept.
+  // 'buf' nullptr: same as get(size)
+  // return: 'buf', or nullptr if it could not grow, 'buf' still owned by
+  //         caller then
+  PoolBuffer* grow(PoolBuffer* buf, uint32_t size);
+
+  // free all idle buffers
+  void trim();
+
+  // pool shared by node chains not set their own pool
+  static WSMessagePool* default_pool();
+
+private:
+  static uint32_t size_class(uint32_t size);
+
+public:
+  static const uint32_t MIN_CLASS_SHIFT = 12;
+  static const uint32_t CLASS_COUNT = 20;
+
+private:
+  std::mutex mutex;
+  uint32_t max_free;
+  std::vector<PoolBuffer*> free_lists[CLASS_COUNT];
+};
+
+// a complete websocket message, payload of all fragments in one
+// contiguous buffer. buffer is returned to pool when message released,
+// or reused directly by next WSNode::read_message with same message.
+class WSMessage {
+public:
+  WSMessage() {}
+
+  ~WSMessage();
+
+  WSMessage(const WSMessage&) = delete;
+
+  WSMessage& operator=(const WSMessage&) = delete;
+
+  // OPCODE_TEXT, OPCODE_BINARY or a control opcode
+  inline uint32_t opcode() const { return flags & OPCODE_MASK; }
+
+  inline void* data() { return buf ? buf->data_begin() : nullptr; }
+
+  inline uint32_t size() const { return buf ? buf->size() : 0; }
+
+  void release();
+
+private:
+  WSMessagePool* pool = nullptr;
+  PoolBuffer* buf = nullptr;
+  uint32_t flags = 0;
+
+  friend class WSNode;
+  friend class WSIoThread;
+};
+
+} // namespace lizard
+} // namespace rokid
@@ -1,10 +1,55 @@
 #pragma once
 
 #include "node.h"
+#include "ws-frame.h"
 
 namespace rokid {
 namespace lizard {
 
+class WSMessage;
+class WSMessagePool;
+class PoolBuffer;
+class WSDeflate;
+class WSSendQueue;
+
+// permessage-deflate extension (rfc 7692) offered in handshake.
+// window bits and context takeover trade memory for compression ratio:
+// compressor takes about (1 << (client_max_window_bits + 2))
+// + (1 << (mem_level + 9)) bytes, decompressor about
+// 1 << server_max_window_bits bytes, kept for whole connection if context
+// takeover enabled.
+class WSDeflateOptions {
+public:
+  bool enable = false;
+  // zlib compression level, 0-9, -1 default level
+  int32_t level = -1;
+  // zlib memory level of compressor, 1-9
+  int32_t mem_level = 8;
+  // log2 of lz77 window of messages sent, 9-15
+  int32_t client_max_window_bits = 15;
+  // log2 of lz77 window of messages received, requested to server, 9-15
+  int32_t server_max_window_bits = 15;
+  // reset compressor after every message sent
+  bool client_no_context_takeover = false;
+  // request server to reset its compressor after every message
+  bool server_no_context_takeover = false;
+  // messages with payload smaller than this are sent uncompressed
+  uint32_t min_size = 64;
+};
+
+// a received frame in place, given by WSNode::read_frames
+class WSFrameView {
+public:
+  inline uint32_t opcode() const { return flags & OPCODE_MASK; }
+
+  inline bool fin() const { return flags & WSFRAME_FIN; }
+
+  // opcode and WSFRAME_* flags, same as flags of read
+  uint32_t flags;
+  const void* data;
+  uint32_t size;
+};
+
 class WSNode : public Node {
 public:
   WSNode();
@@ -14,12 +59,144 @@ public:
   // 0x12 == OPCODE_BINARY | WSFRAME_FIN
   bool send_frame(const void* payload, uint32_t size, uint32_t flags = 0x12);
 
+  // send one frame with payload gathered from 'iov'.
+  // if frame not masked and super node support writev, header and payload
+  // are written with one writev, payload is not copied.
+  // in non-blocking mode, if return false and would_block() is true,
+  // call again with same arguments when socket writable.
+  bool send_frame(const struct iovec* iov, uint32_t iovcnt,
+      uint32_t flags = 0x12);
+
   bool ping(void* payload = nullptr, uint32_t size = 0);
 
+  // cork: frames smaller than 'flush_size' sent by send_frame, ping and
+  // pong are encoded back to back into write buffer, and sent by one write
+  // of super node (one syscall, one tls record if not larger than 16KB)
+  // when 'flush_size' bytes corked, oldest corked frame older than
+  // 'flush_timeout' milliseconds (<= 0 no timeout) at next send, or
+  // uncork/flush called. larger frames are sent at once after corked
+  // frames. write buffer grown to 'flush_size' if it is growable.
+  // in non-blocking mode a corked frame is accepted even if its flush
+  // would block, rest data sent by next write or flush.
+  void cork(uint32_t flush_size = 16384, int32_t flush_timeout = 0);
+
+  // stop corking and flush corked frames
+  // in non-blocking mode, if return false and would_block() is true,
+  // call flush when socket writable.
+  bool uncork();
+
+  inline bool is_corked() const { return corked; }
+
+  // flush corked frames if oldest of them is older than flush timeout,
+  // for a timer of the caller while no frame sent
+  bool flush_cork_timeout();
+
   bool pong(void* payload = nullptr, uint32_t size = 0);
 
+  // thread safe outbound queue, for several threads sending on one
+  // connection. producers enqueue whole messages by enqueue_frame of any
+  // thread without blocking, the writer thread (the only thread operating
+  // the chain) sends them by drain_send_queue.
+  // 'max_bytes': payload bytes queued at most, enqueue_frame fails with
+  //              SEND_QUEUE_FULL if exceeded
+  // 'notify': optional, invoked with SEND_QUEUE_READY in producer thread
+  //           when a frame enqueued to empty queue, so the writer should
+  //           drain, and with SEND_QUEUE_LOW in writer thread when queued
+  //           bytes drop to half of 'max_bytes' after an enqueue failed
+  //           full, so producers may resume.
+  // frames queued are dropped by close.
+  // must be called before producers start, once.
+  bool enable_send_queue(uint32_t max_bytes = 1024 * 1024,
+      void (*notify)(WSNode*, uint32_t, void*) = nullptr,
+      void* arg = nullptr);
+
+  // thread safe. copy a frame to send queue, never blocks.
+  // only whole messages: 'flags' must have WSFRAME_FIN and an opcode
+  // other than OPCODE_CONT, frames of producers are interleaved in queue
+  // so fragments of one message could not stay together.
+  // error of a failed call is got by get_error of the calling thread.
+  // return: false  queue full, send queue not enabled, or frame is not
+  //                a whole message (SEND_QUEUE_FRAGMENT)
+  bool enqueue_frame(const void* payload, uint32_t size,
+      uint32_t flags = 0x12);
+
+  // writer thread only. send queued frames in order, frames smaller than
+  // cork flush size (16KB if not corked) coalesced into one write.
+  // must not be called while a send_frame of the writer is pending.
+  // in non-blocking mode, if return false and would_block() is true,
+  // call again when socket writable, frame in sending is kept.
+  bool drain_send_queue();
+
+  // thread safe, payload bytes in send queue, include frame in sending
+  uint64_t send_queue_bytes() const;
+
+  // thread safe, frames in send queue, include frame in sending
+  uint32_t send_queue_frames() const;
+
   void set_masking_key(const char* key);
 
+  // streaming read: frame header parsed once, then every read delivers
+  // a piece of payload as soon as it arrived, no larger than remain space
+  // of 'out'. read flags of every piece have opcode of the frame,
+  // WSFRAME_PARTIAL if more payload of the frame follows, WSFRAME_FIN
+  // only with last piece of a final frame.
+  // frame of any size is received with small fixed size buffers,
+  // control frames are still delivered whole.
+  inline void set_read_streaming(bool v) { read_streaming = v; }
+
+  inline bool is_read_streaming() const { return read_streaming; }
+
+  // read a complete message, fragments reassembled into one contiguous
+  // buffer taken from message pool. control frames arrived between
+  // fragments are returned as messages of their own, reassembly continues
+  // with next call. buffer held by 'msg' is reused.
+  // 'args': same as read
+  // in non-blocking mode, if return false and would_block() is true,
+  // call again when socket readable, received fragments are kept.
+  bool read_message(WSMessage* msg, NodeArgs<void>* args = nullptr);
+
+  // zero copy read: every complete frame already in read buffer is given
+  // as a view of its payload in read buffer, unmasked in place, up to
+  // 'max' views. super node read only if no complete frame buffered.
+  // views are valid until release_frames, next read_frames or read, the
+  // read buffer is consumed by release_frames.
+  // a compressed frame is read into a buffer of the node by read and
+  // given alone, whole or in pieces as set by set_read_streaming.
+  // a frame larger than read buffer can hold (fixed buffer, or larger
+  // than max message size) is always given in pieces no larger than read
+  // buffer, one per call, WSFRAME_PARTIAL set in flags of all but the
+  // last piece.
+  // '*count': views given
+  // 'args': same as read
+  // in non-blocking mode, if return false and would_block() is true,
+  // call again when socket readable.
+  bool read_frames(WSFrameView* views, uint32_t max, uint32_t* count,
+      NodeArgs<void>* args = nullptr);
+
+  // consume frames of views given by last read_frames
+  void release_frames();
+
+  // nullptr: use WSMessagePool::default_pool()
+  inline void set_message_pool(WSMessagePool* pool) { msg_pool = pool; }
+
+  // read_message failed with MESSAGE_TOO_LARGE if message payload larger
+  // than 'size', default 16MB.
+  // growable buffers of chain never grown for frames larger than 'size'.
+  inline void set_max_message_size(uint32_t size) { max_message_size = size; }
+
+  // offer permessage-deflate in next init, ignored if built without zlib.
+  // if negotiated, messages sent by send_frame are compressed and messages
+  // received are decompressed by read/read_message. frames written by
+  // write are sent as is.
+  // non-streaming read of a compressed frame grows 'out' if it is a
+  // growable buffer, up to max message size.
+  inline void set_deflate_options(const WSDeflateOptions& opts) {
+    deflate_options = opts;
+  }
+
+  // permessage-deflate negotiated by last init
+  inline bool is_deflate_negotiated() const { return deflate != nullptr; }
+
   const char* name() const { return "websocket"; }
 
 protected:
@@ -34,6 +211,32 @@ protected:
 private:
   void set_node_error(int32_t code);
 
+  bool can_gather() const;
+
+  bool send_gather(const struct iovec* iov, uint32_t iovcnt, uint64_t size);
+
+  bool send_copy(const struct iovec* iov, uint32_t iovcnt, uint64_t size,
+      uint32_t flags);
+
+  bool cork_reserve(uint64_t size);
+
+  bool cork_append(const struct iovec* iov, uint32_t iovcnt, uint64_t size,
+      uint32_t flags);
+
+  int32_t read_payload(Buffer* out, Buffer* in, void* arg);
+
+  int32_t read_inflate(Buffer* out, Buffer* in, void* arg);
+
+  // return: 1 frame viewed, 0 no complete frame, '*need' is frame size
+  //         if header complete, 2 frame needs read, -1 invalid frame
+  int32_t view_frame(WSFrameView* view, uint64_t* need);
+
+  bool negotiate_deflate(const char* ext);
+
+  void release_deflate();
+
+  void release_message_buffer();
+
 public:
   static const int32_t ERROR_CODE_BEGIN = -10000;
   static const int32_t HANDSHARK_FAILED = -10000;
@@ -41,15 +244,88 @@ public:
   static const int32_t INVALID_CONTROL_FRAME_FORMAT = -10002;
   static const int32_t INSUFF_READ_BUFFER = -10003;
   static const int32_t INSUFF_WRITE_BUFFER = -10004;
+  static const int32_t MESSAGE_TOO_LARGE = -10005;
+  static const int32_t INVALID_FRAGMENT = -10006;
+  static const int32_t INVALID_RSV = -10007;
+  static const int32_t INFLATE_FAILED = -10008;
+  static const int32_t DEFLATE_FAILED = -10009;
+  static const int32_t SEND_QUEUE_FULL = -10010;
+  static const int32_t SEND_QUEUE_DISABLED = -10011;
+  static const int32_t SEND_QUEUE_FRAGMENT = -10012;
+
+  // events of send queue notify
+  static const uint32_t SEND_QUEUE_READY = 1;
+  static const uint32_t SEND_QUEUE_LOW = 2;
 
 private:
-  static const char* error_messages[5];
+  static const char* error_messages[13];
+  static const uint32_t MAX_CONTROL_PAYLOAD = 125;
+  static const uint32_t MAX_FRAME_HEADER = 14;
 
   uint32_t read_frame_header_size = 0;
-  uint32_t excepted_read_payload_data_size = 0;
+  // payload bytes of current reading frame not delivered yet,
+  // only used by streaming read
+  uint64_t excepted_read_payload_data_size = 0;
+  bool read_streaming = false;
+  // 0: read websocket frame header
+  // 1: read websocket frame payload data, streaming read only
+  int32_t read_state = 0;
+  uint8_t read_opcode = 0;
+  uint8_t read_fin = 0;
+  uint32_t read_mask_offset = 0;
+  char read_masking_key[4] = {0};
+  // opcode and flags of last read frame or payload piece
+  uint32_t read_flags = 0;
+  // message in reassembling by read_message
+  WSMessagePool* msg_pool = nullptr;
+  PoolBuffer* msg_buf = nullptr;
+  // opcode of first fragment, 0 if no message in reassembling
+  uint32_t msg_opcode = 0;
+  uint32_t max_message_size = 16 * 1024 * 1024;
+  // permessage-deflate, 'deflate' is nullptr if not negotiated
+  WSDeflateOptions deflate_options;
+  WSDeflate* deflate = nullptr;
+  // payload of current reading frame is compressed
+  bool read_inflating = false;
+  // data message in receiving is compressed, for continuation frames
+  bool read_msg_compressed = false;
+  // bytes at begin of read buffer already unmasked for decompressing
+  uint32_t read_unmasked = 0;
+  // data message in sending is compressed
+  bool send_msg_compressed = false;
+  // compressed payload of frame in sending by send_frame
+  PoolBuffer* deflate_buf = nullptr;
+  uint32_t deflate_size = 0;
+  uint32_t frame_flags = 0;
+  bool frame_deflated = false;
   // 0: write websocket frame header
   // 1: write websocket frame payload data
   int32_t write_state = 0;
+  // mask offset of next payload chunk in current writing frame
+  uint32_t write_mask_offset = 0;
+  // payload bytes of current writing frame not written yet
+  uint64_t write_remain = 0;
+  // payload size of next frame if larger than 'in' of write,
+  // rest payload given by following writes
+  int64_t next_frame_size = -1;
+  // state of frame sending by send_frame with iovec
+  bool frame_pending = false;
+  bool frame_started = false;
+  bool frame_gather = false;
+  uint32_t frame_header_size = 0;
+  uint64_t frame_sent = 0;
+  // frames of send_frame corked to write buffer
+  bool corked = false;
+  uint32_t cork_flush_size = 0;
+  int32_t cork_flush_timeout = 0;
+  // milliseconds of first frame corked to empty write buffer
+  int64_t cork_time = 0;
+  // bytes of read buffer viewed by read_frames, consumed by release
+  uint32_t view_consumed = 0;
+  // frames could not be viewed in read buffer are read to
+  PoolBuffer* view_buf = nullptr;
+  // outbound queue of enqueue_frame, nullptr if not enabled
+  WSSendQueue* send_queue = nullptr;
   char masking_key[4] = {0};
   char frame_header[14];
 };
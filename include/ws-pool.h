@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "sock-node.h"
+#include "ssl-node.h"
+#include "ws-node.h"
+#include "buffer-pool.h"
+
+namespace rokid {
+namespace lizard {
+
+class WSPool;
+class WSPoolEntry;
+
+// an upgraded websocket chain owned by WSPool, websocket over tls for
+// 'wss' uri, else over tcp. read/write buffers are PoolBuffers.
+class WSSession {
+public:
+  // top node of chain, used as a WSNode initialized by caller.
+  // chain is in blocking mode without deadline when handed out
+  WSNode* node();
+
+  inline const std::string& uri() const { return key; }
+
+private:
+  WSSession(const std::string& uri) : key(uri) {}
+
+  ~WSSession();
+
+  WSSession(const WSSession&) = delete;
+
+  WSSession& operator=(const WSSession&) = delete;
+
+  bool connect(const rokid::Uri& uri, int32_t timeout);
+
+  // return: false  remote closed, or data arrived while idle
+  bool quiet();
+
+  // ping and wait pong for 'timeout' milliseconds
+  bool check(int32_t timeout);
+
+  friend class WSPool;
+
+private:
+  std::string key;
+  SocketNode sock_node;
+#ifdef HAS_SSL
+  // config of pool when connected, outlives ssl_node
+  std::shared_ptr<SSLConfig> ssl_config;
+  SSLNode ssl_node;
+#endif
+  WSNode ws;
+  PoolBuffer read_buffer;
+  PoolBuffer write_buffer;
+  // steady_now_ms() of last health check or handed back
+  int64_t checked = 0;
+};
+
+// pool of pre-warmed websocket sessions keyed by uri.
+// dns, tcp, tls and http upgrade are done by a background thread, get()
+// hand an idle session to caller immediately. idle sessions are checked
+// by ping/pong periodically, and replaced if check failed.
+// thread safe.
+class WSPool {
+public:
+  WSPool();
+
+  // stop refill thread, idle sessions closed.
+  // sessions still held by callers must be put back before.
+  ~WSPool();
+
+  // keep 'count' idle sessions of 'uri', start refill thread if not.
+  // 'count' 0: stop keeping sessions of 'uri', idle ones closed
+  // return: false  'uri' invalid
+  bool warm(const std::string& uri, uint32_t count);
+
+  // take an idle session of 'uri'. if none idle, a new session connected
+  // in caller thread for at most 'timeout' milliseconds (0 no timeout).
+  // 'err': error of connect copied to if not nullptr
+  // return: nullptr if 'uri' invalid or connect failed
+  WSSession* get(const std::string& uri, int32_t timeout = 0,
+      NodeError* err = nullptr);
+
+  // give back a session taken by get.
+  // 'reusable': false if session failed or left with a partial message,
+  //             session closed and replaced.
+  void put(WSSession* session, bool reusable = true);
+
+  // idle sessions checked by ping every 'interval' milliseconds,
+  // pong waited for 'timeout' milliseconds. default 30s and 3s
+  void set_check_interval(int32_t interval, int32_t timeout);
+
+  // timeout of connect, tls handshake and http upgrade of background
+  // connects, default 10s
+  void set_connect_timeout(int32_t timeout);
+
+  // ca certificates of 'wss' sessions, PEM. parsed once, shared by all
+  // sessions connected after, so their tls sessions are also resumed.
+  // return: false  'ca' invalid, or ssl not supported
+  bool set_ca(const std::string& ca);
+
+  void stop();
+
+  // count of get() served by an idle session / by connect in caller thread
+  uint64_t get_hits() const { return hits; }
+
+  uint64_t get_misses() const { return misses; }
+
+  // count of idle sessions of 'uri' ready for get()
+  uint32_t idle_count(const std::string& uri);
+
+private:
+  // lock held
+  WSPoolEntry* find_entry(const std::string& uri);
+
+  void run();
+
+  // lock held, released while connecting.
+  // return: false  no entry need refill
+  bool refill_once(std::unique_lock<std::mutex>& locker);
+
+  // lock held, released while checking.
+  // return: false  no idle session need check
+  bool check_once(std::unique_lock<std::mutex>& locker);
+
+  // lock held
+  // return: time of next refill retry or check, 0 if none
+  int64_t next_wakeup();
+
+private:
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+  std::map<std::string, WSPoolEntry*> entries;
+#ifdef HAS_SSL
+  std::shared_ptr<SSLConfig> ssl_config;
+#endif
+  int32_t check_interval = 30000;
+  int32_t check_timeout = 3000;
+  int32_t connect_timeout = 10000;
+  bool running = false;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+};
+
+} // namespace lizard
+} // namespace rokid
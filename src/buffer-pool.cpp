@@ -0,0 +1,239 @@
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "buffer-pool.h"
+#include "common.h"
+
+// free blocks of each class cached by a thread
+#define THREAD_CACHE_SLOTS 8
+// max bytes of free blocks of each class kept by central list
+#define CENTRAL_MAX_BYTES (8 * 1024 * 1024)
+
+namespace rokid {
+namespace lizard {
+
+class ThreadCache {
+public:
+  ~ThreadCache() {
+    uint32_t i;
+    for (i = 0; i < BufferPool::CLASS_COUNT; ++i) {
+      if (counts[i])
+        BufferPool::instance()->release(i, blocks[i], counts[i]);
+      counts[i] = 0;
+    }
+    // buffers freed by static objects destructed later go to central lists
+    alive = false;
+  }
+
+  void* blocks[BufferPool::CLASS_COUNT][THREAD_CACHE_SLOTS];
+  uint32_t counts[BufferPool::CLASS_COUNT] = {0};
+  bool alive = true;
+};
+
+static thread_local ThreadCache thread_cache;
+
+BufferPool* BufferPool::instance() {
+  // never destroyed, thread caches flush to it at thread exit
+  static BufferPool* pool = new BufferPool();
+  return pool;
+}
+
+uint32_t BufferPool::class_index(uint32_t size) {
+  uint32_t c = 0;
+  while ((MIN_SIZE << c) < size)
+    ++c;
+  return c;
+}
+
+uint32_t BufferPool::class_size(uint32_t size) {
+  if (size > MAX_SIZE)
+    return 0;
+  return MIN_SIZE << class_index(size);
+}
+
+void* BufferPool::get(uint32_t size, uint32_t* cap) {
+  if (size > MAX_SIZE)
+    return nullptr;
+  uint32_t cls = class_index(size);
+  uint32_t csize = MIN_SIZE << cls;
+  ThreadCache& tc = thread_cache;
+  void* p;
+
+  if (!tc.alive) {
+    if (fetch(cls, &p, 1) == 0)
+      p = nullptr;
+  } else {
+    if (tc.counts[cls] == 0) {
+      // refill half of cache from central list
+      tc.counts[cls] = fetch(cls, tc.blocks[cls], THREAD_CACHE_SLOTS / 2);
+    }
+    p = tc.counts[cls] ? tc.blocks[cls][--tc.counts[cls]] : nullptr;
+  }
+  if (p == nullptr) {
+    p = csize <= ARENA_MAX_SIZE ? arena_alloc(cls) : nullptr;
+    if (p == nullptr)
+      p = malloc(csize);
+    if (p == nullptr)
+      return nullptr;
+  }
+  if (cap)
+    *cap = csize;
+  return p;
+}
+
+void BufferPool::put(void* p, uint32_t cap) {
+  if (p == nullptr)
+    return;
+  uint32_t cls = class_index(cap);
+  ThreadCache& tc = thread_cache;
+  if (!tc.alive) {
+    release(cls, &p, 1);
+    return;
+  }
+  if (tc.counts[cls] == THREAD_CACHE_SLOTS) {
+    // return half of cache to central list
+    tc.counts[cls] -= THREAD_CACHE_SLOTS / 2;
+    release(cls, tc.blocks[cls] + tc.counts[cls], THREAD_CACHE_SLOTS / 2);
+  }
+  tc.blocks[cls][tc.counts[cls]++] = p;
+}
+
+uint32_t BufferPool::fetch(uint32_t cls, void** blocks, uint32_t count) {
+  std::lock_guard<std::mutex> locker(mutexes[cls]);
+  std::vector<void*>& list = free_lists[cls];
+  uint32_t n = 0;
+  while (n < count && !list.empty()) {
+    blocks[n++] = list.back();
+    list.pop_back();
+  }
+  return n;
+}
+
+void BufferPool::release(uint32_t cls, void** blocks, uint32_t count) {
+  uint32_t max_free = CENTRAL_MAX_BYTES >> (cls + MIN_SHIFT);
+  uint32_t i;
+  if (max_free < 2)
+    max_free = 2;
+  std::lock_guard<std::mutex> locker(mutexes[cls]);
+  for (i = 0; i < count; ++i) {
+    if (free_lists[cls].size() < max_free || in_arena(blocks[i]))
+      free_lists[cls].push_back(blocks[i]);
+    else
+      free(blocks[i]);
+  }
+}
+
+void BufferPool::trim() {
+  uint32_t i;
+  for (i = 0; i < CLASS_COUNT; ++i) {
+    std::lock_guard<std::mutex> locker(mutexes[i]);
+    std::vector<void*>& list = free_lists[i];
+    size_t j = 0;
+    for (auto it = list.begin(); it != list.end(); ++it) {
+      if (in_arena(*it))
+        list[j++] = *it;
+      else
+        free(*it);
+    }
+    list.resize(j);
+  }
+}
+
+bool BufferPool::init_arena(size_t size, bool hugepage) {
+  std::lock_guard<std::mutex> locker(arena_mutex);
+  void* p = MAP_FAILED;
+
+  if (arena)
+    return false;
+  size = (size + ARENA_MAX_SIZE - 1) / ARENA_MAX_SIZE * ARENA_MAX_SIZE;
+#ifdef MAP_HUGETLB
+  if (hugepage) {
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      KLOGI(TAG, "map hugetlb arena failed: %s, use transparent hugepages",
+          strerror(errno));
+    }
+  }
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      KLOGE(TAG, "map buffer arena failed: %s", strerror(errno));
+      return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if (hugepage)
+      madvise(p, size, MADV_HUGEPAGE);
+#endif
+  }
+  arena_used = 0;
+  arena_size = size;
+  arena = (int8_t*)p;
+  return true;
+}
+
+void* BufferPool::arena_alloc(uint32_t cls) {
+  uint32_t csize = MIN_SIZE << cls;
+  std::lock_guard<std::mutex> locker(arena_mutex);
+  if (arena == nullptr || arena_used + csize > arena_size)
+    return nullptr;
+  // bump allocation, blocks are never returned to arena but cached by
+  // free lists. every block size is multiple of MIN_SIZE, so blocks keep
+  // aligned to MIN_SIZE
+  void* p = arena + arena_used;
+  arena_used += csize;
+  return p;
+}
+
+bool BufferPool::in_arena(void* p) const {
+  return arena && (int8_t*)p >= arena && (int8_t*)p < arena + arena_size;
+}
+
+// ==================PoolBuffer====================
+PoolBuffer::PoolBuffer(uint32_t size) {
+  uint32_t cap = 0;
+  if (size < BufferPool::MIN_SIZE)
+    size = BufferPool::MIN_SIZE;
+  void* p = BufferPool::instance()->get(size, &cap);
+  set_data(p, p ? cap : 0, 0, 0);
+  base_size = p ? cap : BufferPool::class_size(size);
+}
+
+PoolBuffer::~PoolBuffer() {
+  BufferPool::instance()->put(datap, capacity);
+}
+
+bool PoolBuffer::reserve(uint32_t size) {
+  uint32_t cap = 0;
+  if (size <= capacity)
+    return true;
+  void* p = BufferPool::instance()->get(size, &cap);
+  if (p == nullptr)
+    return false;
+  uint32_t sz = end - begin;
+  if (sz)
+    memcpy(p, datap + begin, sz);
+  BufferPool::instance()->put(datap, capacity);
+  set_data(p, cap, 0, sz);
+  return true;
+}
+
+void PoolBuffer::shrink() {
+  uint32_t cap = 0;
+  uint32_t sz = end - begin;
+  if (capacity <= base_size || sz > base_size)
+    return;
+  void* p = BufferPool::instance()->get(base_size, &cap);
+  if (p == nullptr)
+    return;
+  if (sz)
+    memcpy(p, datap + begin, sz);
+  BufferPool::instance()->put(datap, capacity);
+  set_data(p, cap, 0, sz);
+}
+
+} // namespace lizard
+} // namespace rokid
@@ -1,17 +1,76 @@
 #pragma once
 
-#ifdef LIZARD_DEBUG
 #include <stdint.h>
+#if defined(LIZARD_USDT) && defined(__linux__)
+#include <sys/sdt.h>
+#endif
+#ifdef LIZARD_DEBUG
 #include <stdio.h>
 #endif
 #include "rlog.h"
+#include "trace.h"
 
 namespace rokid {
 namespace lizard {
 
 #define TAG "lizard"
 
-void set_rw_timeout(int socket, int32_t tm, bool rd);
+// update counters of 'stats' member of node, compiled out by
+// LIZARD_NO_STATS
+#ifdef LIZARD_NO_STATS
+#define NODE_STAT_OF(node, idx, n)
+#define NODE_STAT(idx, n)
+#define NODE_STAT_FRAME_IN(op)
+#define NODE_STAT_FRAME_OUT(op)
+#define NODE_STAT_ERROR(code)
+#else
+#define NODE_STAT_OF(node, idx, n) (node)->stats.add(NodeStats::idx, n)
+#define NODE_STAT(idx, n) stats.add(NodeStats::idx, n)
+#define NODE_STAT_FRAME_IN(op) stats.add_frame_in(op)
+#define NODE_STAT_FRAME_OUT(op) stats.add_frame_out(op)
+#define NODE_STAT_ERROR(code) stats.add_error(code)
+#endif
+
+// trace points, compiled out by LIZARD_NO_TRACE.
+// TRACE_NODE: event named by node name
+#ifdef LIZARD_NO_TRACE
+#define TRACE_SCOPE(name, cat)
+#define TRACE_NODE(cat)
+#else
+#define TRACE_SCOPE(name, cat) TraceScope trace_scope_(name, cat)
+#define TRACE_NODE(cat) \
+  TraceScope trace_scope_(Trace::enabled() ? name() : nullptr, cat)
+#endif
+
+// usdt probes for bpftrace/systemtap, provider 'lizard'.
+// built with LIZARD_USDT on linux only, a nop instruction if not attached
+#if defined(LIZARD_USDT) && defined(__linux__)
+#define LIZARD_PROBE3(probe, a, b, c) DTRACE_PROBE3(lizard, probe, a, b, c)
+#else
+#define LIZARD_PROBE3(probe, a, b, c)
+#endif
+
+// milliseconds of monotonic clock
+int64_t steady_now_ms();
+
+// return: deadline 'timeout' milliseconds from now, 0 if 'timeout' <= 0
+int64_t deadline_after(int32_t timeout);
+
+// wait until 'fd' readable ('rd') or writable, or 'deadline' passed.
+// 'deadline': 0 wait forever
+// return: 1  fd ready, or error/hangup pending on it
+//         0  deadline passed
+//         -1 poll failed, errno set
+int32_t wait_fd(int fd, bool rd, int64_t deadline);
+
+bool set_fd_nonblock(int fd);
+
+// connect tcp socket to 'host':'port' before 'deadline'.
+// all resolved addresses raced with staggered attempts (rfc 8305).
+// socket returned is non-blocking
+// return: socket fd, -1 if failed with errno set, ETIMEDOUT if deadline
+//         passed
+int tcp_connect(const char* host, uint16_t port, int64_t deadline);
 
 #ifdef LIZARD_DEBUG
 void print_hex_data(const uint8_t *data, uint32_t size);
@@ -0,0 +1,189 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <vector>
+#include "resolver.h"
+#include "common.h"
+
+// delay between starts of two connection attempts, recommended by
+// rfc 8305 section 5
+#define CONNECT_ATTEMPT_DELAY 250
+// max connection attempts in flight
+#define MAX_CONNECT_ATTEMPTS 8
+
+using namespace std;
+
+namespace rokid {
+namespace lizard {
+
+// interleave address families, starts with family of first address.
+// resolver returns addresses sorted by rfc 6724, usually ipv6 first
+static void sort_addrs(vector<ResolvedAddr>& addrs) {
+  vector<ResolvedAddr> first;
+  vector<ResolvedAddr> second;
+  size_t i, j;
+
+  if (addrs.size() < 2)
+    return;
+  sa_family_t family = addrs[0].addr.ss_family;
+  for (i = 0; i < addrs.size(); ++i) {
+    if (addrs[i].addr.ss_family == family)
+      first.push_back(addrs[i]);
+    else
+      second.push_back(addrs[i]);
+  }
+  addrs.clear();
+  for (i = 0, j = 0; i < first.size() || j < second.size(); ++i, ++j) {
+    if (i < first.size())
+      addrs.push_back(first[i]);
+    if (j < second.size())
+      addrs.push_back(second[j]);
+  }
+}
+
+// start non-blocking connect to 'ra'
+// return: socket fd, -1 if failed with errno set.
+//         '*done' true if connected immediately
+static int start_connect(ResolvedAddr* ra, uint16_t port, bool* done) {
+  int fd, err;
+
+  if (ra->addr.ss_family == AF_INET6)
+    ((struct sockaddr_in6*)&ra->addr)->sin6_port = htons(port);
+  else
+    ((struct sockaddr_in*)&ra->addr)->sin_port = htons(port);
+  fd = ::socket(ra->addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (!set_fd_nonblock(fd))
+    goto failed;
+  if (::connect(fd, (sockaddr*)&ra->addr, ra->len) == 0) {
+    *done = true;
+    return fd;
+  }
+  if (errno != EINPROGRESS && errno != EINTR)
+    goto failed;
+  *done = false;
+  return fd;
+
+failed:
+  err = errno;
+  ::close(fd);
+  errno = err;
+  return -1;
+}
+
+static void close_attempts(vector<struct pollfd>& fds, int except) {
+  size_t i;
+  for (i = 0; i < fds.size(); ++i) {
+    if (fds[i].fd != except)
+      ::close(fds[i].fd);
+  }
+  fds.clear();
+}
+
+// race connection attempts to 'addrs' (rfc 8305 'happy eyeballs').
+// a new attempt starts when the previous one failed or not connected
+// in CONNECT_ATTEMPT_DELAY milliseconds, earlier attempts keep going.
+// the first connected socket wins, others are closed.
+static int race_connect(vector<ResolvedAddr>& addrs, uint16_t port,
+    int64_t deadline) {
+  vector<struct pollfd> fds;
+  struct pollfd pfd;
+  size_t next = 0;
+  int64_t next_start = 0;
+  int64_t now;
+  int last_err = ECONNREFUSED;
+  int fd, err, timeout, r;
+  socklen_t len;
+  bool done;
+  size_t i;
+
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  while (true) {
+    now = steady_now_ms();
+    if (deadline && now >= deadline) {
+      last_err = ETIMEDOUT;
+      break;
+    }
+    while (next < addrs.size() && fds.size() < MAX_CONNECT_ATTEMPTS
+        && (fds.empty() || now >= next_start)) {
+      fd = start_connect(&addrs[next++], port, &done);
+      if (fd < 0) {
+        // failed immediately, e.g. ENETUNREACH of ipv6 on ipv4 only host,
+        // start next attempt right now
+        last_err = errno;
+        continue;
+      }
+      if (done) {
+        close_attempts(fds, -1);
+        return fd;
+      }
+      pfd.fd = fd;
+      fds.push_back(pfd);
+      next_start = now + CONNECT_ATTEMPT_DELAY;
+    }
+    if (fds.empty())
+      break;
+
+    timeout = -1;
+    if (next < addrs.size() && fds.size() < MAX_CONNECT_ATTEMPTS)
+      timeout = next_start - now;
+    if (deadline && (timeout < 0 || deadline - now < timeout))
+      timeout = deadline - now;
+    r = ::poll(fds.data(), fds.size(), timeout);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      last_err = errno;
+      break;
+    }
+    if (r == 0)
+      continue;
+    i = 0;
+    while (i < fds.size()) {
+      if (fds[i].revents == 0) {
+        ++i;
+        continue;
+      }
+      fd = fds[i].fd;
+      len = sizeof(err);
+      if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+      if (err == 0) {
+        close_attempts(fds, fd);
+        return fd;
+      }
+      last_err = err;
+      ::close(fd);
+      fds.erase(fds.begin() + i);
+      // attempt failed, don't wait for the delay to start next one
+      next_start = now;
+    }
+  }
+  close_attempts(fds, -1);
+  errno = last_err;
+  return -1;
+}
+
+int tcp_connect(const char* host, uint16_t port, int64_t deadline) {
+  vector<ResolvedAddr> addrs;
+
+  int32_t r = Resolver::instance()->resolve(host, addrs, deadline);
+  if (r) {
+    KLOGI(TAG, "resolve %s failed: %s", host, Resolver::error_string(r));
+    errno = r == EAI_AGAIN && deadline && steady_now_ms() >= deadline
+      ? ETIMEDOUT : EHOSTUNREACH;
+    return -1;
+  }
+  sort_addrs(addrs);
+  return race_connect(addrs, port, deadline);
+}
+
+} // namespace lizard
+} // namespace rokid
@@ -0,0 +1,313 @@
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "event-loop.h"
+#include "common.h"
+
+#define MAX_EVENTS 256
+// max read results delivered for one channel per loop iteration,
+// avoid one busy connection starve others
+#define MAX_READS_PER_EVENT 64
+
+namespace rokid {
+namespace lizard {
+
+EventLoop::EventLoop() {
+}
+
+EventLoop::~EventLoop() {
+  uint32_t i;
+  for (i = 0; i < channels.size(); ++i) {
+    delete channels[i];
+  }
+  for (i = 0; i < dead_channels.size(); ++i) {
+    delete dead_channels[i];
+  }
+  if (event_fd >= 0)
+    ::close(event_fd);
+  if (epoll_fd >= 0)
+    ::close(epoll_fd);
+}
+
+bool EventLoop::init() {
+  if (epoll_fd >= 0)
+    return true;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    KLOGE(TAG, "epoll_create1 failed: %s", strerror(errno));
+    return false;
+  }
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    KLOGE(TAG, "eventfd failed: %s", strerror(errno));
+    ::close(epoll_fd);
+    epoll_fd = -1;
+    return false;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) < 0) {
+    KLOGE(TAG, "epoll add eventfd failed: %s", strerror(errno));
+    ::close(event_fd);
+    ::close(epoll_fd);
+    event_fd = epoll_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+EventLoop::Channel* EventLoop::find_channel(Node* node) {
+  int fd = node->get_fd();
+  if (fd >= 0 && (uint32_t)fd < channels.size() && channels[fd]
+      && channels[fd]->node == node)
+    return channels[fd];
+  // node closed before removed
+  uint32_t i;
+  for (i = 0; i < channels.size(); ++i) {
+    if (channels[i] && channels[i]->node == node)
+      return channels[i];
+  }
+  return nullptr;
+}
+
+bool EventLoop::add(Node* node, Buffer* out, EventHandler* handler,
+    NodeArgs<void>* read_args) {
+  if (epoll_fd < 0 || node == nullptr || handler == nullptr)
+    return false;
+  int fd = node->get_fd();
+  if (fd < 0) {
+    KLOGW(TAG, "event loop: node %s not connected", node->name());
+    return false;
+  }
+  if ((uint32_t)fd < channels.size() && channels[fd])
+    return false;
+  if (!node->set_nonblock(true))
+    return false;
+
+  Channel* ch = new Channel();
+  ch->node = node;
+  ch->fd = fd;
+  ch->out = out;
+  ch->handler = handler;
+  ch->read_args = read_args;
+  ch->events = EPOLLIN;
+  ch->removed = false;
+  ch->read_pending = false;
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ch->events;
+  ev.data.ptr = ch;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    KLOGW(TAG, "epoll add socket %d failed: %s", fd, strerror(errno));
+    delete ch;
+    return false;
+  }
+  if ((uint32_t)fd >= channels.size())
+    channels.resize(fd + 1, nullptr);
+  channels[fd] = ch;
+  ++channel_count;
+  // data may be already buffered in node chain during init
+  ch->read_pending = true;
+  ready_channels.push_back(ch);
+  return true;
+}
+
+void EventLoop::remove(Node* node) {
+  Channel* ch = find_channel(node);
+  if (ch)
+    drop(ch);
+}
+
+void EventLoop::drop(Channel* ch) {
+  // socket may be closed already, ignore error
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ch->fd, nullptr);
+  channels[ch->fd] = nullptr;
+  ch->removed = true;
+  ch->writes.clear();
+  --channel_count;
+  dead_channels.push_back(ch);
+}
+
+bool EventLoop::update_events(Channel* ch, uint32_t events) {
+  if (ch->events == events)
+    return true;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = ch;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ch->fd, &ev) < 0) {
+    KLOGW(TAG, "epoll mod socket %d failed: %s", ch->fd, strerror(errno));
+    return false;
+  }
+  ch->events = events;
+  return true;
+}
+
+bool EventLoop::write(Node* node, Buffer* in, NodeArgs<void>* args) {
+  Channel* ch = find_channel(node);
+  if (ch == nullptr || ch->removed)
+    return false;
+  if (!ch->writes.empty()) {
+    // keep order of writes
+    ch->writes.push_back({ in, args });
+    return true;
+  }
+  if (node->write(in, args))
+    return true;
+  if (!node->would_block())
+    return false;
+  ch->writes.push_back({ in, args });
+  return update_events(ch, EPOLLIN | EPOLLOUT);
+}
+
+void EventLoop::fail(Channel* ch) {
+  NodeError err = *ch->node->get_error();
+  drop(ch);
+  ch->handler->on_error(ch->node, &err);
+}
+
+void EventLoop::handle_read(Channel* ch) {
+  uint32_t count = 0;
+
+  ch->read_pending = false;
+  while (!ch->removed) {
+    if (count >= MAX_READS_PER_EVENT) {
+      // ssl node may hold decrypted data that epoll never signal
+      if (!ch->read_pending) {
+        ch->read_pending = true;
+        ready_channels.push_back(ch);
+      }
+      break;
+    }
+    if (!ch->node->read(ch->out, ch->read_args)) {
+      if (!ch->node->would_block()) {
+        fail(ch);
+      } else {
+        // all received data consumed, give back buffers grown by large frame
+        ch->node->shrink_buffers();
+        if (ch->out)
+          ch->out->shrink();
+      }
+      break;
+    }
+    ++count;
+    ch->handler->on_read(ch->node, ch->out);
+    if (ch->out)
+      ch->out->clear();
+  }
+}
+
+void EventLoop::handle_write(Channel* ch) {
+  bool r;
+
+  while (!ch->removed && !ch->writes.empty()) {
+    PendingWrite& pw = ch->writes.front();
+    // whole 'in' consumed by node chain, only data in node buffers remained
+    if (pw.in == nullptr || pw.in->empty())
+      r = ch->node->flush(pw.args);
+    else
+      r = ch->node->write(pw.in, pw.args);
+    if (!r) {
+      if (!ch->node->would_block())
+        fail(ch);
+      return;
+    }
+    ch->writes.pop_front();
+  }
+  if (ch->removed)
+    return;
+  update_events(ch, EPOLLIN);
+  ch->handler->on_drain(ch->node);
+}
+
+int32_t EventLoop::run_once(int32_t timeout) {
+  struct epoll_event events[MAX_EVENTS];
+  int32_t n, i;
+  uint32_t j;
+
+  if (epoll_fd < 0)
+    return -1;
+  if (!ready_channels.empty())
+    timeout = 0;
+  n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+  if (n < 0) {
+    if (errno == EINTR)
+      return 0;
+    KLOGE(TAG, "epoll_wait failed: %s", strerror(errno));
+    return -1;
+  }
+  for (i = 0; i < n; ++i) {
+    Channel* ch = reinterpret_cast<Channel*>(events[i].data.ptr);
+    if (ch == nullptr) {
+      uint64_t v;
+      if (::read(event_fd, &v, sizeof(v)) < 0) {
+        // eventfd counter already cleared
+      }
+      continue;
+    }
+    if (ch->removed)
+      continue;
+    // read first, EPOLLHUP/EPOLLERR reported by read failure
+    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+      handle_read(ch);
+    if ((events[i].events & EPOLLOUT) && !ch->removed)
+      handle_write(ch);
+  }
+  if (!ready_channels.empty()) {
+    std::vector<Channel*> chs;
+    chs.swap(ready_channels);
+    for (j = 0; j < chs.size(); ++j) {
+      if (!chs[j]->removed && chs[j]->read_pending) {
+        handle_read(chs[j]);
+        ++n;
+      }
+    }
+  }
+  if (!dead_channels.empty()) {
+    for (j = 0; j < ready_channels.size();) {
+      if (ready_channels[j]->removed) {
+        ready_channels[j] = ready_channels.back();
+        ready_channels.pop_back();
+      } else {
+        ++j;
+      }
+    }
+    for (j = 0; j < dead_channels.size(); ++j) {
+      delete dead_channels[j];
+    }
+    dead_channels.clear();
+  }
+  return n;
+}
+
+void EventLoop::run() {
+  while (!stopped) {
+    if (run_once(-1) < 0)
+      break;
+  }
+  stopped = false;
+}
+
+void EventLoop::stop() {
+  stopped = true;
+  wakeup();
+}
+
+void EventLoop::wakeup() {
+  uint64_t v = 1;
+  if (event_fd >= 0 && ::write(event_fd, &v, sizeof(v)) < 0) {
+    // counter overflow, loop already signaled
+  }
+}
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
@@ -0,0 +1,363 @@
+#ifdef __linux__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+#include "loop-group.h"
+#include "mpsc-queue.h"
+#include "common.h"
+
+namespace rokid {
+namespace lizard {
+
+#define TASK_ADD 0
+#define TASK_REMOVE 1
+#define TASK_WRITE 2
+#define TASK_CALL 3
+
+class LoopTask {
+public:
+  std::atomic<LoopTask*> next;
+  int32_t type;
+  Node* node;
+  Buffer* buf;
+  EventHandler* handler;
+  NodeArgs<void>* args;
+  void (*func)(void*);
+  void (*done)(Node*, void*);
+  void* arg;
+};
+
+// forward events of a node chain to user handler, and track shard load
+class ShardHandler : public EventHandler {
+public:
+  ShardHandler(LoopShard* s, EventHandler* h) : shard(s), user(h) {
+  }
+
+  void on_read(Node* node, Buffer* data) {
+    user->on_read(node, data);
+  }
+
+  void on_drain(Node* node) {
+    user->on_drain(node);
+  }
+
+  void on_error(Node* node, const NodeError* err);
+
+private:
+  LoopShard* shard;
+  EventHandler* user;
+};
+
+class LoopShard {
+public:
+  LoopShard(int32_t i) : index(i) {
+  }
+
+  ~LoopShard() {
+    LoopTask* t;
+    while ((t = tasks.pop()) != nullptr) {
+      delete t;
+    }
+  }
+
+  bool start(bool pin, uint32_t cpus) {
+    if (!loop.init())
+      return false;
+    stopped = false;
+    thread = std::thread([this, pin, cpus]() {
+      if (pin)
+        bind_cpu(index % cpus);
+      run();
+    });
+    return true;
+  }
+
+  void stop() {
+    if (!thread.joinable())
+      return;
+    stopped = true;
+    loop.wakeup();
+    thread.join();
+  }
+
+  void post(LoopTask* task) {
+    tasks.push(task);
+    loop.wakeup();
+  }
+
+  bool in_loop_thread() const {
+    return thread_id.load(std::memory_order_acquire)
+      == std::this_thread::get_id();
+  }
+
+  void run_task(LoopTask* task) {
+    switch (task->type) {
+      case TASK_ADD:
+        do_add(task->node, task->buf, task->handler, task->args);
+        break;
+      case TASK_REMOVE:
+        do_remove(task->node);
+        if (task->done)
+          task->done(task->node, task->arg);
+        break;
+      case TASK_WRITE:
+        do_write(task->node, task->buf, task->args);
+        break;
+      case TASK_CALL:
+        task->func(task->arg);
+        break;
+    }
+  }
+
+  void do_add(Node* node, Buffer* out, EventHandler* handler,
+      NodeArgs<void>* read_args) {
+    ShardHandler* sh = new ShardHandler(this, handler);
+    if (!loop.add(node, out, sh, read_args)) {
+      delete sh;
+      load.fetch_sub(1, std::memory_order_relaxed);
+      NodeError err = *node->get_error();
+      if (err.code == 0) {
+        err.node = node;
+        err.code = EINVAL;
+        err.desc = "add node chain to event loop failed";
+      }
+      handler->on_error(node, &err);
+      return;
+    }
+    handlers[node] = sh;
+  }
+
+  void do_remove(Node* node) {
+    auto it = handlers.find(node);
+    if (it == handlers.end())
+      return;
+    loop.remove(node);
+    delete it->second;
+    handlers.erase(it);
+    load.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void do_write(Node* node, Buffer* in, NodeArgs<void>* args) {
+    auto it = handlers.find(node);
+    if (it == handlers.end())
+      return;
+    if (loop.write(node, in, args))
+      return;
+    NodeError err = *node->get_error();
+    loop.remove(node);
+    it->second->on_error(node, &err);
+  }
+
+  // called by ShardHandler::on_error, node already removed from loop
+  void removed(Node* node) {
+    handlers.erase(node);
+    load.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+private:
+  void bind_cpu(uint32_t cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r) {
+      KLOGW(TAG, "loop shard %d bind cpu %u failed: %s", index, cpu,
+          strerror(r));
+    }
+  }
+
+  void run_tasks() {
+    LoopTask* t;
+    while ((t = tasks.pop()) != nullptr) {
+      run_task(t);
+      delete t;
+    }
+  }
+
+  void run() {
+    thread_id.store(std::this_thread::get_id(), std::memory_order_release);
+    while (!stopped) {
+      run_tasks();
+      if (loop.run_once(-1) < 0)
+        break;
+    }
+    run_tasks();
+    for (auto it = handlers.begin(); it != handlers.end(); ++it) {
+      loop.remove(it->first);
+      delete it->second;
+    }
+    handlers.clear();
+    load.store(0, std::memory_order_relaxed);
+    thread_id.store(std::thread::id(), std::memory_order_release);
+  }
+
+public:
+  int32_t index;
+  std::atomic<uint32_t> load{0};
+
+private:
+  EventLoop loop;
+  MPSCQueue<LoopTask> tasks;
+  std::thread thread;
+  std::atomic<std::thread::id> thread_id{std::thread::id()};
+  std::atomic<bool> stopped{false};
+  // only accessed in loop thread
+  std::unordered_map<Node*, ShardHandler*> handlers;
+};
+
+void ShardHandler::on_error(Node* node, const NodeError* err) {
+  EventHandler* h = user;
+  shard->removed(node);
+  delete this;
+  h->on_error(node, err);
+}
+
+LoopGroup::LoopGroup() {
+}
+
+LoopGroup::~LoopGroup() {
+  stop();
+}
+
+bool LoopGroup::start(uint32_t count, bool pin) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t i;
+
+  if (!shards.empty())
+    return false;
+  if (cpus <= 0)
+    cpus = 1;
+  if (count == 0)
+    count = cpus;
+  for (i = 0; i < count; ++i) {
+    LoopShard* s = new LoopShard(i);
+    shards.push_back(s);
+    if (!s->start(pin, cpus)) {
+      stop();
+      return false;
+    }
+  }
+  return true;
+}
+
+void LoopGroup::stop() {
+  uint32_t i;
+  for (i = 0; i < shards.size(); ++i) {
+    shards[i]->stop();
+  }
+  for (i = 0; i < shards.size(); ++i) {
+    delete shards[i];
+  }
+  shards.clear();
+}
+
+LoopShard* LoopGroup::get_shard(int32_t shard) const {
+  if (shard < 0 || (uint32_t)shard >= shards.size())
+    return nullptr;
+  return shards[shard];
+}
+
+int32_t LoopGroup::add(Node* node, Buffer* out, EventHandler* handler,
+    NodeArgs<void>* read_args) {
+  LoopShard* best = nullptr;
+  uint32_t i, l, min_load = UINT32_MAX;
+
+  if (node == nullptr || handler == nullptr)
+    return -1;
+  for (i = 0; i < shards.size(); ++i) {
+    l = shards[i]->load.load(std::memory_order_relaxed);
+    if (l < min_load) {
+      min_load = l;
+      best = shards[i];
+    }
+  }
+  if (best == nullptr)
+    return -1;
+  best->load.fetch_add(1, std::memory_order_relaxed);
+  LoopTask* t = new LoopTask();
+  t->type = TASK_ADD;
+  t->node = node;
+  t->buf = out;
+  t->handler = handler;
+  t->args = read_args;
+  best->post(t);
+  return best->index;
+}
+
+bool LoopGroup::remove(int32_t shard, Node* node,
+    void (*done)(Node*, void*), void* arg) {
+  LoopShard* s = get_shard(shard);
+  if (s == nullptr)
+    return false;
+  if (s->in_loop_thread()) {
+    s->do_remove(node);
+    if (done)
+      done(node, arg);
+    return true;
+  }
+  LoopTask* t = new LoopTask();
+  t->type = TASK_REMOVE;
+  t->node = node;
+  t->done = done;
+  t->arg = arg;
+  s->post(t);
+  return true;
+}
+
+bool LoopGroup::write(int32_t shard, Node* node, Buffer* in,
+    NodeArgs<void>* args) {
+  LoopShard* s = get_shard(shard);
+  if (s == nullptr)
+    return false;
+  if (s->in_loop_thread()) {
+    s->do_write(node, in, args);
+    return true;
+  }
+  LoopTask* t = new LoopTask();
+  t->type = TASK_WRITE;
+  t->node = node;
+  t->buf = in;
+  t->args = args;
+  s->post(t);
+  return true;
+}
+
+bool LoopGroup::call(int32_t shard, void (*func)(void*), void* arg) {
+  LoopShard* s = get_shard(shard);
+  if (s == nullptr || func == nullptr)
+    return false;
+  if (s->in_loop_thread()) {
+    func(arg);
+    return true;
+  }
+  LoopTask* t = new LoopTask();
+  t->type = TASK_CALL;
+  t->func = func;
+  t->arg = arg;
+  s->post(t);
+  return true;
+}
+
+uint32_t LoopGroup::load(int32_t shard) const {
+  LoopShard* s = get_shard(shard);
+  return s ? s->load.load(std::memory_order_relaxed) : 0;
+}
+
+int32_t LoopGroup::current_shard() const {
+  uint32_t i;
+  for (i = 0; i < shards.size(); ++i) {
+    if (shards[i]->in_loop_thread())
+      return i;
+  }
+  return -1;
+}
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+
+namespace rokid {
+namespace lizard {
+
+// intrusive lock-free multi-producer single-consumer queue
+// (Dmitry Vyukov's algorithm). push is wait-free, pop never blocks.
+// T must have member 'std::atomic<T*> next'.
+template <typename T>
+class MPSCQueue {
+public:
+  MPSCQueue() : head(&stub), tail(&stub) {
+    stub.next.store(nullptr, std::memory_order_relaxed);
+  }
+
+  // thread safe
+  void push(T* v) {
+    v->next.store(nullptr, std::memory_order_relaxed);
+    T* prev = head.exchange(v, std::memory_order_acq_rel);
+    prev->next.store(v, std::memory_order_release);
+  }
+
+  // consumer thread only
+  // return: nullptr if queue empty or a producer is in the middle of push
+  T* pop() {
+    T* t = tail;
+    T* next = t->next.load(std::memory_order_acquire);
+    if (t == &stub) {
+      if (next == nullptr)
+        return nullptr;
+      tail = next;
+      t = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail = next;
+      return t;
+    }
+    if (t != head.load(std::memory_order_acquire))
+      return nullptr;
+    push(&stub);
+    next = t->next.load(std::memory_order_acquire);
+    if (next) {
+      tail = next;
+      return t;
+    }
+    return nullptr;
+  }
+
+  // consumer thread only
+  bool empty() const {
+    return tail == &stub && stub.next.load(std::memory_order_acquire) == nullptr;
+  }
+
+private:
+  std::atomic<T*> head;
+  T* tail;
+  T stub;
+};
+
+} // namespace lizard
+} // namespace rokid
@@ -1,8 +1,18 @@
 #include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <chrono>
 #include "node.h"
 #include "common.h"
@@ -14,45 +24,138 @@
 #endif
 
 #define MIN_BUFSIZE 4096
+#define RING_REWIND_SIZE 256
 
 using namespace std;
+using namespace std::chrono;
 
 namespace rokid {
 namespace lizard {
 
 thread_local NodeError Node::err_info;
 
+// ==================NodeStats====================
+static const char* counter_names[] = {
+  "reads",
+  "writes",
+  "bytes_in",
+  "bytes_out",
+  "read_loops",
+  "syscalls",
+  "partial_reads",
+  "partial_writes",
+  "would_blocks",
+  "shifts",
+  "shift_bytes",
+  "buffer_full",
+  "errors"
+};
+
+void NodeStats::add_error(int32_t code) {
+  uint32_t i;
+
+  add(ERRORS);
+  for (i = 0; i < ERROR_SLOTS; ++i) {
+    int32_t c = error_codes[i].load(std::memory_order_relaxed);
+    if (c == code) {
+      bump(error_counts[i], 1);
+      return;
+    }
+    if (c == 0) {
+      // count stored before code, so readers see no slot with code but
+      // without count
+      bump(error_counts[i], 1);
+      error_codes[i].store(code, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+void NodeStats::reset() {
+  uint32_t i;
+
+  for (i = 0; i < COUNT; ++i)
+    counters[i].store(0, std::memory_order_relaxed);
+  for (i = 0; i < OPCODE_SLOTS; ++i) {
+    frames_in[i].store(0, std::memory_order_relaxed);
+    frames_out[i].store(0, std::memory_order_relaxed);
+  }
+  for (i = 0; i < ERROR_SLOTS; ++i) {
+    error_codes[i].store(0, std::memory_order_relaxed);
+    error_counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+const char* NodeStats::counter_name(uint32_t idx) {
+  return idx < COUNT ? counter_names[idx] : "unknown";
+}
+
+NodeStatsSnapshot::NodeStatsSnapshot(const char* n, const NodeStats& stats)
+  : name(n) {
+  uint32_t i;
+
+  for (i = 0; i < NodeStats::COUNT; ++i)
+    counters[i] = stats.counters[i].load(std::memory_order_relaxed);
+  for (i = 0; i < NodeStats::OPCODE_SLOTS; ++i) {
+    frames_in[i] = stats.frames_in[i].load(std::memory_order_relaxed);
+    frames_out[i] = stats.frames_out[i].load(std::memory_order_relaxed);
+  }
+  for (i = 0; i < NodeStats::ERROR_SLOTS; ++i) {
+    int32_t c = stats.error_codes[i].load(std::memory_order_acquire);
+    if (c == 0)
+      break;
+    errors.push_back(std::make_pair(c,
+          stats.error_counts[i].load(std::memory_order_relaxed)));
+  }
+}
+
 // ==================Buffer====================
 void Buffer::set_data(void* p, uint32_t size, uint32_t b, uint32_t e) {
   datap = (int8_t*)p;
   capacity = size;
   begin = b;
   end = e;
+  ring = false;
 }
 
 void Buffer::obtain(uint32_t size) {
   end += size;
-  if (end > capacity)
+  if (ring) {
+    if (end > begin + capacity)
+      end = begin + capacity;
+  } else if (end > capacity) {
     end = capacity;
+  }
 }
 
 void Buffer::consume(uint32_t size) {
   begin += size;
   if (begin > end)
     begin = end;
-  if (begin == end)
+  if (begin == end) {
     clear();
+  } else if (ring && begin >= capacity) {
+    // data wholly in mirror, move indexes back to first mapping
+    begin -= capacity;
+    end -= capacity;
+  }
 }
 
-void Buffer::shift() {
+uint32_t Buffer::shift() {
   if (begin == 0)
-    return;
+    return 0;
   uint32_t sz = end - begin;
+  // ring buffer need no shift, but a few bytes are moved back to front,
+  // so reads keep reusing memory in cpu cache. not if data wrapped into
+  // the mirror, it overlaps the front physically.
+  if (ring && (sz > RING_REWIND_SIZE || begin + sz > capacity))
+    return 0;
   if (sz) {
     memmove(datap, datap + begin, sz);
   }
   begin = 0;
   end = begin + sz;
+  return sz;
 }
 
 void Buffer::clear() {
@@ -61,38 +164,87 @@ void Buffer::clear() {
 
 void Buffer::move(Buffer& src) {
   set_data(src.datap, src.capacity, src.begin, src.end);
+  ring = src.ring;
   src.clear();
 }
 
 void Buffer::assign(Buffer& src) {
   set_data(src.datap, src.capacity, src.begin, src.end);
+  ring = src.ring;
 }
 
 bool Buffer::append(const void* data, uint32_t size) {
-  if (end + size > capacity)
+  if (size > remain_space())
     return false;
   memcpy(datap + end, data, size);
   end += size;
   return true;
 }
 
-/**
+// ==================MmapBuffer====================
 MmapBuffer::MmapBuffer(uint32_t size) {
+  long page = sysconf(_SC_PAGESIZE);
+  if (page <= 0)
+    page = MIN_BUFSIZE;
   if (size < MIN_BUFSIZE)
     size = MIN_BUFSIZE;
-  datap = (int8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+  size = (size + page - 1) / page * page;
+  if (map_ring(size))
+    return;
+  KLOGW(TAG, "map ring buffer failed: %s, use plain mapping",
+      strerror(errno));
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (datap) {
-    capacity = size;
+  if (p != MAP_FAILED) {
+    mapping = p;
+    mapping_size = size;
+    set_data(p, size, 0, 0);
   }
 }
 
 MmapBuffer::~MmapBuffer() {
-  if (datap) {
-    munmap(datap, capacity);
+  if (mapping) {
+    munmap(mapping, mapping_size);
   }
 }
-*/
+
+bool MmapBuffer::map_ring(uint32_t size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+  int fd = syscall(SYS_memfd_create, "lizard-ring", MFD_CLOEXEC);
+  if (fd < 0)
+    return false;
+  if (ftruncate(fd, size) < 0) {
+    ::close(fd);
+    return false;
+  }
+  // reserve address space of two copies, then map the memfd to both halves
+  size_t total = (size_t)size * 2;
+  int8_t* p = (int8_t*)mmap(NULL, total, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  if (mmap(p, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+        == MAP_FAILED
+      || mmap(p + size, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(p, total);
+    ::close(fd);
+    return false;
+  }
+  // mappings keep the memory alive
+  ::close(fd);
+  mapping = p;
+  mapping_size = total;
+  set_data(p, size, 0, 0);
+  ring = true;
+  return true;
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
 
 // ==================Node====================
 void Node::set_read_buffers(NodeArgs<Buffer> *bufs) {
@@ -127,7 +279,21 @@ bool Node::write(Buffer *in, NodeArgs<void> *args) {
   uint32_t argsIndex{0};
   void* targ = args ? args->get(&argsIndex) : nullptr;
   bool ret{true};
+#ifndef LIZARD_NO_STATS
+  uint32_t in_size = in ? in->size() : 0;
+#endif
 
+  TRACE_NODE("write");
+  NODE_STAT(WRITES, 1);
+
+  // data left by previous non-blocking write must be sent first
+  if (super_node && write_buffer && !write_buffer->empty()) {
+    if (!super_node->write(write_buffer, args)) {
+      ret = false;
+      goto exit;
+    }
+  }
+  write_args = args;
   while (true) {
     auto r = on_write(in, write_buffer, targ);
     if (r < 0) {
@@ -146,18 +312,58 @@ bool Node::write(Buffer *in, NodeArgs<void> *args) {
   }
 
 exit:
+  write_args = nullptr;
+#ifndef LIZARD_NO_STATS
+  if (in && in->size() < in_size)
+    NODE_STAT(BYTES_OUT, in_size - in->size());
+#endif
+  LIZARD_PROBE3(node_write, name(), in ? in->size() : 0, ret);
   if (args)
     args->restore(argsIndex);
   if (ret)
     clear_node_error();
+  else
+    count_failure();
   return ret;
 }
 
+int64_t Node::writev(const struct iovec* iov, int32_t iovcnt,
+    NodeArgs<void> *args) {
+  uint32_t argsIndex{0};
+  void* targ = args ? args->get(&argsIndex) : nullptr;
+  TRACE_NODE("writev");
+  NODE_STAT(WRITES, 1);
+  int64_t r = on_writev(iov, iovcnt, targ);
+  LIZARD_PROBE3(node_writev, name(), iovcnt, r);
+  if (args)
+    args->restore(argsIndex);
+  if (r >= 0) {
+    NODE_STAT(BYTES_OUT, r);
+    clear_node_error();
+  } else {
+    count_failure();
+  }
+  return r;
+}
+
+int64_t Node::on_writev(const struct iovec* iov, int32_t iovcnt,
+    void* arg) {
+  err_info.node = this;
+  err_info.code = ENOTSUP;
+  err_info.desc = strerror(ENOTSUP);
+  return -1;
+}
+
 bool Node::read(Buffer *out, NodeArgs<void> *args) {
   uint32_t argsIndex{0};
   void* targ = args ? args->get(&argsIndex) : nullptr;
   bool ret{true};
+#ifndef LIZARD_NO_STATS
+  uint32_t out_size = out ? out->size() : 0;
+#endif
 
+  TRACE_NODE("read");
+  NODE_STAT(READS, 1);
   while (true) {
     auto r = on_read(out, read_buffer, targ);
     if (r < 0) {
@@ -165,6 +371,7 @@ bool Node::read(Buffer *out, NodeArgs<void> *args) {
       goto exit;
     }
     if (r && super_node) {
+      NODE_STAT(READ_LOOPS, 1);
       if (!super_node->read(read_buffer, args)) {
         ret = false;
         goto exit;
@@ -175,6 +382,33 @@ bool Node::read(Buffer *out, NodeArgs<void> *args) {
   }
 
 exit:
+#ifndef LIZARD_NO_STATS
+  if (out && out->size() > out_size)
+    NODE_STAT(BYTES_IN, out->size() - out_size);
+#endif
+  LIZARD_PROBE3(node_read, name(), out ? out->size() : 0, ret);
+  if (args)
+    args->restore(argsIndex);
+  if (ret)
+    clear_node_error();
+  else
+    count_failure();
+  return ret;
+}
+
+bool Node::flush(NodeArgs<void> *args) {
+  uint32_t argsIndex{0};
+  bool ret{true};
+
+  if (super_node == nullptr)
+    return true;
+  if (args)
+    args->get(&argsIndex);
+  if (write_buffer && !write_buffer->empty()) {
+    ret = super_node->write(write_buffer, args);
+  } else {
+    ret = super_node->flush(args);
+  }
   if (args)
     args->restore(argsIndex);
   if (ret)
@@ -182,8 +416,19 @@ exit:
   return ret;
 }
 
+void Node::shrink_buffers() {
+  if (read_buffer)
+    read_buffer->shrink();
+  if (write_buffer)
+    write_buffer->shrink();
+  if (super_node)
+    super_node->shrink_buffers();
+}
+
 void Node::close() {
   clear_node_error();
+  nonblock = false;
+  deadline = 0;
   on_close();
   if (super_node) {
     super_node->close();
@@ -198,27 +443,148 @@ void Node::chain(Node* node) {
   super_node = node;
 }
 
+bool Node::set_nonblock(bool nb) {
+  int fd = get_fd();
+  if (fd < 0)
+    return false;
+  // socket is kept non-blocking in both modes, blocking mode waits in poll
+  if (!set_fd_nonblock(fd)) {
+    KLOGW(TAG, "set socket %d non-blocking failed: %s", fd, strerror(errno));
+    return false;
+  }
+  Node* node = this;
+  while (node) {
+    node->nonblock = nb;
+    node = node->super_node;
+  }
+  return true;
+}
+
+void Node::set_deadline(int32_t timeout) {
+  int64_t d = deadline_after(timeout);
+  Node* node = this;
+  while (node) {
+    node->deadline = d;
+    node = node->super_node;
+  }
+}
+
+int64_t Node::get_deadline(void* arg) const {
+  int64_t d = arg ? deadline_after(reinterpret_cast<int32_t*>(arg)[0]) : 0;
+  if (deadline && (d == 0 || deadline < d))
+    d = deadline;
+  return d;
+}
+
+bool Node::set_nodelay(bool nd) {
+  int fd = get_fd();
+  int on = nd ? 1 : 0;
+  if (fd < 0)
+    return false;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0) {
+    KLOGW(TAG, "set socket %d nodelay failed: %s", fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+int Node::get_fd() const {
+  return super_node ? super_node->get_fd() : -1;
+}
+
+bool Node::would_block() const {
+  return err_info.code == EAGAIN || err_info.code == EWOULDBLOCK;
+}
+
 void Node::clear_node_error() {
   err_info.node = nullptr;
   err_info.code = 0;
-  err_info.desc.clear();
+  err_info.desc = "";
 }
 
-void set_rw_timeout(int socket, int32_t tm, bool rd) {
-  struct timeval tv;
-  if (tm > 0) {
-    tv.tv_sec = tm / 1000;
-    tv.tv_usec = (tm % 1000) * 1000;
-  } else {
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
+void Node::set_would_block() {
+  err_info.node = this;
+  err_info.code = EAGAIN;
+  err_info.desc = strerror(EAGAIN);
+}
+
+void Node::shift_buffer(Buffer* buf) {
+  uint32_t sz = buf->shift();
+  if (sz) {
+    NODE_STAT(SHIFTS, 1);
+    NODE_STAT(SHIFT_BYTES, sz);
   }
-  int opt = rd ? SO_RCVTIMEO : SO_SNDTIMEO;
-  if (setsockopt(socket, SOL_SOCKET, opt, &tv, sizeof(tv)) < 0) {
-    KLOGW(TAG, "set_rw_timeout failed: %s", strerror(errno));
+}
+
+void Node::count_failure() {
+  // failure caused by super node counted by super node
+  if (err_info.node != this)
+    return;
+  if (would_block())
+    NODE_STAT(WOULD_BLOCKS, 1);
+  else
+    NODE_STAT_ERROR(err_info.code);
+}
+
+void Node::snapshot_stats(std::vector<NodeStatsSnapshot>& out) const {
+  const Node* node = this;
+  while (node) {
+    out.emplace_back(node->name(), node->stats);
+    node = node->super_node;
   }
 }
 
+void Node::reset_stats() {
+  Node* node = this;
+  while (node) {
+    node->stats.reset();
+    node = node->super_node;
+  }
+}
+
+int64_t steady_now_ms() {
+  return duration_cast<milliseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t deadline_after(int32_t timeout) {
+  return timeout > 0 ? steady_now_ms() + timeout : 0;
+}
+
+int32_t wait_fd(int fd, bool rd, int64_t deadline) {
+  struct pollfd pfd;
+  int32_t tm = -1;
+  int r;
+
+  pfd.fd = fd;
+  pfd.events = rd ? POLLIN : POLLOUT;
+  while (true) {
+    if (deadline) {
+      int64_t remain = deadline - steady_now_ms();
+      if (remain <= 0)
+        return 0;
+      tm = remain > INT32_MAX ? INT32_MAX : remain;
+    }
+    pfd.revents = 0;
+    r = poll(&pfd, 1, tm);
+    if (r > 0)
+      return 1;
+    if (r < 0 && errno != EINTR)
+      return -1;
+    if (r == 0 && deadline == 0)
+      continue;
+  }
+}
+
+bool set_fd_nonblock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return false;
+  if (flags & O_NONBLOCK)
+    return true;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
 void ignore_sigpipe(int socket) {
 #ifdef __APPLE__
   int option_value = 1; /* Set NOSIGPIPE to ON */
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <map>
+#include <string>
+#include "pipeline.h"
+#include "http.h"
+#include "common.h"
+
+using namespace std;
+
+namespace rokid {
+namespace lizard {
+
+extern void ignore_sigpipe(int socket);
+
+// ==================TcpLayer====================
+bool TcpLayer::connect(const rokid::Uri& uri, int32_t timeout,
+    bool nodelay, PipelineError& err) {
+  int fd = tcp_connect(uri.host.c_str(), uri.port, deadline_after(timeout));
+  if (fd < 0) {
+    if (errno == ETIMEDOUT)
+      err.set(TIMEOUT, "tcp connect timeout");
+    else
+      err.set(errno, strerror(errno));
+    return false;
+  }
+  if (nodelay) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  ignore_sigpipe(fd);
+  socket = fd;
+  return true;
+}
+
+bool TcpLayer::wait(bool rd, int32_t timeout, int64_t* dl,
+    PipelineError& err) {
+  if (*dl < 0)
+    *dl = deadline_after(timeout);
+  int32_t r = wait_fd(socket, rd, *dl);
+  if (r > 0)
+    return true;
+  if (r == 0)
+    err.set(TIMEOUT, rd ? "tcp read timeout" : "tcp write timeout");
+  else
+    err.set(errno, strerror(errno));
+  return false;
+}
+
+void TcpLayer::fail(ssize_t r, PipelineError& err) {
+  if (r == 0 || socket < 0)
+    err.set(REMOTE_CLOSED, socket < 0 ? "tcp socket not connected"
+        : "remote socket closed");
+  else
+    err.set(errno, strerror(errno));
+}
+
+void TcpLayer::close() {
+  if (socket >= 0) {
+    ::close(socket);
+    socket = -1;
+  }
+}
+
+// ==================WSLayer====================
+int32_t WSLayer::build_request(const rokid::Uri& uri, char* buf,
+    uint32_t size) {
+  HttpRequest req;
+  char host[300];
+
+  req.setPath(uri.path.c_str());
+  snprintf(host, sizeof(host), "%s:%d", uri.host.c_str(), uri.port);
+  req.addHeaderField("Host", host);
+  req.addHeaderField("Upgrade", "websocket");
+  req.addHeaderField("Connection", "Upgrade");
+  req.addHeaderField("Sec-WebSocket-Key", "x3JJHMbDL1EzLkh9GBhXDw==");
+  req.addHeaderField("Sec-WebSocket-Version", "13");
+  return req.build(buf, size);
+}
+
+int32_t WSLayer::parse_response(const char* data, uint32_t size) {
+  static const char header_end[] = "\r\n\r\n";
+  HttpResponse resp;
+  map<string, string>::iterator it;
+  uint32_t i;
+
+  // size of response header, data after it belongs to frames
+  for (i = 0; i + 4 <= size; ++i) {
+    if (memcmp(data + i, header_end, 4) == 0)
+      break;
+  }
+  if (i + 4 > size)
+    return 0;
+  if (resp.parse(data, i + 4) <= 0 || strcmp(resp.statusCode, "101"))
+    return -1;
+  it = resp.headerFields.find("Upgrade");
+  if (it == resp.headerFields.end()
+      || strcasecmp(it->second.c_str(), "websocket"))
+    return -1;
+  it = resp.headerFields.find("Connection");
+  if (it == resp.headerFields.end()
+      || strcasecmp(it->second.c_str(), "upgrade"))
+    return -1;
+  // no extension offered, any accepted is a protocol error
+  it = resp.headerFields.find("Sec-WebSocket-Extensions");
+  if (it != resp.headerFields.end())
+    return -1;
+  return i + 4;
+}
+
+} // namespace lizard
+} // namespace rokid
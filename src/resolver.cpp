@@ -0,0 +1,247 @@
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "resolver.h"
+#include "common.h"
+
+namespace rokid {
+namespace lizard {
+
+static int32_t getaddrinfo_lookup(const char* host,
+    std::vector<ResolvedAddr>& addrs) {
+  struct addrinfo hints;
+  struct addrinfo* res = nullptr;
+  struct addrinfo* ai;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  int r = getaddrinfo(host, nullptr, &hints, &res);
+  if (r)
+    return r;
+  for (ai = res; ai; ai = ai->ai_next) {
+    if (ai->ai_addrlen > sizeof(struct sockaddr_storage))
+      continue;
+    ResolvedAddr ra;
+    memset(&ra.addr, 0, sizeof(ra.addr));
+    memcpy(&ra.addr, ai->ai_addr, ai->ai_addrlen);
+    ra.len = ai->ai_addrlen;
+    addrs.push_back(ra);
+  }
+  freeaddrinfo(res);
+  return addrs.empty() ? EAI_NONAME : 0;
+}
+
+Resolver* Resolver::instance() {
+  // never destroyed, worker threads may still be running at exit
+  static Resolver* resolver = new Resolver();
+  return resolver;
+}
+
+const char* Resolver::error_string(int32_t err) {
+  return gai_strerror(err);
+}
+
+bool Resolver::parse_numeric(const std::string& host,
+    std::vector<ResolvedAddr>& addrs) {
+  ResolvedAddr ra;
+  memset(&ra.addr, 0, sizeof(ra.addr));
+  struct sockaddr_in* in4 = (struct sockaddr_in*)&ra.addr;
+  struct sockaddr_in6* in6 = (struct sockaddr_in6*)&ra.addr;
+  if (inet_pton(AF_INET, host.c_str(), &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    ra.len = sizeof(*in4);
+  } else if (inet_pton(AF_INET6, host.c_str(), &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    ra.len = sizeof(*in6);
+  } else {
+    return false;
+  }
+  addrs.push_back(ra);
+  return true;
+}
+
+Resolver::Entry* Resolver::lookup(const std::string& host, bool* fresh) {
+  auto it = cache.find(host);
+  if (it == cache.end()) {
+    *fresh = false;
+    return nullptr;
+  }
+  *fresh = !it->second.pending && it->second.expire > steady_now_ms();
+  return &it->second;
+}
+
+void Resolver::start_lookup(const std::string& host, Entry* entry) {
+  if (entry->pending)
+    return;
+  entry->pending = true;
+  tasks.push_back(host);
+  if (idle_workers) {
+    task_cond.notify_one();
+  } else if (workers < max_workers) {
+    ++workers;
+    std::thread(&Resolver::run_worker, this).detach();
+  }
+}
+
+int32_t Resolver::resolve(const std::string& host,
+    std::vector<ResolvedAddr>& addrs, int64_t deadline) {
+  bool waited = false;
+  int64_t now;
+
+  if (parse_numeric(host, addrs))
+    return 0;
+  std::unique_lock<std::mutex> locker(mutex);
+  while (true) {
+    now = steady_now_ms();
+    auto it = cache.find(host);
+    // entry may be evicted by other threads while waiting, look it up again
+    if (it != cache.end() && !it->second.pending
+        && (waited || it->second.expire > now)) {
+      if (it->second.err == 0) {
+        addrs.insert(addrs.end(), it->second.addrs.begin(),
+            it->second.addrs.end());
+      }
+      return it->second.err;
+    }
+    if (deadline && now >= deadline)
+      return EAI_AGAIN;
+    if (it == cache.end()) {
+      evict(now);
+      it = cache.emplace(host, Entry()).first;
+    }
+    start_lookup(host, &it->second);
+    if (deadline) {
+      done_cond.wait_until(locker, std::chrono::steady_clock::time_point(
+            std::chrono::milliseconds(deadline)));
+    } else {
+      done_cond.wait(locker);
+    }
+    waited = true;
+  }
+}
+
+void Resolver::resolve_async(const std::string& host, Callback cb,
+    void* arg) {
+  std::vector<ResolvedAddr> addrs;
+  if (parse_numeric(host, addrs)) {
+    cb(0, &addrs, arg);
+    return;
+  }
+  std::unique_lock<std::mutex> locker(mutex);
+  bool fresh;
+  Entry* entry = lookup(host, &fresh);
+  if (fresh) {
+    int32_t err = entry->err;
+    addrs = entry->addrs;
+    locker.unlock();
+    cb(err, &addrs, arg);
+    return;
+  }
+  if (entry == nullptr) {
+    evict(steady_now_ms());
+    entry = &cache[host];
+  }
+  Waiter w;
+  w.cb = cb;
+  w.arg = arg;
+  entry->waiters.push_back(w);
+  start_lookup(host, entry);
+}
+
+void Resolver::run_worker() {
+  std::unique_lock<std::mutex> locker(mutex);
+  while (true) {
+    if (tasks.empty()) {
+      ++idle_workers;
+      task_cond.wait(locker);
+      --idle_workers;
+      continue;
+    }
+    std::string host = tasks.front();
+    tasks.pop_front();
+    LookupFunc func = lookup_func ? lookup_func : getaddrinfo_lookup;
+    locker.unlock();
+
+    std::vector<ResolvedAddr> addrs;
+    int32_t err = func(host.c_str(), addrs);
+    if (err) {
+      KLOGI(TAG, "resolve %s failed: %s", host.c_str(), gai_strerror(err));
+    }
+
+    locker.lock();
+    Entry& entry = cache[host];
+    std::vector<Waiter> waiters;
+    entry.addrs.swap(addrs);
+    entry.err = err;
+    entry.expire = steady_now_ms() + (err ? negative_ttl : ttl);
+    entry.pending = false;
+    waiters.swap(entry.waiters);
+    done_cond.notify_all();
+    if (!waiters.empty()) {
+      addrs = entry.addrs;
+      locker.unlock();
+      for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        it->cb(err, &addrs, it->arg);
+      }
+      locker.lock();
+    }
+  }
+}
+
+void Resolver::evict(int64_t now) {
+  if (cache.size() < MAX_CACHE_ENTRIES)
+    return;
+  auto it = cache.begin();
+  while (it != cache.end()) {
+    if (!it->second.pending && it->second.expire <= now)
+      it = cache.erase(it);
+    else
+      ++it;
+  }
+  // still full of unexpired entries, drop all of them
+  if (cache.size() >= MAX_CACHE_ENTRIES) {
+    it = cache.begin();
+    while (it != cache.end()) {
+      if (!it->second.pending)
+        it = cache.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void Resolver::set_ttl(uint32_t t, uint32_t nt) {
+  std::lock_guard<std::mutex> locker(mutex);
+  ttl = t;
+  negative_ttl = nt;
+}
+
+void Resolver::set_max_workers(uint32_t count) {
+  std::lock_guard<std::mutex> locker(mutex);
+  max_workers = count ? count : 1;
+}
+
+void Resolver::set_lookup(LookupFunc func) {
+  std::lock_guard<std::mutex> locker(mutex);
+  lookup_func = func;
+}
+
+void Resolver::clear_cache() {
+  std::lock_guard<std::mutex> locker(mutex);
+  auto it = cache.begin();
+  while (it != cache.end()) {
+    if (!it->second.pending)
+      it = cache.erase(it);
+    else
+      ++it;
+  }
+}
+
+} // namespace lizard
+} // namespace rokid
@@ -1,5 +1,6 @@
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
@@ -18,6 +19,8 @@ const char* SocketNode::error_messages[] = {
   "remote socket closed",
   "insufficient buffer capacity",
   "socket read timeout",
+  "socket write timeout",
+  "socket connect timeout",
 };
 
 void SocketNode::set_node_error_by_errno() {
@@ -31,34 +34,43 @@ SocketNode::~SocketNode() {
 }
 
 bool SocketNode::on_init(const rokid::Uri& uri, void* arg) {
-  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
-  KLOGD(TAG, "lizard: new socket %d", fd);
+  // 'arg': connect timeout in milliseconds
+  int fd = tcp_connect(uri.host.c_str(), uri.port, get_deadline(arg));
   if (fd < 0) {
-    set_node_error_by_errno();
-    return false;
-  }
-  struct sockaddr_in addr;
-  struct hostent* hp;
-  hp = gethostbyname(uri.host.c_str());
-  if (hp == nullptr) {
-    set_node_error_by_errno();
-    ::close(fd);
-    return false;
-  }
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  memcpy(&addr.sin_addr, hp->h_addr_list[0], sizeof(addr.sin_addr));
-  addr.sin_port = htons(uri.port);
-  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-    set_node_error_by_errno();
-    ::close(fd);
+    if (errno == ETIMEDOUT)
+      set_node_error(CONNECT_TIMEOUT);
+    else
+      set_node_error_by_errno();
     return false;
   }
+  KLOGD(TAG, "lizard: new socket %d", fd);
   ignore_sigpipe(fd);
   socket = fd;
   return true;
 }
 
+// wait socket ready after EAGAIN in blocking mode, deadline computed at
+// first wait of the operation, no extra syscall if socket always ready
+// return: false  failed, node error set
+bool SocketNode::wait(bool rd, void* arg, int64_t* dl) {
+  if (nonblock) {
+    set_would_block();
+    return false;
+  }
+  if (*dl < 0)
+    *dl = get_deadline(arg);
+  NODE_STAT(SYSCALLS, 1);
+  TRACE_SCOPE("poll()", "syscall");
+  int32_t r = wait_fd(socket, rd, *dl);
+  if (r > 0)
+    return true;
+  if (r == 0)
+    set_node_error(rd ? READ_TIMEOUT : WRITE_TIMEOUT);
+  else
+    set_node_error_by_errno();
+  return false;
+}
+
 void SocketNode::set_node_error(int32_t code) {
   err_info.node = this;
   err_info.code = code;
@@ -72,26 +84,92 @@ int32_t SocketNode::on_write(Buffer *in, Buffer *out, void* arg) {
   }
   if (in == nullptr || in->empty())
     return 0;
-  if (arg) {
-    set_rw_timeout(socket, reinterpret_cast<int32_t*>(arg)[0], false);
-  } else {
-    set_rw_timeout(socket, -1, false);
+  int64_t dl = -1;
+  while (!in->empty()) {
+    NODE_STAT(SYSCALLS, 1);
+    ssize_t r;
+    {
+      TRACE_SCOPE("write()", "syscall");
+      r = ::write(socket, in->data_begin(), in->size());
+    }
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN) {
+        if (wait(false, arg, &dl))
+          continue;
+        return -1;
+      }
+      set_node_error_by_errno();
+      return -1;
+    }
+    if (r == 0) {
+      set_node_error(REMOTE_CLOSED);
+      return -1;
+    }
+#ifdef LIZARD_DEBUG
+    // printf("sock-node: write %d bytes: ", (int)r);
+    // print_hex_data((uint8_t*)in->data_begin(), r);
+#endif
+    if ((uint32_t)r < in->size())
+      NODE_STAT(PARTIAL_WRITES, 1);
+    in->consume(r);
   }
-  ssize_t r = ::write(socket, in->data_begin(), in->size());
-  if (r < 0) {
-    set_node_error_by_errno();
+  return 0;
+}
+
+int64_t SocketNode::on_writev(const struct iovec* iov, int32_t iovcnt,
+    void* arg) {
+  struct iovec vec[MAX_IOV];
+  int32_t idx = 0;
+  int64_t total = 0;
+  int64_t dl = -1;
+
+  if (socket < 0) {
+    set_node_error(NOT_READY);
     return -1;
   }
-  if (r == 0) {
-    set_node_error(REMOTE_CLOSED);
+  if (iovcnt > MAX_IOV) {
+    err_info.node = this;
+    err_info.code = EINVAL;
+    err_info.desc = strerror(EINVAL);
     return -1;
   }
-#ifdef LIZARD_DEBUG
-  // printf("sock-node: write %d bytes: ", (int)r);
-  // print_hex_data((uint8_t*)in->data_begin(), r);
-#endif
-  in->clear();
-  return 0;
+  memcpy(vec, iov, sizeof(struct iovec) * iovcnt);
+  while (idx < iovcnt) {
+    NODE_STAT(SYSCALLS, 1);
+    ssize_t r;
+    {
+      TRACE_SCOPE("writev()", "syscall");
+      r = ::writev(socket, vec + idx, iovcnt - idx);
+    }
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN) {
+        // part of data written, caller continue with rest data later
+        if (nonblock && total > 0)
+          return total;
+        if (wait(false, arg, &dl))
+          continue;
+        return -1;
+      }
+      set_node_error_by_errno();
+      return -1;
+    }
+    total += r;
+    // skip written data, handle partial write
+    while (idx < iovcnt && (size_t)r >= vec[idx].iov_len) {
+      r -= vec[idx].iov_len;
+      ++idx;
+    }
+    if (idx < iovcnt) {
+      NODE_STAT(PARTIAL_WRITES, 1);
+      vec[idx].iov_base = reinterpret_cast<char*>(vec[idx].iov_base) + r;
+      vec[idx].iov_len -= r;
+    }
+  }
+  return total;
 }
 
 int32_t SocketNode::on_read(Buffer *out, Buffer *in, void* arg) {
@@ -103,24 +181,33 @@ int32_t SocketNode::on_read(Buffer *out, Buffer *in, void* arg) {
     set_node_error(INSUFF_BUFFER);
     return -1;
   }
-  if (arg) {
-    set_rw_timeout(socket, reinterpret_cast<int32_t*>(arg)[0], true);
-  } else {
-    set_rw_timeout(socket, -1, true);
-  }
-  ssize_t r = ::read(socket, out->data_end(), out->remain_space());
-  if (r < 0) {
+  int64_t dl = -1;
+  ssize_t r;
+  while (true) {
+    NODE_STAT(SYSCALLS, 1);
+    {
+      TRACE_SCOPE("read()", "syscall");
+      r = ::read(socket, out->data_end(), out->remain_space());
+    }
+    if (r >= 0)
+      break;
+    if (errno == EINTR)
+      continue;
     if (errno == EAGAIN) {
-      set_node_error(READ_TIMEOUT);
-    } else {
-      set_node_error_by_errno();
+      if (wait(true, arg, &dl))
+        continue;
+      return -1;
     }
+    set_node_error_by_errno();
     return -1;
   }
   if (r == 0) {
     set_node_error(REMOTE_CLOSED);
     return -1;
   }
+  // more data may be pending in socket
+  if ((uint32_t)r == out->remain_space())
+    NODE_STAT(BUFFER_FULL, 1);
   out->obtain(r);
 #ifdef LIZARD_DEBUG
   // printf("sock-node: read %d bytes: ", (int)r);
@@ -129,6 +216,10 @@ int32_t SocketNode::on_read(Buffer *out, Buffer *in, void* arg) {
   return 0;
 }
 
+int SocketNode::get_fd() const {
+  return socket;
+}
+
 void SocketNode::on_close() {
   if (socket >= 0) {
     KLOGD(TAG, "lizard: close socket %d", socket);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace rokid {
+namespace lizard {
+
+// bounded wait-free single-producer single-consumer ring.
+// 'head' and 'tail' are stored then the other index loaded with seq_cst,
+// so push() sees the ring was empty, or a pop() racing with it sees the
+// new element, never both miss: producer may signal consumer only when
+// push made ring non-empty without lost wakeup.
+template <typename T>
+class SPSCRing {
+public:
+  // 'size': rounded up to power of 2
+  SPSCRing(uint32_t size) {
+    uint32_t n = 1;
+    while (n < size)
+      n <<= 1;
+    slots.resize(n);
+    mask = n - 1;
+  }
+
+  // producer thread only
+  // '*was_empty': set true if ring was empty before pushed
+  // return: false if full
+  bool push(const T& v, bool* was_empty = nullptr) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) > mask)
+      return false;
+    slots[h & mask] = v;
+    head.store(h + 1, std::memory_order_seq_cst);
+    if (was_empty)
+      *was_empty = tail.load(std::memory_order_seq_cst) == h;
+    return true;
+  }
+
+  // consumer thread only
+  // return: false if empty
+  bool pop(T* v) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_seq_cst) == t)
+      return false;
+    *v = slots[t & mask];
+    tail.store(t + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  // consumer thread only
+  bool empty() const {
+    return head.load(std::memory_order_seq_cst)
+      == tail.load(std::memory_order_relaxed);
+  }
+
+  // producer thread only
+  bool full() const {
+    return head.load(std::memory_order_relaxed)
+      - tail.load(std::memory_order_seq_cst) > mask;
+  }
+
+  inline uint32_t capacity() const { return mask + 1; }
+
+private:
+  std::vector<T> slots;
+  uint64_t mask;
+  // indexes written by different threads kept in different cache lines
+  char pad0[64];
+  std::atomic<uint64_t> head{0};
+  char pad1[64];
+  std::atomic<uint64_t> tail{0};
+  char pad2[64];
+};
+
+} // namespace lizard
+} // namespace rokid
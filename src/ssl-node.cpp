@@ -5,6 +5,9 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include "ssl.h"
 #include "entropy.h"
 #include "ctr_drbg.h"
@@ -25,17 +28,26 @@ const char* SSLNode::error_messages[] = {
   "read buffer size insufficient",
   "remote socket closed",
   "ssl read timeout",
+  "ssl write timeout",
+  "ssl connect or handshake timeout",
 };
 
 SSLNode::~SSLNode() {
   on_close();
+  delete own_config;
 }
 
-static int my_net_recv(void* ctx, unsigned char* buf, size_t len) {
-  int fd = *(int*)ctx;
-  ssize_t ret = ::read(fd, buf, len);
+int SSLNode::bio_recv(void* ctx, unsigned char* buf, size_t len) {
+  SSLNode* node = reinterpret_cast<SSLNode*>(ctx);
+  ssize_t ret;
+  TRACE_SCOPE("read()", "syscall");
+  do {
+    NODE_STAT_OF(node, SYSCALLS, 1);
+    ret = ::read(node->socket, buf, len);
+  } while (ret < 0 && errno == EINTR);
   if (ret < 0) {
-    // if socket read timeout, errno will be EAGAIN
+    // socket is always non-blocking, EAGAIN means would block: WANT_READ,
+    // caller polls until readable or deadline
     if (errno == EAGAIN)
       return POLARSSL_ERR_NET_WANT_READ;
     return POLARSSL_ERR_NET_RECV_FAILED;
@@ -43,98 +55,351 @@ static int my_net_recv(void* ctx, unsigned char* buf, size_t len) {
   return ret;
 }
 
-class mbedtlsData {
+int SSLNode::bio_send(void* ctx, const unsigned char* buf, size_t len) {
+  SSLNode* node = reinterpret_cast<SSLNode*>(ctx);
+  NODE_STAT_OF(node, SYSCALLS, 1);
+  TRACE_SCOPE("write()", "syscall");
+  return net_send(&node->socket, buf, len);
+}
+
+class SSLConfigData {
 public:
   entropy_context entropy;
   ctr_drbg_context ctr_drbg;
-  ssl_context ssl;
+  // ctr_drbg is not thread safe, shared by connections of all threads
+  std::mutex rng_mutex;
   x509_crt cacert;
-  bool initialized = false;
+  bool has_ca = false;
+  int authmode = SSL_VERIFY_NONE;
+  // identify the config in session cache keys, never reused
+  uint64_t id = 0;
 
-  ~mbedtlsData() {
-    if (initialized) {
-      x509_crt_free(&cacert);
-      ssl_free(&ssl);
-      ctr_drbg_free(&ctr_drbg);
-      entropy_free(&entropy);
-    }
+  ~SSLConfigData() {
+    x509_crt_free(&cacert);
+    ctr_drbg_free(&ctr_drbg);
+    entropy_free(&entropy);
   }
 
-  bool init(const std::string& host, const char* ca_list) {
+  bool init(const char* ca_list, int32_t mode) {
     static const char* pers = "lizard_ssl_node";
+    static std::atomic<uint64_t> next_id{1};
 
-    memset(&ssl, 0, sizeof(ssl_context));
     entropy_init(&entropy);
+    x509_crt_init(&cacert);
+    memset(&ctr_drbg, 0, sizeof(ctr_drbg));
     if(ctr_drbg_init(&ctr_drbg, entropy_func, &entropy,
           (const unsigned char *) pers, strlen(pers)) != 0) {
-      entropy_free(&entropy);
-      return false;
-    }
-    if(ssl_init(&ssl) != 0) {
-      ctr_drbg_free(&ctr_drbg);
-      entropy_free(&entropy);
       return false;
     }
-    x509_crt_init(&cacert);
     if (ca_list) {
       if (x509_crt_parse(&cacert, (const unsigned char*)ca_list,
             strlen(ca_list)) < 0) {
-        x509_crt_free(&cacert);
-        ctr_drbg_free(&ctr_drbg);
-        entropy_free(&entropy);
         return false;
       }
-      ssl_set_authmode(&ssl, SSL_VERIFY_REQUIRED);
-      ssl_set_ca_chain(&ssl, &cacert, nullptr, host.c_str());
+      has_ca = true;
+      authmode = mode == SSLConfig::VERIFY_NONE ? SSL_VERIFY_NONE
+        : mode == SSLConfig::VERIFY_OPTIONAL ? SSL_VERIFY_OPTIONAL
+        : SSL_VERIFY_REQUIRED;
     }
-    ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
-    ssl_set_rng(&ssl, ctr_drbg_random, &ctr_drbg);
+    id = next_id++;
+    return true;
+  }
+};
+
+static int locked_random(void* p, unsigned char* out, size_t len) {
+  SSLConfigData* config = (SSLConfigData*)p;
+  std::lock_guard<std::mutex> locker(config->rng_mutex);
+  return ctr_drbg_random(&config->ctr_drbg, out, len);
+}
+
+// only the ssl context is per connection, ca chain and random generator
+// are referenced from SSLConfig
+class mbedtlsData {
+public:
+  ssl_context ssl;
+  bool initialized = false;
+
+  ~mbedtlsData() {
+    if (initialized)
+      ssl_free(&ssl);
+  }
+
+  bool init(const std::string& host, SSLConfigData* config) {
+    memset(&ssl, 0, sizeof(ssl_context));
+    if(ssl_init(&ssl) != 0)
+      return false;
     initialized = true;
+    ssl_set_authmode(&ssl, config->authmode);
+    if (config->has_ca)
+      ssl_set_ca_chain(&ssl, &config->cacert, nullptr, host.c_str());
+    ssl_set_endpoint(&ssl, SSL_IS_CLIENT);
+    ssl_set_rng(&ssl, locked_random, config);
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl_set_session_tickets(&ssl, SSL_SESSION_TICKETS_ENABLED);
+#endif
     return true;
   }
 };
 
+// ==================SSLConfig====================
+SSLConfig::~SSLConfig() {
+  delete reinterpret_cast<SSLConfigData*>(config_data);
+}
+
+bool SSLConfig::init(const char* ca_list, int32_t authmode) {
+  if (config_data)
+    return false;
+  SSLConfigData* data = new SSLConfigData();
+  if (!data->init(ca_list, authmode)) {
+    KLOGE(TAG, "ssl config init failed");
+    delete data;
+    return false;
+  }
+  config_data = data;
+  return true;
+}
+
+// config of SSLNodes without SSLConfig set and no ca list given by init
+// args. never destroyed, SSLNodes may be closed at exit.
+static SSLConfig* no_verify_config() {
+  static std::mutex mutex;
+  static SSLConfig* config = nullptr;
+
+  std::lock_guard<std::mutex> locker(mutex);
+  if (config == nullptr) {
+    SSLConfig* c = new SSLConfig();
+    if (!c->init(nullptr)) {
+      delete c;
+      return nullptr;
+    }
+    config = c;
+  }
+  return config;
+}
+
+// sessions of finished handshakes, keyed by server host:port and config,
+// presented
+// by next connection to the same server for an abbreviated handshake.
+// session ids and tickets are both kept by ssl_session.
+class SessionCache {
+public:
+  ~SessionCache() {
+    clear();
+  }
+
+  // present cached session of 'key' to 'ssl',
+  // master secret of the session copied to 'master'
+  // return: false  no session cached
+  bool load(const std::string& key, ssl_context* ssl, unsigned char* master) {
+    std::lock_guard<std::mutex> locker(mutex);
+    auto it = sessions.find(key);
+    if (it == sessions.end())
+      return false;
+    if (ssl_set_session(ssl, it->second) != 0)
+      return false;
+    memcpy(master, it->second->master, sizeof(it->second->master));
+    return true;
+  }
+
+  void save(const std::string& key, const ssl_context* ssl) {
+    ssl_session* session = new ssl_session;
+    ssl_session_init(session);
+    if (ssl_get_session(ssl, session) != 0) {
+      ssl_session_free(session);
+      delete session;
+      return;
+    }
+    std::lock_guard<std::mutex> locker(mutex);
+    auto it = sessions.find(key);
+    if (it != sessions.end()) {
+      free_session(it->second);
+      it->second = session;
+      return;
+    }
+    if (sessions.size() >= MAX_SESSIONS) {
+      free_session(sessions.begin()->second);
+      sessions.erase(sessions.begin());
+    }
+    sessions[key] = session;
+  }
+
+  void remove(const std::string& key) {
+    std::lock_guard<std::mutex> locker(mutex);
+    auto it = sessions.find(key);
+    if (it != sessions.end()) {
+      free_session(it->second);
+      sessions.erase(it);
+    }
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> locker(mutex);
+    for (auto it = sessions.begin(); it != sessions.end(); ++it) {
+      free_session(it->second);
+    }
+    sessions.clear();
+  }
+
+  static void free_session(ssl_session* session) {
+    ssl_session_free(session);
+    delete session;
+  }
+
+public:
+  static const size_t MAX_SESSIONS = 256;
+
+  std::atomic<bool> enabled{true};
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, ssl_session*> sessions;
+};
+
+static SessionCache session_cache;
+
+// a session verified by a config must not be resumed by connections
+// verifying with other ca list or auth mode, or not verifying at all
+static std::string session_key(const rokid::Uri& uri, SSLConfigData* config) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), ":%d/%llu", uri.port,
+      (unsigned long long)config->id);
+  return uri.host + buf;
+}
+
+void SSLNode::set_session_cache(bool enable) {
+  session_cache.enabled = enable;
+  if (!enable)
+    session_cache.clear();
+}
+
+void SSLNode::clear_session_cache() {
+  session_cache.clear();
+}
+
+uint64_t SSLNode::get_session_cache_hits() {
+  return session_cache.hits;
+}
+
+uint64_t SSLNode::get_session_cache_misses() {
+  return session_cache.misses;
+}
+
+SSLConfig* SSLNode::args_config(const char* ca_list) {
+  if (ca_list == nullptr)
+    return no_verify_config();
+  // ca list identified by address, parsed again only if changed
+  if (own_config && own_ca == ca_list)
+    return own_config;
+  on_close();
+  delete own_config;
+  own_ca = ca_list;
+  own_config = new SSLConfig();
+  if (!own_config->init(ca_list)) {
+    delete own_config;
+    own_config = nullptr;
+  }
+  return own_config;
+}
+
 bool SSLNode::on_init(const rokid::Uri& uri, void* arg) {
   intptr_t* sslargs = (intptr_t*)arg;
-  char* ca_list = (char*)sslargs[0];
+  char* ca_list = sslargs ? (char*)sslargs[0] : nullptr;
+  // one deadline for connect and handshake
+  int32_t timeout = sslargs ? (int32_t)sslargs[1] : 0;
+  int64_t dl = get_deadline(&timeout);
+  SSLConfig* cfg = config ? config : args_config(ca_list);
+  SSLConfigData* cfg_data = cfg
+    ? reinterpret_cast<SSLConfigData*>(cfg->config_data) : nullptr;
+  if (cfg_data == nullptr) {
+    set_node_error(SSL_INIT_FAILED);
+    return false;
+  }
   mbedtlsData *mbedtls_data = new mbedtlsData();
-  if (!mbedtls_data->init(uri.host, ca_list)) {
+  if (!mbedtls_data->init(uri.host, cfg_data)) {
     delete mbedtls_data;
     set_node_error(SSL_INIT_FAILED);
     return false;
   }
-  KLOGD(TAG, "net_connect %s:%d", uri.host.c_str(), uri.port);
-  int r;
-  if (r = net_connect(&socket, uri.host.c_str(), uri.port)) {
-    KLOGI(TAG, "net_connect failed: -0x%x", -r);
+  KLOGD(TAG, "connect %s:%d", uri.host.c_str(), uri.port);
+  socket = tcp_connect(uri.host.c_str(), uri.port, dl);
+  if (socket < 0) {
+    KLOGI(TAG, "connect failed: %s", strerror(errno));
     delete mbedtls_data;
-    set_node_error(SSL_INIT_FAILED);
+    set_node_error(errno == ETIMEDOUT ? SSL_HANDSHAKE_TIMEOUT
+        : SSL_INIT_FAILED);
     return false;
   }
-  KLOGD(TAG, "set socket write timeout %d", (int32_t)sslargs[1]);
-
-  set_rw_timeout(socket, sslargs[1], true);
-  ssl_set_bio(&mbedtls_data->ssl, my_net_recv, &socket, net_send, &socket);
-  do {
+  ssl_set_bio(&mbedtls_data->ssl, bio_recv, this, bio_send, this);
+  std::string cache_key;
+  unsigned char master[48];
+  bool offered = false;
+  if (session_cache.enabled) {
+    cache_key = session_key(uri, cfg_data);
+    offered = session_cache.load(cache_key, &mbedtls_data->ssl, master);
+  }
+  int r;
+  TRACE_SCOPE("ssl_handshake", "tls");
+  while (true) {
     r = ssl_handshake(&mbedtls_data->ssl);
-    // if (r == POLARSSL_ERR_NET_WANT_WRITE || r == POLARSSL_ERR_NET_WANT_READ)
-    //   continue;
-    if (r < 0) {
+    if (r == 0)
+      break;
+    if (r == POLARSSL_ERR_NET_WANT_READ || r == POLARSSL_ERR_NET_WANT_WRITE) {
+      r = wait_fd(socket, r == POLARSSL_ERR_NET_WANT_READ, dl);
+      if (r > 0)
+        continue;
+      KLOGI(TAG, "ssl handshake %s", r == 0 ? "timeout" : strerror(errno));
+      set_node_error(r == 0 ? SSL_HANDSHAKE_TIMEOUT : SSL_HANDSHAKE_FAILED);
+    } else {
       KLOGI(TAG, "ssl handshake failed: -0x%x", -r);
       set_node_error(SSL_HANDSHAKE_FAILED);
-      net_close(socket);
-      socket = -1;
-      delete mbedtls_data;
-      return false;
     }
-    break;
-  } while (true);
+    // session may be rejected by server, don't present it again
+    if (offered)
+      session_cache.remove(cache_key);
+    net_close(socket);
+    socket = -1;
+    delete mbedtls_data;
+    return false;
+  }
+  if (!cache_key.empty()) {
+    // master secret of a resumed session is not changed
+    ssl_session* session = mbedtls_data->ssl.session;
+    if (offered && session
+        && memcmp(session->master, master, sizeof(master)) == 0) {
+      ++session_cache.hits;
+    } else {
+      ++session_cache.misses;
+    }
+    // ticket may be renewed by server, always save the latest
+    session_cache.save(cache_key, &mbedtls_data->ssl);
+  }
   KLOGD(TAG, "ssl handshake success");
   ignore_sigpipe(socket);
   ssl_data = mbedtls_data;
   return true;
 }
 
+// wait socket ready when ssl want read/write in blocking mode
+// return: false  failed, node error set
+bool SSLNode::wait(bool rd, void* arg, int64_t* dl, int32_t timeout_code) {
+  if (nonblock) {
+    set_would_block();
+    return false;
+  }
+  if (*dl < 0)
+    *dl = get_deadline(arg);
+  NODE_STAT(SYSCALLS, 1);
+  TRACE_SCOPE("poll()", "syscall");
+  int32_t r = wait_fd(socket, rd, *dl);
+  if (r > 0)
+    return true;
+  set_node_error(r == 0 ? timeout_code
+      : (rd ? SSL_READ_FAILED : SSL_WRITE_FAILED));
+  return false;
+}
+
 void SSLNode::set_node_error(int32_t code) {
   err_info.node = this;
   err_info.code = code;
@@ -149,17 +414,21 @@ int32_t SSLNode::on_write(Buffer *in, Buffer *out, void* arg) {
   uint32_t sz = in->size();
   uint8_t *db = reinterpret_cast<uint8_t *>(in->data_begin());
 #endif
-  if (arg) {
-    set_rw_timeout(socket, reinterpret_cast<int32_t *>(arg)[0], false);
-  } else {
-    set_rw_timeout(socket, -1, false);
-  }
+  int64_t dl = -1;
   while (true) {
+    // if ssl_write returned WANT_WRITE, must be called again with same data
+    // to send the pending record, 'in' is not consumed until then
     r = ssl_write(&reinterpret_cast<mbedtlsData*>(ssl_data)->ssl, (unsigned char*)in->data_begin(), in->size());
     if (r >= 0) {
+      if ((uint32_t)r < in->size())
+        NODE_STAT(PARTIAL_WRITES, 1);
       in->consume(r);
       if (in->empty())
         break;
+    } else if (r == POLARSSL_ERR_NET_WANT_WRITE
+        || r == POLARSSL_ERR_NET_WANT_READ) {
+      if (!wait(r == POLARSSL_ERR_NET_WANT_READ, arg, &dl, SSL_WRITE_TIMEOUT))
+        return -1;
     } else {
       KLOGI(TAG, "ssl write failed: -0x%x", -r);
       set_node_error(SSL_WRITE_FAILED);
@@ -182,19 +451,16 @@ int32_t SSLNode::on_read(Buffer *out, Buffer *in, void* arg) {
     set_node_error(INSUFF_READ_BUFFER);
     return -1;
   }
-  if (arg) {
-    set_rw_timeout(socket, reinterpret_cast<int32_t *>(arg)[0], true);
-  } else {
-    set_rw_timeout(socket, -1, true);
-  }
-
+  int64_t dl = -1;
   int ret;
   do {
     ret = ssl_read(&reinterpret_cast<mbedtlsData*>(ssl_data)->ssl, (unsigned char*)out->data_end(), out->remain_space());
 
-    if (ret == POLARSSL_ERR_NET_WANT_READ) {
-      set_node_error(SSL_READ_TIMEOUT);
-      return -1;
+    if (ret == POLARSSL_ERR_NET_WANT_READ
+        || ret == POLARSSL_ERR_NET_WANT_WRITE) {
+      if (!wait(ret == POLARSSL_ERR_NET_WANT_READ, arg, &dl, SSL_READ_TIMEOUT))
+        return -1;
+      continue;
     }
 
     if(ret < 0) {
@@ -207,6 +473,9 @@ int32_t SSLNode::on_read(Buffer *out, Buffer *in, void* arg) {
       return -1;
     }
 
+    // more records may be pending
+    if ((uint32_t)ret == out->remain_space())
+      NODE_STAT(BUFFER_FULL, 1);
     out->obtain(ret);
 #ifdef LIZARD_DEBUG
     // printf("ssl-node: read %d bytes: ", ret);
@@ -218,6 +487,10 @@ int32_t SSLNode::on_read(Buffer *out, Buffer *in, void* arg) {
   return 0;
 }
 
+int SSLNode::get_fd() const {
+  return socket;
+}
+
 void SSLNode::on_close() {
   if (socket >= 0) {
     net_close(socket);
@@ -0,0 +1,174 @@
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace rokid {
+namespace lizard {
+
+class TraceEvent {
+public:
+  const char* name;
+  const char* cat;
+  int64_t begin;
+  int64_t end;
+};
+
+// events of one thread, written only by the thread.
+// reader copies events then checks 'head' again, events the writer may
+// have overwritten meanwhile are dropped.
+class TraceRing {
+public:
+  TraceEvent events[Trace::RING_SIZE];
+  // count of events ever recorded
+  std::atomic<uint64_t> head{0};
+  // events before this index dropped by clear
+  std::atomic<uint64_t> start{0};
+  int32_t tid = 0;
+};
+
+// rings of all threads, kept after thread exit until exported and cleared
+class TraceRegistry {
+public:
+  static TraceRegistry* instance() {
+    // never destroyed, threads may exit after static destruction
+    static TraceRegistry* registry = new TraceRegistry();
+    return registry;
+  }
+
+  std::mutex mutex;
+  std::vector<shared_ptr<TraceRing> > rings;
+};
+
+class ThreadTrace {
+public:
+  TraceRing* get() {
+    if (ring == nullptr) {
+      ring = make_shared<TraceRing>();
+#ifdef __linux__
+      ring->tid = (int32_t)syscall(SYS_gettid);
+#else
+      static std::atomic<int32_t> next_tid{1};
+      ring->tid = next_tid++;
+#endif
+      TraceRegistry* registry = TraceRegistry::instance();
+      lock_guard<mutex> locker(registry->mutex);
+      registry->rings.push_back(ring);
+    }
+    return ring.get();
+  }
+
+private:
+  shared_ptr<TraceRing> ring;
+};
+
+static thread_local ThreadTrace thread_trace;
+
+std::atomic<bool> Trace::on{false};
+
+void Trace::enable(bool e) {
+  on.store(e, std::memory_order_relaxed);
+}
+
+int64_t Trace::now_ns() {
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::record(const char* name, const char* cat, int64_t begin,
+    int64_t end) {
+  TraceRing* ring = thread_trace.get();
+  uint64_t h = ring->head.load(std::memory_order_relaxed);
+  TraceEvent& ev = ring->events[h & (RING_SIZE - 1)];
+  ev.name = name;
+  ev.cat = cat;
+  ev.begin = begin;
+  ev.end = end;
+  ring->head.store(h + 1, std::memory_order_release);
+}
+
+void Trace::clear() {
+  TraceRegistry* registry = TraceRegistry::instance();
+  lock_guard<mutex> locker(registry->mutex);
+  auto it = registry->rings.begin();
+  while (it != registry->rings.end()) {
+    // thread exited, ring only owned by registry
+    if (it->use_count() == 1) {
+      it = registry->rings.erase(it);
+      continue;
+    }
+    (*it)->start.store((*it)->head.load(std::memory_order_acquire),
+        std::memory_order_relaxed);
+    ++it;
+  }
+}
+
+static void copy_events(TraceRing* ring, vector<TraceEvent>& out) {
+  uint64_t h = ring->head.load(std::memory_order_acquire);
+  uint64_t b = ring->start.load(std::memory_order_relaxed);
+  uint64_t i;
+  size_t first = out.size();
+
+  if (h - b > Trace::RING_SIZE)
+    b = h - Trace::RING_SIZE;
+  for (i = b; i < h; ++i)
+    out.push_back(ring->events[i & (Trace::RING_SIZE - 1)]);
+  // events overwritten while copying, including the one being recorded
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t h2 = ring->head.load(std::memory_order_relaxed) + 1;
+  if (h2 - b > Trace::RING_SIZE) {
+    uint64_t lost = h2 - b - Trace::RING_SIZE;
+    if (lost > h - b)
+      lost = h - b;
+    out.erase(out.begin() + first, out.begin() + first + lost);
+  }
+}
+
+bool Trace::write_chrome_trace(FILE* fp) {
+  vector<shared_ptr<TraceRing> > rings;
+  vector<TraceEvent> events;
+  bool first = true;
+  int pid = getpid();
+
+  {
+    TraceRegistry* registry = TraceRegistry::instance();
+    lock_guard<mutex> locker(registry->mutex);
+    rings = registry->rings;
+  }
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (auto& ring : rings) {
+    events.clear();
+    copy_events(ring.get(), events);
+    for (auto& ev : events) {
+      // complete event, microseconds
+      fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+          "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+          first ? "" : ",", ev.name, ev.cat, ev.begin / 1000.0,
+          (ev.end - ev.begin) / 1000.0, pid, ring->tid);
+      first = false;
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  return !ferror(fp);
+}
+
+bool Trace::write_chrome_trace(const char* path) {
+  FILE* fp = fopen(path, "w");
+  if (fp == nullptr)
+    return false;
+  bool r = write_chrome_trace(fp);
+  if (fclose(fp) != 0)
+    r = false;
+  return r;
+}
+
+} // namespace lizard
+} // namespace rokid
@@ -0,0 +1,128 @@
+#ifdef HAS_ZLIB
+
+#include <string.h>
+#include "ws-deflate.h"
+#include "common.h"
+
+// grow output buffer when free space less than this
+#define MIN_DEFLATE_SPACE 64
+
+namespace rokid {
+namespace lizard {
+
+static const uint8_t deflate_tail[4] = { 0x00, 0x00, 0xff, 0xff };
+
+WSDeflate::~WSDeflate() {
+  if (dstream_inited)
+    deflateEnd(&dstream);
+  if (istream_inited)
+    inflateEnd(&istream);
+}
+
+bool WSDeflate::compress(const struct iovec* iov, uint32_t iovcnt, bool fin,
+    Buffer* out, uint32_t* size) {
+  uint32_t i, space;
+  int r;
+
+  if (!dstream_inited) {
+    memset(&dstream, 0, sizeof(dstream));
+    // negative window bits: raw deflate without zlib header
+    if (deflateInit2(&dstream, options.level, Z_DEFLATED,
+          -options.client_max_window_bits, options.mem_level,
+          Z_DEFAULT_STRATEGY) != Z_OK) {
+      KLOGE(TAG, "deflateInit2 failed");
+      return false;
+    }
+    dstream_inited = true;
+  }
+  out->clear();
+  for (i = 0; i < iovcnt || i == 0; ++i) {
+    dstream.next_in = iovcnt ? (Bytef*)iov[i].iov_base : Z_NULL;
+    dstream.avail_in = iovcnt ? iov[i].iov_len : 0;
+    // sync flush every frame, so receiver decompress it without waiting
+    // next frame
+    int flush = i + 1 >= iovcnt ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    do {
+      if (out->remain_space() < MIN_DEFLATE_SPACE) {
+        uint32_t cap = out->total_space();
+        if (!out->reserve(cap < 4096 ? 4096 : cap * 2))
+          return false;
+      }
+      space = out->remain_space();
+      dstream.next_out = (Bytef*)out->data_end();
+      dstream.avail_out = space;
+      r = deflate(&dstream, flush);
+      out->obtain(space - dstream.avail_out);
+      if (r == Z_STREAM_ERROR)
+        return false;
+    } while (dstream.avail_in || dstream.avail_out == 0);
+  }
+  *size = out->size();
+  if (fin) {
+    if (*size >= sizeof(deflate_tail) && memcmp((uint8_t*)out->data_end()
+          - sizeof(deflate_tail), deflate_tail, sizeof(deflate_tail)) == 0)
+      *size -= sizeof(deflate_tail);
+    if (options.client_no_context_takeover)
+      deflateReset(&dstream);
+  }
+  return true;
+}
+
+bool WSDeflate::decompress(const void* in, uint32_t in_size, bool last,
+    void* out, uint32_t out_size, uint32_t* consumed, uint32_t* produced,
+    bool* done) {
+  int r;
+
+  if (!istream_inited) {
+    memset(&istream, 0, sizeof(istream));
+    if (inflateInit2(&istream, -options.server_max_window_bits) != Z_OK) {
+      KLOGE(TAG, "inflateInit2 failed");
+      return false;
+    }
+    istream_inited = true;
+  }
+  istream.next_out = (Bytef*)out;
+  istream.avail_out = out_size;
+  *consumed = in_size;
+  if (!istream_end) {
+    istream.next_in = (Bytef*)in;
+    istream.avail_in = in_size;
+    r = inflate(&istream, Z_SYNC_FLUSH);
+    if (r == Z_STREAM_END)
+      istream_end = true;
+    else if (r != Z_OK && r != Z_BUF_ERROR)
+      return false;
+    *consumed = in_size - istream.avail_in;
+    // data after final block ignored
+    if (istream_end)
+      *consumed = in_size;
+  }
+  // end of message, give the tail removed by sender
+  if (last && *consumed == in_size && istream.avail_out && !istream_end
+      && tail_fed < sizeof(deflate_tail)) {
+    istream.next_in = (Bytef*)deflate_tail + tail_fed;
+    istream.avail_in = sizeof(deflate_tail) - tail_fed;
+    r = inflate(&istream, Z_SYNC_FLUSH);
+    if (r == Z_STREAM_END)
+      istream_end = true;
+    else if (r != Z_OK && r != Z_BUF_ERROR)
+      return false;
+    tail_fed = sizeof(deflate_tail) - istream.avail_in;
+  }
+  *produced = out_size - istream.avail_out;
+  // free output space left, no output pending in inflate stream
+  *done = last && *consumed == in_size && istream.avail_out
+    && (istream_end || tail_fed == sizeof(deflate_tail));
+  if (*done) {
+    tail_fed = 0;
+    if (istream_end || options.server_no_context_takeover)
+      inflateReset(&istream);
+    istream_end = false;
+  }
+  return true;
+}
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // HAS_ZLIB
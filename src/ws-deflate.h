@@ -0,0 +1,76 @@
+#pragma once
+
+#include <sys/uio.h>
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+#include "ws-node.h"
+
+namespace rokid {
+namespace lizard {
+
+#ifdef HAS_ZLIB
+
+// zlib streams of a websocket connection negotiated permessage-deflate.
+// streams are created at first use and reused by all messages, reset
+// after every message if no context takeover.
+class WSDeflate {
+public:
+  // 'opts': negotiated options
+  WSDeflate(const WSDeflateOptions& opts) : options(opts) {}
+
+  ~WSDeflate();
+
+  WSDeflate(const WSDeflate&) = delete;
+
+  WSDeflate& operator=(const WSDeflate&) = delete;
+
+  // compress payload of a frame to 'out', 'out' cleared before and grown
+  // if not large enough.
+  // 'fin': last frame of message, trailing 00 00 ff ff excluded from
+  //        '*size'
+  // return: false  compress failed or 'out' could not grow
+  bool compress(const struct iovec* iov, uint32_t iovcnt, bool fin,
+      Buffer* out, uint32_t* size);
+
+  // decompress a piece of payload of a compressed message.
+  // 'last': 'in' is end of message
+  // '*consumed': bytes of 'in' consumed
+  // '*produced': bytes written to 'out'
+  // '*done': message fully decompressed, set only if 'last'
+  // return: false  data invalid
+  bool decompress(const void* in, uint32_t in_size, bool last, void* out,
+      uint32_t out_size, uint32_t* consumed, uint32_t* produced, bool* done);
+
+private:
+  WSDeflateOptions options;
+  z_stream dstream;
+  z_stream istream;
+  bool dstream_inited = false;
+  bool istream_inited = false;
+  // bytes of 00 00 ff ff appended to current message given to inflate
+  uint32_t tail_fed = 0;
+  // peer finished deflate stream with a final block
+  bool istream_end = false;
+};
+
+#else // HAS_ZLIB
+
+// never negotiated without zlib
+class WSDeflate {
+public:
+  bool compress(const struct iovec* iov, uint32_t iovcnt, bool fin,
+      Buffer* out, uint32_t* size) {
+    return false;
+  }
+
+  bool decompress(const void* in, uint32_t in_size, bool last, void* out,
+      uint32_t out_size, uint32_t* consumed, uint32_t* produced, bool* done) {
+    return false;
+  }
+};
+
+#endif // HAS_ZLIB
+
+} // namespace lizard
+} // namespace rokid
@@ -18,6 +18,8 @@ int32_t is_control_opcode(uint8_t op) {
 
 int32_t lizard_ws_frame_create(uint16_t op, uint8_t fin, uint8_t mask,
     const char* mask_key, uint64_t payload_len, void* out, uint32_t out_size) {
+  uint8_t rsv = op & WSFRAME_RSV1 ? 0x40 : 0;
+  op &= ~WSFRAME_RSV1;
   if (!check_opcode(op))
     return WSFRAME_ERROR_INVALID_OPCODE;
   if (out == nullptr && out_size)
@@ -42,7 +44,7 @@ int32_t lizard_ws_frame_create(uint16_t op, uint8_t fin, uint8_t mask,
   if (out_size < header_len)
     return header_len;
   uint8_t* p = reinterpret_cast<uint8_t*>(out);
-  p[0] = (fin ? 0x80 : 0) | op;
+  p[0] = (fin ? 0x80 : 0) | rsv | op;
   switch (plen_type) {
     case 0:
       p[1] = (has_mask ? 0x80 : 0) | (int32_t)payload_len;
@@ -71,16 +73,6 @@ int32_t lizard_ws_frame_create(uint16_t op, uint8_t fin, uint8_t mask,
   return header_len;
 }
 
-void lizard_ws_frame_mask_payload(const char* mask_key, const void* in, uint32_t in_size, void* out) {
-  const char* inp = reinterpret_cast<const char*>(in);
-  char* outp = reinterpret_cast<char*>(out);
-  uint32_t i;
-
-  for (i = 0; i < in_size; ++i) {
-    outp[i] = inp[i] ^ mask_key[i % 4];
-  }
-}
-
 int32_t lizard_ws_frame_parse_header(uint8_t* data, uint32_t size, WSFrameHeader* result) {
   if (size == 0)
     return 0;
@@ -113,6 +105,7 @@ int32_t lizard_ws_frame_parse_header(uint8_t* data, uint32_t size, WSFrameHeader
     hsz = 10;
   }
   result->fin = (data[0] & 0x80) ? 1 : 0;
+  result->rsv1 = (data[0] & 0x40) ? 1 : 0;
   result->mask = (data[1] & 0x80) ? 1 : 0;
   result->opcode = opcode;
   return hsz;
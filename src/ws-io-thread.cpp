@@ -0,0 +1,265 @@
+#ifdef __linux__
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ws-io-thread.h"
+#include "spsc-ring.h"
+#include "common.h"
+
+namespace rokid {
+namespace lizard {
+
+class WSIoMessage {
+public:
+  WSMessagePool* pool = nullptr;
+  PoolBuffer* buf = nullptr;
+  uint32_t flags = 0;
+};
+
+WSIoThread::WSIoThread() {
+  error.node = nullptr;
+  error.code = 0;
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0 || wake_fd < 0)
+    KLOGE(TAG, "io thread: eventfd failed: %s", strerror(errno));
+}
+
+WSIoThread::~WSIoThread() {
+  stop();
+  if (ring) {
+    WSIoMessage m;
+    while (ring->pop(&m))
+      m.pool->put(m.buf);
+    delete ring;
+  }
+  if (event_fd >= 0)
+    ::close(event_fd);
+  if (wake_fd >= 0)
+    ::close(wake_fd);
+}
+
+bool WSIoThread::start(WSNode* node, uint32_t ring_size,
+    uint32_t send_queue_limit) {
+  if (thread.joinable() || node == nullptr || event_fd < 0 || wake_fd < 0)
+    return false;
+  // send queue of a WSNode enabled only once, kept for restart
+  if (node != queue_node) {
+    if (!node->enable_send_queue(send_queue_limit, on_send_queue, this)) {
+      KLOGW(TAG, "io thread: send queue of node already enabled");
+      return false;
+    }
+    queue_node = node;
+  }
+  if (!node->set_nonblock(true))
+    return false;
+  if (ring && ring->capacity() < ring_size) {
+    // messages left by last run are dropped
+    WSIoMessage m;
+    while (ring->pop(&m))
+      m.pool->put(m.buf);
+    delete ring;
+    ring = nullptr;
+  }
+  if (ring == nullptr)
+    ring = new SPSCRing<WSIoMessage>(ring_size);
+  ws = node;
+  error.node = nullptr;
+  error.code = 0;
+  error.desc = "";
+  pong_size = -1;
+  stopping.store(false, std::memory_order_relaxed);
+  reader_blocked.store(false, std::memory_order_relaxed);
+  running.store(true, std::memory_order_release);
+  thread = std::thread([this]() { run(); });
+  return true;
+}
+
+void WSIoThread::stop() {
+  if (!thread.joinable())
+    return;
+  stopping.store(true, std::memory_order_release);
+  signal(wake_fd);
+  thread.join();
+  ws->set_nonblock(false);
+}
+
+bool WSIoThread::pop(WSMessage* msg) {
+  WSIoMessage m;
+  uint64_t v;
+
+  msg->release();
+  if (ring == nullptr)
+    return false;
+  if (!ring->pop(&m)) {
+    // clear event fd, then check again for message pushed meanwhile,
+    // its push signals event fd again
+    if (read(event_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+      KLOGW(TAG, "io thread: read eventfd failed: %s", strerror(errno));
+    if (!ring->pop(&m))
+      return false;
+  }
+  msg->pool = m.pool;
+  msg->buf = m.buf;
+  msg->flags = m.flags;
+  // io thread stopped reading by full ring, seq_cst ordered with tail
+  // stored by ring pop
+  if (reader_blocked.load() && reader_blocked.exchange(false))
+    signal(wake_fd);
+  return true;
+}
+
+bool WSIoThread::wait(int32_t timeout) {
+  int64_t dl = deadline_after(timeout);
+  struct pollfd pfd;
+  int32_t tm = -1;
+  uint64_t v;
+
+  if (ring == nullptr)
+    return false;
+  pfd.fd = event_fd;
+  pfd.events = POLLIN;
+  while (true) {
+    if (!ring->empty())
+      return true;
+    if (!is_running())
+      return !ring->empty();
+    if (dl) {
+      int64_t remain = dl - steady_now_ms();
+      if (remain <= 0)
+        return false;
+      tm = remain;
+    } else if (timeout == 0) {
+      return false;
+    }
+    pfd.revents = 0;
+    if (poll(&pfd, 1, tm) < 0 && errno != EINTR)
+      return false;
+    // signal of a message already popped, clear and check ring again
+    if ((pfd.revents & POLLIN) && read(event_fd, &v, sizeof(v)) < 0
+        && errno != EAGAIN)
+      return false;
+  }
+}
+
+bool WSIoThread::send(const void* payload, uint32_t size, uint32_t flags) {
+  if (ws == nullptr)
+    return false;
+  return ws->enqueue_frame(payload, size, flags);
+}
+
+void WSIoThread::on_send_queue(WSNode* node, uint32_t event, void* arg) {
+  if (event == WSNode::SEND_QUEUE_READY)
+    reinterpret_cast<WSIoThread*>(arg)->signal(
+        reinterpret_cast<WSIoThread*>(arg)->wake_fd);
+}
+
+void WSIoThread::signal(int fd) {
+  uint64_t v = 1;
+  if (write(fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+    KLOGW(TAG, "io thread: write eventfd failed: %s", strerror(errno));
+}
+
+void WSIoThread::fail() {
+  const NodeError* err = ws->get_error();
+  error.node = err->node;
+  error.code = err->code;
+  error.desc = err->desc;
+  KLOGI(TAG, "io thread: stopped by error %d: %s", err->code, err->desc);
+}
+
+// read messages until socket would block or ring full
+bool WSIoThread::read_messages(WSMessage* msg) {
+  WSIoMessage m;
+  bool was_empty = false;
+
+  while (!ring->full()) {
+    if (!ws->read_message(msg)) {
+      if (ws->would_block())
+        return true;
+      fail();
+      return false;
+    }
+    if (msg->opcode() == OPCODE_PING) {
+      // answer latest ping only
+      pong_size = msg->size();
+      if (pong_size)
+        memcpy(pong_payload, msg->data(), pong_size);
+      continue;
+    }
+    m.pool = msg->pool;
+    m.buf = msg->buf;
+    m.flags = msg->flags;
+    msg->pool = nullptr;
+    msg->buf = nullptr;
+    msg->flags = 0;
+    ring->push(m, &was_empty);
+    if (was_empty)
+      signal(event_fd);
+  }
+  reader_blocked.store(true);
+  // consumer may have popped before flag set and not signaled
+  if (!ring->full() && reader_blocked.exchange(false))
+    return read_messages(msg);
+  return true;
+}
+
+void WSIoThread::run() {
+  struct pollfd pfds[2];
+  WSMessage msg;
+  bool want_write = false;
+  uint64_t v;
+
+  pfds[0].fd = ws->get_fd();
+  pfds[1].fd = wake_fd;
+  pfds[1].events = POLLIN;
+  while (!stopping.load(std::memory_order_acquire)) {
+    if (pong_size >= 0) {
+      if (ws->enqueue_frame(pong_payload, pong_size,
+            OPCODE_PONG | WSFRAME_FIN)) {
+        pong_size = -1;
+      } else if (ws->get_error()->code != WSNode::SEND_QUEUE_FULL) {
+        fail();
+        break;
+      }
+    }
+    if (!ws->drain_send_queue()) {
+      if (!ws->would_block()) {
+        fail();
+        break;
+      }
+      want_write = true;
+    } else {
+      want_write = false;
+    }
+    if (!read_messages(&msg))
+      break;
+    // pong just read from socket sent before waiting
+    if (pong_size >= 0 && !want_write)
+      continue;
+    pfds[0].events = (ring->full() ? 0 : POLLIN)
+      | (want_write ? POLLOUT : 0);
+    pfds[0].revents = pfds[1].revents = 0;
+    if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+      error.node = ws;
+      error.code = errno;
+      error.desc = strerror(errno);
+      break;
+    }
+    if (pfds[1].revents & POLLIN) {
+      if (read(wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        KLOGW(TAG, "io thread: read eventfd failed: %s", strerror(errno));
+    }
+  }
+  running.store(false, std::memory_order_release);
+  // consumer waiting on event fd learns thread ended
+  signal(event_fd);
+}
+
+} // namespace lizard
+} // namespace rokid
+
+#endif // __linux__
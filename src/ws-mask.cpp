@@ -0,0 +1,301 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include "ws-frame.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LIZARD_MASK_X86
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LIZARD_MASK_NEON
+#include <arm_neon.h>
+#endif
+
+// mask kernel: xor 'n' bytes of 'in' with 'key', 'key' is the 4 bytes mask
+// key already rotated to the mask offset of in[0]
+typedef void (*MaskKernel)(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out);
+
+static inline void rotate_key(const uint8_t* key, uint32_t offset,
+    uint8_t* rkey) {
+  rkey[0] = key[offset & 3];
+  rkey[1] = key[(offset + 1) & 3];
+  rkey[2] = key[(offset + 2) & 3];
+  rkey[3] = key[(offset + 3) & 3];
+}
+
+// mask bytes one by one until 'out' aligned to 'align',
+// return count of bytes masked, 'key' rotated for the rest bytes
+static inline size_t mask_head(uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out, uintptr_t align) {
+  size_t h = (align - ((uintptr_t)out & (align - 1))) & (align - 1);
+  size_t i;
+  uint8_t k[4];
+
+  if (h > n)
+    h = n;
+  for (i = 0; i < h; ++i) {
+    out[i] = in[i] ^ key[i & 3];
+  }
+  if (h & 3) {
+    memcpy(k, key, 4);
+    rotate_key(k, h, key);
+  }
+  return h;
+}
+
+static inline void mask_tail(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    out[i] = in[i] ^ key[i & 3];
+  }
+}
+
+static void mask_scalar(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  mask_tail(key, in, n, out);
+}
+
+static void mask_word(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  uint8_t k[8];
+  uint64_t k64, v;
+  size_t i;
+
+  if (n < 16) {
+    mask_tail(key, in, n, out);
+    return;
+  }
+  memcpy(k, key, 4);
+  i = mask_head(k, in, n, out, sizeof(uint64_t));
+  memcpy(k + 4, k, 4);
+  memcpy(&k64, k, sizeof(k64));
+  for (; i + 32 <= n; i += 32) {
+    memcpy(&v, in + i, 8);
+    v ^= k64;
+    memcpy(out + i, &v, 8);
+    memcpy(&v, in + i + 8, 8);
+    v ^= k64;
+    memcpy(out + i + 8, &v, 8);
+    memcpy(&v, in + i + 16, 8);
+    v ^= k64;
+    memcpy(out + i + 16, &v, 8);
+    memcpy(&v, in + i + 24, 8);
+    v ^= k64;
+    memcpy(out + i + 24, &v, 8);
+  }
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&v, in + i, 8);
+    v ^= k64;
+    memcpy(out + i, &v, 8);
+  }
+  mask_tail(k, in + i, n - i, out + i);
+}
+
+#ifdef LIZARD_MASK_X86
+__attribute__((target("sse2")))
+static void mask_sse2(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  uint8_t k[4];
+  int32_t k32;
+  size_t i;
+
+  if (n < 64) {
+    mask_word(key, in, n, out);
+    return;
+  }
+  memcpy(k, key, 4);
+  i = mask_head(k, in, n, out, 16);
+  memcpy(&k32, k, 4);
+  __m128i vk = _mm_set1_epi32(k32);
+  for (; i + 64 <= n; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(in + i + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*)(in + i + 48));
+    _mm_store_si128((__m128i*)(out + i), _mm_xor_si128(a, vk));
+    _mm_store_si128((__m128i*)(out + i + 16), _mm_xor_si128(b, vk));
+    _mm_store_si128((__m128i*)(out + i + 32), _mm_xor_si128(c, vk));
+    _mm_store_si128((__m128i*)(out + i + 48), _mm_xor_si128(d, vk));
+  }
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+    _mm_store_si128((__m128i*)(out + i), _mm_xor_si128(a, vk));
+  }
+  mask_tail(k, in + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void mask_avx2(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  uint8_t k[4];
+  int32_t k32;
+  size_t i;
+
+  if (n < 256) {
+    mask_sse2(key, in, n, out);
+    return;
+  }
+  memcpy(k, key, 4);
+  i = mask_head(k, in, n, out, 32);
+  memcpy(&k32, k, 4);
+  __m256i vk = _mm256_set1_epi32(k32);
+  for (; i + 128 <= n; i += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(in + i + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(in + i + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(in + i + 96));
+    _mm256_store_si256((__m256i*)(out + i), _mm256_xor_si256(a, vk));
+    _mm256_store_si256((__m256i*)(out + i + 32), _mm256_xor_si256(b, vk));
+    _mm256_store_si256((__m256i*)(out + i + 64), _mm256_xor_si256(c, vk));
+    _mm256_store_si256((__m256i*)(out + i + 96), _mm256_xor_si256(d, vk));
+  }
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+    _mm256_store_si256((__m256i*)(out + i), _mm256_xor_si256(a, vk));
+  }
+  mask_tail(k, in + i, n - i, out + i);
+}
+#endif // LIZARD_MASK_X86
+
+#ifdef LIZARD_MASK_NEON
+static void mask_neon(const uint8_t* key, const uint8_t* in, size_t n,
+    uint8_t* out) {
+  uint8_t k[4];
+  uint32_t k32;
+  size_t i;
+
+  if (n < 64) {
+    mask_word(key, in, n, out);
+    return;
+  }
+  memcpy(k, key, 4);
+  i = mask_head(k, in, n, out, 16);
+  memcpy(&k32, k, 4);
+  uint8x16_t vk = vreinterpretq_u8_u32(vdupq_n_u32(k32));
+  for (; i + 64 <= n; i += 64) {
+    uint8x16_t a = vld1q_u8(in + i);
+    uint8x16_t b = vld1q_u8(in + i + 16);
+    uint8x16_t c = vld1q_u8(in + i + 32);
+    uint8x16_t d = vld1q_u8(in + i + 48);
+    vst1q_u8(out + i, veorq_u8(a, vk));
+    vst1q_u8(out + i + 16, veorq_u8(b, vk));
+    vst1q_u8(out + i + 32, veorq_u8(c, vk));
+    vst1q_u8(out + i + 48, veorq_u8(d, vk));
+  }
+  for (; i + 16 <= n; i += 16) {
+    vst1q_u8(out + i, veorq_u8(vld1q_u8(in + i), vk));
+  }
+  mask_tail(k, in + i, n - i, out + i);
+}
+#endif // LIZARD_MASK_NEON
+
+static const char* kernel_names[WSMASK_KERNEL_COUNT] = {
+  "auto",
+  "scalar",
+  "word",
+  "sse2",
+  "avx2",
+  "neon",
+};
+
+static MaskKernel kernel_func(int32_t kernel) {
+  switch (kernel) {
+    case WSMASK_KERNEL_SCALAR:
+      return mask_scalar;
+    case WSMASK_KERNEL_WORD:
+      return mask_word;
+#ifdef LIZARD_MASK_X86
+    case WSMASK_KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2") ? mask_sse2 : nullptr;
+    case WSMASK_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2") ? mask_avx2 : nullptr;
+#endif
+#ifdef LIZARD_MASK_NEON
+    case WSMASK_KERNEL_NEON:
+      return mask_neon;
+#endif
+  }
+  return nullptr;
+}
+
+static int32_t best_kernel() {
+  static const int32_t prefer[] = {
+    WSMASK_KERNEL_AVX2,
+    WSMASK_KERNEL_NEON,
+    WSMASK_KERNEL_SSE2,
+  };
+  uint32_t i;
+
+  for (i = 0; i < sizeof(prefer) / sizeof(prefer[0]); ++i) {
+    if (kernel_func(prefer[i]))
+      return prefer[i];
+  }
+  return WSMASK_KERNEL_WORD;
+}
+
+static std::atomic<int32_t> current_kernel{WSMASK_KERNEL_AUTO};
+static std::atomic<MaskKernel> current_func{nullptr};
+
+static MaskKernel get_kernel_func() {
+  MaskKernel f = current_func.load(std::memory_order_relaxed);
+  if (f == nullptr) {
+    int32_t k = best_kernel();
+    f = kernel_func(k);
+    current_kernel.store(k, std::memory_order_relaxed);
+    current_func.store(f, std::memory_order_relaxed);
+  }
+  return f;
+}
+
+int32_t lizard_ws_mask_set_kernel(int32_t kernel) {
+  if (kernel == WSMASK_KERNEL_AUTO)
+    kernel = best_kernel();
+  MaskKernel f = kernel_func(kernel);
+  if (f == nullptr)
+    return -1;
+  current_kernel.store(kernel, std::memory_order_relaxed);
+  current_func.store(f, std::memory_order_relaxed);
+  return 0;
+}
+
+int32_t lizard_ws_mask_get_kernel() {
+  get_kernel_func();
+  return current_kernel.load(std::memory_order_relaxed);
+}
+
+int32_t lizard_ws_mask_kernel_supported(int32_t kernel) {
+  if (kernel == WSMASK_KERNEL_AUTO)
+    return 1;
+  return kernel_func(kernel) ? 1 : 0;
+}
+
+const char* lizard_ws_mask_kernel_name(int32_t kernel) {
+  if (kernel < 0 || kernel >= WSMASK_KERNEL_COUNT)
+    return "unknown";
+  return kernel_names[kernel];
+}
+
+void lizard_ws_frame_mask_payload(const char* mask_key, const void* in, uint32_t in_size, void* out) {
+  lizard_ws_frame_mask_payload_at(mask_key, 0, in, in_size, out);
+}
+
+uint32_t lizard_ws_frame_mask_payload_at(const char* mask_key, uint32_t offset,
+    const void* in, uint32_t in_size, void* out) {
+  uint8_t rkey[4];
+
+  if (in_size == 0)
+    return offset;
+  rotate_key(reinterpret_cast<const uint8_t*>(mask_key), offset, rkey);
+  if (in_size < 16) {
+    mask_tail(rkey, reinterpret_cast<const uint8_t*>(in), in_size,
+        reinterpret_cast<uint8_t*>(out));
+    return offset + in_size;
+  }
+  get_kernel_func()(rkey, reinterpret_cast<const uint8_t*>(in), in_size,
+      reinterpret_cast<uint8_t*>(out));
+  return offset + in_size;
+}
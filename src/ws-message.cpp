@@ -0,0 +1,98 @@
+#include <string.h>
+#include "ws-message.h"
+
+namespace rokid {
+namespace lizard {
+
+// ==================WSMessagePool====================
+WSMessagePool::WSMessagePool(uint32_t mf) : max_free(mf) {
+}
+
+WSMessagePool::~WSMessagePool() {
+  trim();
+}
+
+uint32_t WSMessagePool::size_class(uint32_t size) {
+  uint32_t c = 0;
+  while (c < CLASS_COUNT - 1 && (1u << (c + MIN_CLASS_SHIFT)) < size)
+    ++c;
+  return c;
+}
+
+PoolBuffer* WSMessagePool::get(uint32_t size) {
+  uint32_t c = size_class(size);
+  uint32_t cap = 1u << (c + MIN_CLASS_SHIFT);
+  PoolBuffer* buf = nullptr;
+
+  if (cap < size)
+    cap = size;
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    std::vector<PoolBuffer*>& list = free_lists[c];
+    if (!list.empty() && list.back()->total_space() >= size) {
+      buf = list.back();
+      list.pop_back();
+    }
+  }
+  if (buf == nullptr) {
+    buf = new PoolBuffer(cap);
+    if (buf->total_space() < size) {
+      delete buf;
+      return nullptr;
+    }
+  }
+  buf->clear();
+  return buf;
+}
+
+void WSMessagePool::put(PoolBuffer* buf) {
+  if (buf == nullptr)
+    return;
+  uint32_t c = size_class(buf->total_space());
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    if (free_lists[c].size() < max_free) {
+      free_lists[c].push_back(buf);
+      return;
+    }
+  }
+  delete buf;
+}
+
+PoolBuffer* WSMessagePool::grow(PoolBuffer* buf, uint32_t size) {
+  if (buf == nullptr)
+    return get(size);
+  return buf->reserve(size) ? buf : nullptr;
+}
+
+void WSMessagePool::trim() {
+  uint32_t i;
+  std::lock_guard<std::mutex> locker(mutex);
+  for (i = 0; i < CLASS_COUNT; ++i) {
+    for (auto it = free_lists[i].begin(); it != free_lists[i].end(); ++it) {
+      delete *it;
+    }
+    free_lists[i].clear();
+  }
+}
+
+WSMessagePool* WSMessagePool::default_pool() {
+  static WSMessagePool pool;
+  return &pool;
+}
+
+// ==================WSMessage====================
+WSMessage::~WSMessage() {
+  release();
+}
+
+void WSMessage::release() {
+  if (buf && pool)
+    pool->put(buf);
+  buf = nullptr;
+  pool = nullptr;
+  flags = 0;
+}
+
+} // namespace lizard
+} // namespace rokid
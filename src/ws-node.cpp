@@ -1,9 +1,19 @@
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include "ws-node.h"
+#include "ws-message.h"
 #include "ws-frame.h"
+#include "ws-deflate.h"
+#include "buffer-pool.h"
+#include "ws-send-queue.h"
 #include "http.h"
 #include "common.h"
 
+// payload smaller than this is copied to write buffer with header,
+// cheaper than gather write
+#define GATHER_MIN_PAYLOAD 256
+
 using namespace std;
 
 namespace rokid {
@@ -15,22 +25,371 @@ const char* WSNode::error_messages[] = {
   "control frame with payload data size larger than 125",
   "insufficient websocket frame read buffer",
   "insufficient websocket frame write buffer",
+  "websocket message larger than max message size",
+  "invalid websocket message fragment",
+  "frame reserved bits set without negotiated extension",
+  "decompress websocket message failed",
+  "compress websocket message failed",
+  "websocket send queue full",
+  "websocket send queue not enabled",
+  "only whole messages can be enqueued to send queue",
 };
 
 WSNode::WSNode() {
 }
 
 WSNode::~WSNode() {
+  release_message_buffer();
+  release_deflate();
+  delete deflate_buf;
+  delete view_buf;
+  delete send_queue;
 }
 
 bool WSNode::send_frame(const void* payload, uint32_t size, uint32_t flags) {
   Buffer in;
   NodeArgs<void> args;
+  if (corked || (deflate && !is_control_opcode(flags & OPCODE_MASK))) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(payload);
+    iov.iov_len = size;
+    return send_frame(&iov, 1, flags);
+  }
   args.add(&flags);
   in.set_data(const_cast<void *>(payload), size, 0, size);
   return Node::write(&in, &args);
 }
 
+bool WSNode::can_gather() const {
+  return *(int32_t*)masking_key == 0 && super_node
+    && super_node->can_writev();
+}
+
+bool WSNode::send_frame(const struct iovec* iov, uint32_t iovcnt,
+    uint32_t flags) {
+  uint64_t size = 0;
+  uint32_t i;
+
+  for (i = 0; i < iovcnt; ++i) {
+    size += iov[i].iov_len;
+  }
+  // small frame corked to write buffer, large frame sent as usual after
+  // corked frames
+  bool cork_frame = corked && !frame_pending && write_state == 0
+    && size < cork_flush_size && write_buffer;
+  // room made before compressing, frame may be retried after would block
+  if (cork_frame && !cork_reserve(size))
+    return false;
+  struct iovec ziov;
+  if (!frame_pending) {
+    uint32_t op = flags & OPCODE_MASK;
+    if (is_control_opcode(op) && size > 125) {
+      set_node_error(INVALID_CONTROL_FRAME_FORMAT);
+      return false;
+    }
+    frame_deflated = false;
+    if (deflate && !is_control_opcode(op)) {
+      // first frame decides for the whole message
+      if (op != OPCODE_CONT)
+        send_msg_compressed = size >= deflate_options.min_size;
+      if (send_msg_compressed) {
+        TRACE_SCOPE("deflate", "websocket");
+        if (deflate_buf == nullptr)
+          deflate_buf = new PoolBuffer();
+        if (!deflate->compress(iov, iovcnt, flags & FIN_MASK, deflate_buf,
+              &deflate_size)) {
+          set_node_error(DEFLATE_FAILED);
+          return false;
+        }
+        if (op != OPCODE_CONT)
+          flags |= WSFRAME_RSV1;
+        frame_deflated = true;
+      }
+    }
+    frame_flags = flags;
+  }
+  if (frame_deflated) {
+    // compressed payload is sent instead, also when called again to
+    // resume a blocked frame
+    ziov.iov_base = deflate_buf->data_begin();
+    ziov.iov_len = deflate_size;
+    iov = &ziov;
+    iovcnt = 1;
+    size = deflate_size;
+    flags = frame_flags;
+  }
+  if (cork_frame && write_buffer->remain_space() >= size + MAX_FRAME_HEADER)
+    return cork_append(iov, iovcnt, size, flags);
+  if (!frame_pending) {
+    frame_pending = true;
+    frame_started = false;
+    frame_sent = 0;
+    frame_gather = write_state == 0 && iovcnt < (uint32_t)MAX_IOV
+      && can_gather() && (write_buffer == nullptr || write_buffer->empty());
+    if (frame_gather) {
+      uint8_t fin = flags & FIN_MASK ? 1 : 0;
+      frame_header_size = lizard_ws_frame_create(
+          flags & (OPCODE_MASK | WSFRAME_RSV1), fin, 0, nullptr, size,
+          frame_header, sizeof(frame_header));
+      NODE_STAT_FRAME_OUT(flags & OPCODE_MASK);
+    }
+  }
+  bool r = frame_gather ? send_gather(iov, iovcnt, size)
+    : send_copy(iov, iovcnt, size, flags);
+  if (r || !would_block())
+    frame_pending = false;
+  return r;
+}
+
+// make room of frame with 'size' bytes payload in write buffer, frames
+// corked before are flushed if no room
+bool WSNode::cork_reserve(uint64_t size) {
+  uint32_t need = size + MAX_FRAME_HEADER;
+  shift_buffer(write_buffer);
+  if (write_buffer->remain_space() >= need)
+    return true;
+  NODE_STAT(BUFFER_FULL, 1);
+  if (!write_buffer->empty() && !flush())
+    return false;
+  if (write_buffer->remain_space() < need)
+    write_buffer->reserve(write_buffer->size() + need);
+  return true;
+}
+
+// encode frame to write buffer after corked frames, room already made.
+// flushed if corked frames reach flush size or oldest of them timeout
+bool WSNode::cork_append(const struct iovec* iov, uint32_t iovcnt,
+    uint64_t size, uint32_t flags) {
+  uint8_t mask = *(int32_t*)masking_key ? 1 : 0;
+  uint32_t i, offset = 0;
+
+  if (write_buffer->empty() && cork_flush_timeout > 0)
+    cork_time = steady_now_ms();
+  int32_t c = lizard_ws_frame_create(flags & (OPCODE_MASK | WSFRAME_RSV1),
+      flags & FIN_MASK ? 1 : 0, mask, masking_key, size, frame_header,
+      sizeof(frame_header));
+  write_buffer->append(frame_header, c);
+  for (i = 0; i < iovcnt; ++i) {
+    if (mask) {
+      TRACE_SCOPE("mask", "websocket");
+      offset = lizard_ws_frame_mask_payload_at(masking_key, offset,
+          iov[i].iov_base, iov[i].iov_len, write_buffer->data_end());
+      write_buffer->obtain(iov[i].iov_len);
+    } else {
+      write_buffer->append(iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+  NODE_STAT_FRAME_OUT(flags & OPCODE_MASK);
+  if (write_buffer->size() < cork_flush_size && (cork_flush_timeout <= 0
+        || steady_now_ms() - cork_time < cork_flush_timeout))
+    return true;
+  // frame accepted, rest of write buffer sent by next write or flush
+  // if would block
+  if (!flush() && !would_block())
+    return false;
+  clear_node_error();
+  return true;
+}
+
+void WSNode::cork(uint32_t flush_size, int32_t flush_timeout) {
+  corked = true;
+  cork_flush_size = flush_size;
+  cork_flush_timeout = flush_timeout;
+}
+
+bool WSNode::uncork() {
+  corked = false;
+  return flush();
+}
+
+bool WSNode::flush_cork_timeout() {
+  if (cork_flush_timeout <= 0 || write_buffer == nullptr
+      || write_buffer->empty()
+      || steady_now_ms() - cork_time < cork_flush_timeout)
+    return true;
+  return flush();
+}
+
+// write header and payload to super node with one writev,
+// 'frame_sent' is count of frame bytes already written
+bool WSNode::send_gather(const struct iovec* iov, uint32_t iovcnt,
+    uint64_t size) {
+  struct iovec vec[MAX_IOV];
+  uint64_t total = frame_header_size + size;
+  uint64_t skip;
+  int32_t n;
+  uint32_t i;
+  int64_t r;
+
+  while (frame_sent < total) {
+    n = 0;
+    skip = frame_sent;
+    if (skip < frame_header_size) {
+      vec[n].iov_base = frame_header + skip;
+      vec[n].iov_len = frame_header_size - skip;
+      ++n;
+      skip = 0;
+    } else {
+      skip -= frame_header_size;
+    }
+    for (i = 0; i < iovcnt; ++i) {
+      if (skip >= iov[i].iov_len) {
+        skip -= iov[i].iov_len;
+        continue;
+      }
+      vec[n].iov_base = reinterpret_cast<char*>(iov[i].iov_base) + skip;
+      vec[n].iov_len = iov[i].iov_len - skip;
+      skip = 0;
+      ++n;
+    }
+    r = super_node->writev(vec, n);
+    if (r < 0)
+      return false;
+    frame_sent += r;
+  }
+  clear_node_error();
+  return true;
+}
+
+// frame with masking or super node not support writev, copy payload to
+// write buffer by Node::write, 'frame_sent' is count of payload bytes
+// consumed by node chain
+bool WSNode::send_copy(const struct iovec* iov, uint32_t iovcnt,
+    uint64_t size, uint32_t flags) {
+  NodeArgs<void> args;
+  Buffer in;
+  uint64_t skip = frame_sent;
+  uint32_t i, before;
+
+  args.add(&flags);
+  if (!frame_started) {
+    frame_started = true;
+    next_frame_size = size;
+    if (size == 0) {
+      in.set_data(nullptr, 0, 0, 0);
+      return Node::write(&in, &args);
+    }
+  } else if (frame_sent >= size) {
+    // all payload consumed, only data in node buffers remained
+    return flush();
+  }
+  for (i = 0; i < iovcnt; ++i) {
+    if (skip >= iov[i].iov_len) {
+      skip -= iov[i].iov_len;
+      continue;
+    }
+    in.set_data(iov[i].iov_base, iov[i].iov_len, skip, iov[i].iov_len);
+    skip = 0;
+    before = in.size();
+    bool r = Node::write(&in, &args);
+    frame_sent += before - in.size();
+    if (!r)
+      return false;
+  }
+  return true;
+}
+
+bool WSNode::read_message(WSMessage* msg, NodeArgs<void>* args) {
+  WSMessagePool* pool = msg_pool ? msg_pool : WSMessagePool::default_pool();
+  bool streaming = read_streaming;
+  Buffer out;
+  uint64_t need, target;
+  uint32_t used, op;
+  bool in_frame;
+
+  // reuse buffer of last message, no pool operation in steady state
+  if (msg->buf && msg_buf == nullptr && msg->pool == pool) {
+    msg_buf = msg->buf;
+    msg_buf->clear();
+    msg->buf = nullptr;
+  }
+  msg->release();
+  // payload written directly to message buffer piece by piece,
+  // size of frame not limited by read buffer
+  read_streaming = true;
+  while (true) {
+    in_frame = read_state == 1;
+    used = msg_buf ? msg_buf->size() : 0;
+    need = in_frame ? excepted_read_payload_data_size : 0;
+    if (in_frame && used + need > max_message_size) {
+      set_node_error(MESSAGE_TOO_LARGE);
+      goto failed;
+    }
+    // control frame may arrive between fragments, always keep room for it
+    if (need < MAX_CONTROL_PAYLOAD)
+      need = MAX_CONTROL_PAYLOAD;
+    if (msg_buf == nullptr || msg_buf->remain_space() < need) {
+      target = used + need;
+      // size of decompressed payload unknown, grow by doubling too
+      if ((!in_frame || read_inflating) && msg_buf
+          && target < msg_buf->total_space() * 2ULL)
+        target = msg_buf->total_space() * 2ULL;
+      if (target > (uint64_t)max_message_size + MAX_CONTROL_PAYLOAD)
+        target = (uint64_t)max_message_size + MAX_CONTROL_PAYLOAD;
+      PoolBuffer* nbuf = pool->grow(msg_buf, target);
+      if (nbuf == nullptr) {
+        set_node_error(MESSAGE_TOO_LARGE);
+        goto failed;
+      }
+      msg_buf = nbuf;
+    }
+    out.set_data(msg_buf->data_end(), msg_buf->remain_space(), 0, 0);
+    if (!Node::read(&out, args))
+      goto failed;
+    op = read_flags & OPCODE_MASK;
+    if (is_control_opcode(op)) {
+      if (msg_opcode == 0 && used == 0) {
+        msg_buf->obtain(out.size());
+        msg->buf = msg_buf;
+        msg_buf = nullptr;
+      } else {
+        // keep fragments already received, deliver control frame alone
+        msg->buf = pool->get(out.size());
+        msg->buf->append(out.data_begin(), out.size());
+      }
+      msg->pool = pool;
+      msg->flags = read_flags;
+      break;
+    }
+    if (!in_frame) {
+      // first piece of a data frame
+      if ((op == OPCODE_CONT) != (msg_opcode != 0)) {
+        set_node_error(INVALID_FRAGMENT);
+        goto failed;
+      }
+      if (op != OPCODE_CONT)
+        msg_opcode = op;
+    }
+    msg_buf->obtain(out.size());
+    if (msg_buf->size() > max_message_size) {
+      set_node_error(MESSAGE_TOO_LARGE);
+      goto failed;
+    }
+    if (read_flags & WSFRAME_FIN) {
+      msg->buf = msg_buf;
+      msg->pool = pool;
+      msg->flags = msg_opcode | WSFRAME_FIN;
+      msg_buf = nullptr;
+      msg_opcode = 0;
+      break;
+    }
+  }
+  read_streaming = streaming;
+  return true;
+
+failed:
+  read_streaming = streaming;
+  return false;
+}
+
+void WSNode::release_message_buffer() {
+  if (msg_buf) {
+    (msg_pool ? msg_pool : WSMessagePool::default_pool())->put(msg_buf);
+    msg_buf = nullptr;
+  }
+  msg_opcode = 0;
+}
+
 bool WSNode::ping(void* payload, uint32_t size) {
   return send_frame(payload, size, OPCODE_PING | WSFRAME_FIN);
 }
@@ -39,6 +398,90 @@ bool WSNode::pong(void* payload, uint32_t size) {
   return send_frame(payload, size, OPCODE_PONG | WSFRAME_FIN);
 }
 
+bool WSNode::enable_send_queue(uint32_t max_bytes,
+    void (*notify)(WSNode*, uint32_t, void*), void* arg) {
+  if (send_queue)
+    return false;
+  send_queue = new WSSendQueue(max_bytes, notify, arg);
+  return true;
+}
+
+bool WSNode::enqueue_frame(const void* payload, uint32_t size,
+    uint32_t flags) {
+  if (send_queue == nullptr) {
+    set_node_error(SEND_QUEUE_DISABLED);
+    return false;
+  }
+  uint8_t op = flags & OPCODE_MASK;
+  if (!check_opcode(op)) {
+    set_node_error(INVALID_OPCODE);
+    return false;
+  }
+  // fragments of producers would interleave in queue
+  if (op == OPCODE_CONT || (flags & WSFRAME_FIN) == 0) {
+    set_node_error(SEND_QUEUE_FRAGMENT);
+    return false;
+  }
+  if (is_control_opcode(op) && size > MAX_CONTROL_PAYLOAD) {
+    set_node_error(INVALID_CONTROL_FRAME_FORMAT);
+    return false;
+  }
+  int32_t r = send_queue->push(payload, size, flags);
+  if (r < 0) {
+    if (r == -1) {
+      set_node_error(SEND_QUEUE_FULL);
+    } else {
+      err_info.node = this;
+      err_info.code = ENOMEM;
+      err_info.desc = strerror(ENOMEM);
+    }
+    return false;
+  }
+  if (r > 0 && send_queue->notify)
+    send_queue->notify(this, SEND_QUEUE_READY, send_queue->notify_arg);
+  return true;
+}
+
+bool WSNode::drain_send_queue() {
+  if (send_queue == nullptr)
+    return true;
+  bool was_corked = corked;
+  bool r = true;
+  bool low = false;
+  WSQueuedFrame* f;
+
+  // frames coalesced in write buffer by cork, corked frames of the
+  // writer sent first
+  if (!was_corked)
+    cork();
+  while ((f = send_queue->front()) != nullptr) {
+    if (!send_frame(f->payload(), f->size, f->flags)) {
+      r = false;
+      break;
+    }
+    if (send_queue->pop_front())
+      low = true;
+  }
+  if (!was_corked) {
+    corked = false;
+    if (r)
+      r = flush();
+  }
+  if (low && send_queue->notify)
+    send_queue->notify(this, SEND_QUEUE_LOW, send_queue->notify_arg);
+  return r;
+}
+
+uint64_t WSNode::send_queue_bytes() const {
+  return send_queue
+    ? send_queue->bytes.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t WSNode::send_queue_frames() const {
+  return send_queue
+    ? send_queue->frames.load(std::memory_order_relaxed) : 0;
+}
+
 void WSNode::set_masking_key(const char* key) {
   memcpy(masking_key, key, 4);
 }
@@ -49,11 +492,27 @@ void WSNode::set_node_error(int32_t code) {
   err_info.desc = error_messages[ERROR_CODE_BEGIN - code];
 }
 
+// args of handshake read/write of super node, timeout of every operation
+// is time remained before handshake deadline
+static NodeArgs<void>* handshake_args(int64_t dl, int32_t* tm,
+    NodeArgs<void>* args) {
+  if (dl == 0)
+    return nullptr;
+  int64_t remain = dl - steady_now_ms();
+  *tm = remain > 0 ? remain : 1;
+  return args;
+}
+
 bool WSNode::on_init(const rokid::Uri& uri, void* arg) {
   HttpRequest req;
-  char buf[256];
+  char buf[1024];
   int32_t len;
+  // 'arg': handshake timeout in milliseconds
+  int64_t dl = arg ? deadline_after(reinterpret_cast<int32_t*>(arg)[0]) : 0;
+  int32_t tm;
+  NodeArgs<void> args;
 
+  args.add(&tm);
   req.setPath(uri.path.c_str());
   snprintf(buf, sizeof(buf), "%s:%d", uri.host.c_str(), uri.port);
   req.addHeaderField("Host", buf);
@@ -61,6 +520,32 @@ bool WSNode::on_init(const rokid::Uri& uri, void* arg) {
   req.addHeaderField("Connection", "Upgrade");
   req.addHeaderField("Sec-WebSocket-Key", "x3JJHMbDL1EzLkh9GBhXDw==");
   req.addHeaderField("Sec-WebSocket-Version", "13");
+  release_deflate();
+#ifdef HAS_ZLIB
+  if (deflate_options.enable) {
+    char ext[160];
+    // zlib raw deflate not support window of 256 bytes
+    int32_t bits = deflate_options.client_max_window_bits;
+    deflate_options.client_max_window_bits = bits < 9 ? 9
+      : (bits > 15 ? 15 : bits);
+    snprintf(ext, sizeof(ext),
+        "permessage-deflate; client_max_window_bits=%d%s%s",
+        deflate_options.client_max_window_bits,
+        deflate_options.client_no_context_takeover
+          ? "; client_no_context_takeover" : "",
+        deflate_options.server_no_context_takeover
+          ? "; server_no_context_takeover" : "");
+    if (deflate_options.server_max_window_bits < 15) {
+      len = strlen(ext);
+      snprintf(ext + len, sizeof(ext) - len, "; server_max_window_bits=%d",
+          deflate_options.server_max_window_bits);
+    }
+    req.addHeaderField("Sec-WebSocket-Extensions", ext);
+  }
+#else
+  if (deflate_options.enable)
+    KLOGW(TAG, "permessage-deflate not supported, built without zlib");
+#endif
   len = req.build(buf, sizeof(buf));
   if (len <= 0) {
     goto failed;
@@ -71,12 +556,12 @@ bool WSNode::on_init(const rokid::Uri& uri, void* arg) {
     Buffer rwbuf;
 
     rwbuf.set_data(buf, sizeof(buf), 0, len);
-    if (!super_node->write(&rwbuf)) {
+    if (!super_node->write(&rwbuf, handshake_args(dl, &tm, &args))) {
       return false;
     }
     int32_t pr;
     while (true) {
-      if (!super_node->read(&rwbuf)) {
+      if (!super_node->read(&rwbuf, handshake_args(dl, &tm, &args))) {
         return false;
       }
       pr = resp.parse((char*)rwbuf.data_begin(), rwbuf.size());
@@ -101,6 +586,12 @@ bool WSNode::on_init(const rokid::Uri& uri, void* arg) {
     if (strcasecmp(it->second.c_str(), "upgrade"))
       goto failed;
     // TODO: check field Sec-WebSocket-Accept
+    for (it = resp.headerFields.begin(); it != resp.headerFields.end();
+        ++it) {
+      if (strcasecmp(it->first.c_str(), "Sec-WebSocket-Extensions") == 0
+          && !negotiate_deflate(it->second.c_str()))
+        goto failed;
+    }
   }
   return true;
 
@@ -109,58 +600,205 @@ failed:
   return false;
 }
 
+// parse extension accepted by server, only permessage-deflate offered.
+// return: false  server response invalid
+bool WSNode::negotiate_deflate(const char* ext) {
+#ifdef HAS_ZLIB
+  WSDeflateOptions opts = deflate_options;
+  char name[64];
+  int32_t bits;
+  const char* p = ext;
+  const char* e;
+  uint32_t n;
+  bool first = true;
+
+  if (!deflate_options.enable || deflate) {
+    KLOGI(TAG, "unexpected websocket extension: %s", ext);
+    return false;
+  }
+  opts.server_max_window_bits = 15;
+  while (*p) {
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    e = p;
+    while (*e && *e != ';' && *e != ',')
+      ++e;
+    if (*e == ',') {
+      KLOGI(TAG, "more than one websocket extensions: %s", ext);
+      return false;
+    }
+    n = e - p;
+    while (n && (p[n - 1] == ' ' || p[n - 1] == '\t'))
+      --n;
+    if (n >= sizeof(name))
+      return false;
+    memcpy(name, p, n);
+    name[n] = '\0';
+    bits = -1;
+    char* eq = strchr(name, '=');
+    if (eq) {
+      *eq = '\0';
+      bits = atoi(eq + 1 + (eq[1] == '"' ? 1 : 0));
+    }
+    if (first) {
+      if (strcmp(name, "permessage-deflate"))
+        return false;
+      first = false;
+    } else if (strcmp(name, "server_no_context_takeover") == 0) {
+      opts.server_no_context_takeover = true;
+    } else if (strcmp(name, "client_no_context_takeover") == 0) {
+      opts.client_no_context_takeover = true;
+    } else if (strcmp(name, "server_max_window_bits") == 0) {
+      if (bits < 8 || bits > 15)
+        return false;
+      opts.server_max_window_bits = bits;
+    } else if (strcmp(name, "client_max_window_bits") == 0) {
+      if (bits < 8 || bits > 15)
+        return false;
+      if (bits < opts.client_max_window_bits)
+        opts.client_max_window_bits = bits;
+    } else {
+      KLOGI(TAG, "unknown permessage-deflate parameter %s", name);
+      return false;
+    }
+    p = *e ? e + 1 : e;
+  }
+  if (first)
+    return false;
+  // zlib raw deflate not support window of 256 bytes
+  if (opts.client_max_window_bits < 9) {
+    KLOGI(TAG, "client_max_window_bits %d not supported",
+        opts.client_max_window_bits);
+    return false;
+  }
+  // inflate window must not be smaller than window of server
+  if (opts.server_max_window_bits < 9)
+    opts.server_max_window_bits = 9;
+  deflate = new WSDeflate(opts);
+  read_msg_compressed = false;
+  send_msg_compressed = false;
+  return true;
+#else
+  KLOGI(TAG, "unexpected websocket extension: %s", ext);
+  return false;
+#endif
+}
+
+void WSNode::release_deflate() {
+  delete deflate;
+  deflate = nullptr;
+}
+
 int32_t WSNode::on_write(Buffer *in, Buffer *out, void* arg) {
-  uint32_t flags = reinterpret_cast<uint32_t*>(arg)[0];
+  uint32_t flags = arg ? reinterpret_cast<uint32_t*>(arg)[0]
+    : (OPCODE_BINARY | WSFRAME_FIN);
+  bool gather = can_gather();
+  int64_t r;
   if (in == nullptr)
     return 0;
   if (out == nullptr) {
     set_node_error(INSUFF_WRITE_BUFFER);
     return -1;
   }
-  out->shift();
+  shift_buffer(out);
   if (write_state == 0) {
-    uint8_t mask = *(int32_t*)masking_key ? 1 : 0;
-    int32_t c = lizard_ws_frame_create(flags & OPCODE_MASK,
-        flags & FIN_MASK ? 1 : 0, mask, masking_key,
-        in->size(), frame_header, sizeof(frame_header));
-    if (out->remain_space() < c) {
-      set_node_error(INSUFF_WRITE_BUFFER);
+    int64_t fsize = next_frame_size;
+    uint64_t psize = fsize >= 0 ? fsize : in->size();
+    next_frame_size = -1;
+    if (is_control_opcode(flags & OPCODE_MASK) && psize > 125) {
+      set_node_error(INVALID_CONTROL_FRAME_FORMAT);
       return -1;
     }
+    uint8_t mask = *(int32_t*)masking_key ? 1 : 0;
+    int32_t c = lizard_ws_frame_create(flags & (OPCODE_MASK | WSFRAME_RSV1),
+        flags & FIN_MASK ? 1 : 0, mask, masking_key,
+        psize, frame_header, sizeof(frame_header));
+    write_remain = psize;
+    write_mask_offset = 0;
+    write_state = 1;
 #ifdef LIZARD_DEBUG
     printf("ws-node: write frame header %d bytes\n", c);
 #endif
+    if (gather && out->empty() && (in->size() >= GATHER_MIN_PAYLOAD
+          || in->size() + c > out->remain_space())) {
+      // send header and payload with one gather write, payload not copied
+      struct iovec iov[2];
+      iov[0].iov_base = frame_header;
+      iov[0].iov_len = c;
+      iov[1].iov_base = in->data_begin();
+      iov[1].iov_len = in->size() < psize ? in->size() : psize;
+      r = super_node->writev(iov, iov[1].iov_len ? 2 : 1, write_args);
+      if (r < 0) {
+        // nothing written (would block included), header created again
+        // by next write
+        write_state = 0;
+        next_frame_size = fsize;
+        return -1;
+      }
+      NODE_STAT_FRAME_OUT(flags & OPCODE_MASK);
+      if (r < c) {
+        // header partially written, rest of header sent by write buffer
+        NODE_STAT(PARTIAL_WRITES, 1);
+        out->append(frame_header + r, c - r);
+        return 1;
+      }
+      in->consume(r - c);
+      write_remain -= r - c;
+      goto done;
+    }
+    if (out->remain_space() < (uint32_t)c) {
+      NODE_STAT(BUFFER_FULL, 1);
+      if (!out->reserve(out->size() + c)) {
+        write_state = 0;
+        set_node_error(INSUFF_WRITE_BUFFER);
+        return -1;
+      }
+    }
     out->append(frame_header, c);
-    write_state = 1;
-    return 1;
+    NODE_STAT_FRAME_OUT(flags & OPCODE_MASK);
   }
 
-  uint32_t wsize;
-  if (is_control_opcode(flags & OPCODE_MASK) && in->size() > 125) {
-    set_node_error(INVALID_CONTROL_FRAME_FORMAT);
-    return -1;
-  }
-  if (in->size() > out->remain_space()) {
-    wsize = out->remain_space();
-  } else {
-    wsize = in->size();
-  }
-  if (*(int32_t*)masking_key) {
-    lizard_ws_frame_mask_payload(masking_key, in->data_begin(),
-        wsize, out->data_begin());
-    out->obtain(wsize);
+  if (gather && out->empty() && write_remain
+      && (in->size() >= GATHER_MIN_PAYLOAD
+        || in->size() > out->remain_space())) {
+    struct iovec iov;
+    iov.iov_base = in->data_begin();
+    iov.iov_len = in->size() < write_remain ? in->size() : write_remain;
+    r = super_node->writev(&iov, 1, write_args);
+    if (r < 0)
+      return -1;
+    in->consume(r);
+    write_remain -= r;
   } else {
-    out->append(in->data_begin(), wsize);
-  }
-  in->consume(wsize);
+    // header and payload share the write buffer, so a small frame is sent
+    // with one write of super node
+    uint32_t wsize = in->size();
+    if (wsize > out->remain_space())
+      wsize = out->remain_space();
+    if (wsize > write_remain)
+      wsize = write_remain;
+    if (*(int32_t*)masking_key) {
+      TRACE_SCOPE("mask", "websocket");
+      write_mask_offset = lizard_ws_frame_mask_payload_at(masking_key,
+          write_mask_offset, in->data_begin(), wsize, out->data_end());
+      out->obtain(wsize);
+    } else {
+      out->append(in->data_begin(), wsize);
+    }
+    in->consume(wsize);
+    write_remain -= wsize;
 #ifdef LIZARD_DEBUG
-  printf("ws-node: write frame payload %d bytes\n", wsize);
+    printf("ws-node: write frame payload %d bytes\n", wsize);
 #endif
-  if (!in->empty()) {
-    return 1;
   }
-  write_state = 0;
-  return 0;
+
+done:
+  if (write_remain == 0) {
+    write_state = 0;
+    return 0;
+  }
+  // rest payload of frame given by next write
+  return in->empty() ? 0 : 1;
 }
 
 int32_t WSNode::on_read(Buffer *out, Buffer *in, void *arg) {
@@ -168,10 +806,16 @@ int32_t WSNode::on_read(Buffer *out, Buffer *in, void *arg) {
     set_node_error(INSUFF_READ_BUFFER);
     return -1;
   }
+  if (view_consumed)
+    release_frames();
   if (out == nullptr) {
     set_node_error(INSUFF_WRITE_BUFFER);
     return -1;
   }
+  if (read_state == 1) {
+    return read_inflating ? read_inflate(out, in, arg)
+      : read_payload(out, in, arg);
+  }
   uint32_t read_bytes = in->size();
   uint8_t* p = (uint8_t*)in->data_begin();
   WSFrameHeader header;
@@ -186,22 +830,70 @@ int32_t WSNode::on_read(Buffer *out, Buffer *in, void *arg) {
     set_node_error(INVALID_CONTROL_FRAME_FORMAT);
     return hsz;
   } else if (hsz == 0) {
+    shift_buffer(in);
     return 1;
   } else if (hsz < 0) {
     return hsz;
   }
+  bool control = is_control_opcode(header.opcode);
+  if (header.rsv1 && (deflate == nullptr || control
+        || header.opcode == OPCODE_CONT)) {
+    set_node_error(INVALID_RSV);
+    return -1;
+  }
+  if (!control && header.opcode != OPCODE_CONT)
+    read_msg_compressed = header.rsv1;
+  // compressed payload is always decompressed piece by piece
+  bool compressed = !control && deflate && read_msg_compressed;
+  if ((read_streaming || compressed) && !control) {
+    uint32_t keysz = header.mask ? 4 : 0;
+    if (hsz + keysz > read_bytes) {
+      shift_buffer(in);
+      return 1;
+    }
+    read_opcode = header.opcode;
+    read_fin = header.fin;
+    if (header.mask)
+      memcpy(read_masking_key, p + hsz, 4);
+    else
+      *(int32_t*)read_masking_key = 0;
+    read_mask_offset = 0;
+    excepted_read_payload_data_size = header.payload_length;
+    in->consume(hsz + keysz);
+    NODE_STAT_FRAME_IN(header.opcode);
+    read_state = 1;
+    read_inflating = compressed;
+    read_unmasked = 0;
+    return compressed ? read_inflate(out, in, arg)
+      : read_payload(out, in, arg);
+  }
   uint64_t frame_size = lizard_ws_frame_size(&header);
 #ifdef LIZARD_DEBUG
   printf("ws-node: parse frame payload, frame size %llu, payload %llu, read bytes %d\n", frame_size, header.payload_length, read_bytes);
 #endif
-  if (frame_size > read_bytes)
+  if (frame_size > read_bytes) {
+    // grow buffer of pool to hold whole frame,
+    // fixed buffer failed later if too small
+    if (frame_size > in->total_space()
+        && frame_size <= (uint64_t)max_message_size + MAX_FRAME_HEADER) {
+      NODE_STAT(BUFFER_FULL, 1);
+      in->reserve(frame_size);
+    }
+    // make room at buffer end for rest of frame
+    shift_buffer(in);
     return 1;
-  out->shift();
+  }
+  shift_buffer(out);
   if (out->remain_space() < header.payload_length) {
-    set_node_error(INSUFF_READ_BUFFER);
-    return -1;
+    NODE_STAT(BUFFER_FULL, 1);
+    if (header.payload_length > max_message_size
+        || !out->reserve(out->size() + header.payload_length)) {
+      set_node_error(INSUFF_READ_BUFFER);
+      return -1;
+    }
   }
   if (header.mask) {
+    TRACE_SCOPE("mask", "websocket");
     lizard_ws_frame_mask_payload((char*)(p + hsz), p + hsz + 4, header.payload_length,
         out->data_begin());
     out->obtain(header.payload_length);
@@ -210,16 +902,293 @@ int32_t WSNode::on_read(Buffer *out, Buffer *in, void *arg) {
     out->append(p + hsz, header.payload_length);
     in->consume(hsz + header.payload_length);
   }
-  if (arg) {
-    uint32_t v = header.opcode;
-    if (header.fin)
-      v |= WSFRAME_FIN;
-    reinterpret_cast<uint32_t *>(arg)[0] = v;
+  NODE_STAT_FRAME_IN(header.opcode);
+  read_flags = header.opcode;
+  if (header.fin)
+    read_flags |= WSFRAME_FIN;
+  if (arg)
+    reinterpret_cast<uint32_t *>(arg)[0] = read_flags;
+  return 0;
+}
+
+bool WSNode::read_frames(WSFrameView* views, uint32_t max, uint32_t* count,
+    NodeArgs<void>* args) {
+  uint32_t argsIndex{0};
+  uint64_t need, bytes = 0;
+  int32_t r = 0;
+  bool ok, oversize = false;
+
+  TRACE_NODE("read_frames");
+  *count = 0;
+  release_frames();
+  if (read_buffer == nullptr || super_node == nullptr) {
+    set_node_error(INSUFF_READ_BUFFER);
+    count_failure();
+    return false;
+  }
+  // frame partially delivered by read is continued by read
+  if (read_state == 1)
+    r = 2;
+  while (r != 2 && *count < max) {
+    r = view_frame(views + *count, &need);
+    if (r < 0) {
+      count_failure();
+      return false;
+    }
+    if (r == 1) {
+      bytes += views[*count].size;
+      ++*count;
+      continue;
+    }
+    if (r == 2 || *count)
+      break;
+    // no complete frame buffered, receive more
+    if (need > read_buffer->total_space()) {
+      NODE_STAT(BUFFER_FULL, 1);
+      if (need > (uint64_t)max_message_size + MAX_FRAME_HEADER
+          || !read_buffer->reserve(need)) {
+        r = 2;
+        oversize = true;
+        break;
+      }
+    }
+    shift_buffer(read_buffer);
+    if (args)
+      args->get(&argsIndex);
+    ok = super_node->read(read_buffer, args);
+    if (args)
+      args->restore(argsIndex);
+    if (!ok)
+      return false;
+  }
+  if (r == 2 && *count == 0) {
+    bool streaming = read_streaming;
+    if (view_buf == nullptr)
+      view_buf = new PoolBuffer();
+    view_buf->clear();
+    // frame can not be held by read buffer, whole frame read would fail
+    // the same way, give it in pieces of read buffer size
+    if (oversize) {
+      view_buf->reserve(read_buffer->total_space());
+      read_streaming = true;
+    }
+    ok = Node::read(view_buf, args);
+    read_streaming = streaming;
+    if (!ok)
+      return false;
+    views[0].flags = read_flags;
+    views[0].data = view_buf->data_begin();
+    views[0].size = view_buf->size();
+    *count = 1;
+    return true;
+  }
+  NODE_STAT(READS, 1);
+  NODE_STAT(BYTES_IN, bytes);
+  clear_node_error();
+  return true;
+}
+
+void WSNode::release_frames() {
+  if (view_consumed && read_buffer)
+    read_buffer->consume(view_consumed);
+  view_consumed = 0;
+}
+
+// view frame at 'view_consumed' of read buffer
+int32_t WSNode::view_frame(WSFrameView* view, uint64_t* need) {
+  uint32_t avail = read_buffer->size() - view_consumed;
+  uint8_t* p = (uint8_t*)read_buffer->data_begin() + view_consumed;
+  WSFrameHeader header;
+  int32_t hsz = lizard_ws_frame_parse_header(p, avail, &header);
+
+  *need = 0;
+  if (hsz == -1) {
+    set_node_error(INVALID_OPCODE);
+    return -1;
+  } else if (hsz == -2) {
+    set_node_error(INVALID_CONTROL_FRAME_FORMAT);
+    return -1;
+  } else if (hsz == 0) {
+    return 0;
+  }
+  bool control = is_control_opcode(header.opcode);
+  if (header.rsv1 && (deflate == nullptr || control
+        || header.opcode == OPCODE_CONT)) {
+    set_node_error(INVALID_RSV);
+    return -1;
+  }
+  // compressed payload is decompressed by read
+  if (!control && deflate && (header.opcode == OPCODE_CONT
+        ? read_msg_compressed : header.rsv1))
+    return 2;
+  *need = lizard_ws_frame_size(&header);
+  if (*need > avail)
+    return 0;
+  if (!control && header.opcode != OPCODE_CONT)
+    read_msg_compressed = false;
+  p += hsz;
+  if (header.mask) {
+    TRACE_SCOPE("mask", "websocket");
+    lizard_ws_frame_mask_payload_at((const char*)p, 0, p + 4,
+        header.payload_length, p + 4);
+    p += 4;
+  }
+  NODE_STAT_FRAME_IN(header.opcode);
+  view->flags = header.opcode;
+  if (header.fin)
+    view->flags |= WSFRAME_FIN;
+  view->data = p;
+  view->size = header.payload_length;
+  view_consumed += *need;
+  return 1;
+}
+
+// deliver payload of current frame already in 'in', return 1 if nothing
+// received yet
+int32_t WSNode::read_payload(Buffer *out, Buffer *in, void *arg) {
+  uint64_t remain = excepted_read_payload_data_size;
+  uint32_t n = in->size();
+  if (remain && n == 0) {
+    shift_buffer(in);
+    return 1;
+  }
+  shift_buffer(out);
+  if (n > remain)
+    n = remain;
+  if (n > out->remain_space())
+    n = out->remain_space();
+  if (remain && n == 0) {
+    set_node_error(INSUFF_READ_BUFFER);
+    return -1;
+  }
+  if (*(int32_t*)read_masking_key) {
+    TRACE_SCOPE("mask", "websocket");
+    read_mask_offset = lizard_ws_frame_mask_payload_at(read_masking_key,
+        read_mask_offset, in->data_begin(), n, out->data_end());
+    out->obtain(n);
+  } else {
+    out->append(in->data_begin(), n);
   }
+  in->consume(n);
+  remain -= n;
+  excepted_read_payload_data_size = remain;
+#ifdef LIZARD_DEBUG
+  printf("ws-node: read frame payload %u bytes, %llu remain\n", n,
+      (unsigned long long)remain);
+#endif
+  if (remain == 0)
+    read_state = 0;
+  read_flags = read_opcode;
+  if (remain) {
+    NODE_STAT(PARTIAL_READS, 1);
+    read_flags |= WSFRAME_PARTIAL;
+  }
+  else if (read_fin)
+    read_flags |= WSFRAME_FIN;
+  if (arg)
+    reinterpret_cast<uint32_t *>(arg)[0] = read_flags;
+  return 0;
+}
+
+// decompress payload of current frame already in 'in'.
+// streaming read deliver every piece decompressed, else whole frame
+// collected to 'out', 'out' grown if needed.
+int32_t WSNode::read_inflate(Buffer *out, Buffer *in, void *arg) {
+  uint32_t consumed, produced, n;
+  uint64_t remain;
+  bool done, last, frame_done;
+
+  shift_buffer(out);
+  while (true) {
+    remain = excepted_read_payload_data_size;
+    n = in->size() < remain ? in->size() : remain;
+    if (out->remain_space() == 0) {
+      NODE_STAT(BUFFER_FULL, 1);
+      uint32_t cap = out->total_space();
+      uint64_t target = cap < 4096 ? 4096 : cap * 2ULL;
+      if (target > max_message_size)
+        target = max_message_size;
+      if (read_streaming || target <= cap || !out->reserve(target)) {
+        set_node_error(read_streaming ? INSUFF_READ_BUFFER
+            : MESSAGE_TOO_LARGE);
+        return -1;
+      }
+    }
+    if (*(int32_t*)read_masking_key && n > read_unmasked) {
+      TRACE_SCOPE("mask", "websocket");
+      int8_t* p = (int8_t*)in->data_begin() + read_unmasked;
+      read_mask_offset = lizard_ws_frame_mask_payload_at(read_masking_key,
+          read_mask_offset, p, n - read_unmasked, p);
+      read_unmasked = n;
+    }
+    last = read_fin && n == remain;
+    {
+      TRACE_SCOPE("inflate", "websocket");
+      if (!deflate->decompress(in->data_begin(), n, last, out->data_end(),
+            out->remain_space(), &consumed, &produced, &done)) {
+        set_node_error(INFLATE_FAILED);
+        return -1;
+      }
+    }
+    in->consume(consumed);
+    read_unmasked -= consumed;
+    remain -= consumed;
+    excepted_read_payload_data_size = remain;
+    out->obtain(produced);
+    frame_done = remain == 0 && (!read_fin || done);
+#ifdef LIZARD_DEBUG
+    printf("ws-node: inflate frame payload %u bytes to %u bytes, %llu remain\n",
+        consumed, produced, (unsigned long long)remain);
+#endif
+    if (frame_done)
+      break;
+    if (out->remain_space() == 0) {
+      // more output pending, deliver this piece or grow 'out'
+      if (read_streaming)
+        break;
+      continue;
+    }
+    if (read_streaming && produced)
+      break;
+    // all input consumed, wait more payload
+    shift_buffer(in);
+    return 1;
+  }
+  if (frame_done) {
+    read_state = 0;
+    read_inflating = false;
+  }
+  read_flags = read_opcode;
+  if (!frame_done) {
+    NODE_STAT(PARTIAL_READS, 1);
+    read_flags |= WSFRAME_PARTIAL;
+  }
+  else if (read_fin)
+    read_flags |= WSFRAME_FIN;
+  if (arg)
+    reinterpret_cast<uint32_t *>(arg)[0] = read_flags;
   return 0;
 }
 
 void WSNode::on_close() {
+  write_state = 0;
+  write_mask_offset = 0;
+  write_remain = 0;
+  next_frame_size = -1;
+  frame_pending = false;
+  read_state = 0;
+  excepted_read_payload_data_size = 0;
+  read_inflating = false;
+  read_unmasked = 0;
+  read_msg_compressed = false;
+  send_msg_compressed = false;
+  frame_deflated = false;
+  corked = false;
+  view_consumed = 0;
+  if (send_queue)
+    send_queue->drop();
+  release_message_buffer();
+  release_deflate();
 }
 
 } // namespace lizard
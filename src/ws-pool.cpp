@@ -0,0 +1,436 @@
+#include <poll.h>
+#include <stdint.h>
+#include <chrono>
+#include "ws-pool.h"
+#include "ws-frame.h"
+#include "common.h"
+
+// max delay of refill retry after connect failed
+#define MAX_RETRY_DELAY 30000
+#define MIN_RETRY_DELAY 100
+
+using namespace std;
+using namespace std::chrono;
+
+namespace rokid {
+namespace lizard {
+
+class WSPoolEntry {
+public:
+  rokid::Uri uri;
+  // idle sessions kept
+  uint32_t count = 0;
+  // sessions connecting or checking by refill thread
+  uint32_t busy = 0;
+  list<WSSession*> idle;
+  // refill backoff after connect failed
+  uint32_t failures = 0;
+  int64_t retry_time = 0;
+};
+
+static bool parse_uri(const string& str, rokid::Uri& uri) {
+  if (!uri.parse(str.c_str()))
+    return false;
+  if (uri.scheme == "wss") {
+#ifdef HAS_SSL
+    return true;
+#else
+    KLOGW(TAG, "ssl not supported, pool of %s rejected", str.c_str());
+    return false;
+#endif
+  }
+  return uri.scheme == "ws";
+}
+
+// ==================WSSession====================
+WSSession::~WSSession() {
+  ws.close();
+}
+
+// not inline, layout of WSSession depends on HAS_SSL of library build
+WSNode* WSSession::node() {
+  return &ws;
+}
+
+bool WSSession::connect(const rokid::Uri& uri, int32_t timeout) {
+  NodeArgs<Buffer> bufs;
+  NodeArgs<void> args;
+#ifdef HAS_SSL
+  intptr_t sslargs[2] = { 0, 0 };
+#endif
+
+  // handshake timeout of websocket node covered by deadline of chain
+  args.add(nullptr);
+#ifdef HAS_SSL
+  if (uri.scheme == "wss") {
+    ws.chain(&ssl_node);
+    // config shared by sessions of pool, no verification if not set
+    ssl_node.set_config(ssl_config.get());
+    args.add(sslargs);
+  } else
+#endif
+  {
+    ws.chain(&sock_node);
+  }
+  bufs.add(&read_buffer);
+  ws.set_read_buffers(&bufs);
+  bufs.clear();
+  bufs.add(&write_buffer);
+  ws.set_write_buffers(&bufs);
+  ws.set_deadline(timeout);
+  bool r = ws.init(uri, &args);
+  ws.set_deadline(0);
+  checked = steady_now_ms();
+  return r;
+}
+
+bool WSSession::quiet() {
+  struct pollfd pfd;
+  int fd = ws.get_fd();
+  if (fd < 0 || !read_buffer.empty())
+    return false;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  // readable means remote closed, or a frame arrived while idle
+  return ::poll(&pfd, 1, 0) == 0;
+}
+
+bool WSSession::check(int32_t timeout) {
+  char data[128];
+  Buffer out(data, sizeof(data));
+  NodeArgs<void> args;
+  uint32_t flags = 0;
+  bool r;
+
+  args.add(&flags);
+  ws.set_deadline(timeout);
+  r = ws.ping();
+  while (r) {
+    out.clear();
+    args.restore(0);
+    r = ws.read(&out, &args);
+    if (!r)
+      break;
+    // answer ping of remote sent while idle, wait pong again
+    if ((flags & OPCODE_MASK) == OPCODE_PING) {
+      r = ws.pong(out.data_begin(), out.size());
+      continue;
+    }
+    r = (flags & OPCODE_MASK) == OPCODE_PONG;
+    break;
+  }
+  ws.set_deadline(0);
+  checked = steady_now_ms();
+  return r;
+}
+
+// ==================WSPool====================
+WSPool::WSPool() {
+}
+
+WSPool::~WSPool() {
+  stop();
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    for (auto sit = it->second->idle.begin(); sit != it->second->idle.end();
+        ++sit) {
+      delete *sit;
+    }
+    delete it->second;
+  }
+}
+
+WSPoolEntry* WSPool::find_entry(const string& uri) {
+  auto it = entries.find(uri);
+  return it == entries.end() ? nullptr : it->second;
+}
+
+bool WSPool::warm(const string& uri, uint32_t count) {
+  list<WSSession*> closing;
+  rokid::Uri u;
+
+  if (!parse_uri(uri, u))
+    return false;
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    WSPoolEntry* entry = find_entry(uri);
+    if (entry == nullptr) {
+      if (count == 0)
+        return true;
+      entry = new WSPoolEntry();
+      entry->uri = u;
+      entries[uri] = entry;
+    }
+    entry->count = count;
+    entry->failures = 0;
+    entry->retry_time = 0;
+    while (entry->idle.size() > count) {
+      closing.push_back(entry->idle.back());
+      entry->idle.pop_back();
+    }
+    if (!running) {
+      running = true;
+      thread = std::thread(&WSPool::run, this);
+    }
+    cond.notify_one();
+  }
+  // close sessions out of lock, tls close_notify may block
+  for (auto it = closing.begin(); it != closing.end(); ++it) {
+    delete *it;
+  }
+  return true;
+}
+
+WSSession* WSPool::get(const string& uri, int32_t timeout, NodeError* err) {
+  list<WSSession*> stale;
+  WSSession* session = nullptr;
+  rokid::Uri u;
+
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    WSPoolEntry* entry = find_entry(uri);
+    if (entry) {
+      while (!entry->idle.empty()) {
+        WSSession* s = entry->idle.front();
+        entry->idle.pop_front();
+        if (s->quiet()) {
+          session = s;
+          break;
+        }
+        stale.push_back(s);
+      }
+      // refill immediately
+      cond.notify_one();
+    }
+  }
+  for (auto it = stale.begin(); it != stale.end(); ++it) {
+    delete *it;
+  }
+  if (session) {
+    ++hits;
+    return session;
+  }
+
+  ++misses;
+  if (!parse_uri(uri, u))
+    return nullptr;
+  session = new WSSession(uri);
+#ifdef HAS_SSL
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    session->ssl_config = ssl_config;
+  }
+#endif
+  if (!session->connect(u, timeout)) {
+    if (err)
+      *err = *session->ws.get_error();
+    delete session;
+    return nullptr;
+  }
+  return session;
+}
+
+void WSPool::put(WSSession* session, bool reusable) {
+  if (session == nullptr)
+    return;
+  WSNode* ws = &session->ws;
+  if (reusable) {
+    ws->set_deadline(0);
+    if (ws->is_nonblock())
+      ws->set_nonblock(false);
+    ws->shrink_buffers();
+    reusable = session->write_buffer.empty() && session->quiet();
+  }
+  if (reusable) {
+    std::lock_guard<std::mutex> locker(mutex);
+    WSPoolEntry* entry = find_entry(session->key);
+    // preferred to a session refill thread is connecting, which is
+    // closed when done if not needed any more
+    if (entry && entry->idle.size() < entry->count) {
+      session->checked = steady_now_ms();
+      entry->idle.push_back(session);
+      return;
+    }
+  }
+  delete session;
+  // refill thread replace it if needed
+  cond.notify_one();
+}
+
+uint32_t WSPool::idle_count(const string& uri) {
+  std::lock_guard<std::mutex> locker(mutex);
+  WSPoolEntry* entry = find_entry(uri);
+  return entry ? entry->idle.size() : 0;
+}
+
+void WSPool::set_check_interval(int32_t interval, int32_t timeout) {
+  std::lock_guard<std::mutex> locker(mutex);
+  check_interval = interval;
+  check_timeout = timeout;
+  cond.notify_one();
+}
+
+void WSPool::set_connect_timeout(int32_t timeout) {
+  std::lock_guard<std::mutex> locker(mutex);
+  connect_timeout = timeout;
+}
+
+bool WSPool::set_ca(const string& ca) {
+#ifdef HAS_SSL
+  // parsed out of lock, sessions connecting keep the old config
+  std::shared_ptr<SSLConfig> config;
+  if (!ca.empty()) {
+    config = std::make_shared<SSLConfig>();
+    if (!config->init(ca.c_str()))
+      return false;
+  }
+  std::lock_guard<std::mutex> locker(mutex);
+  ssl_config = config;
+  return true;
+#else
+  return ca.empty();
+#endif
+}
+
+void WSPool::stop() {
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    if (!running)
+      return;
+    running = false;
+    cond.notify_one();
+  }
+  thread.join();
+}
+
+void WSPool::run() {
+  std::unique_lock<std::mutex> locker(mutex);
+  int64_t wakeup;
+
+  while (running) {
+    if (refill_once(locker) || check_once(locker))
+      continue;
+    if (!running)
+      break;
+    wakeup = next_wakeup();
+    if (wakeup) {
+      cond.wait_until(locker, steady_clock::time_point(milliseconds(wakeup)));
+    } else {
+      cond.wait(locker);
+    }
+  }
+}
+
+bool WSPool::refill_once(std::unique_lock<std::mutex>& locker) {
+  int64_t now = steady_now_ms();
+  WSPoolEntry* entry = nullptr;
+  string key;
+
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    WSPoolEntry* e = it->second;
+    if (e->idle.size() + e->busy < e->count && now >= e->retry_time) {
+      entry = e;
+      key = it->first;
+      break;
+    }
+  }
+  if (entry == nullptr)
+    return false;
+
+  rokid::Uri uri = entry->uri;
+  int32_t timeout = connect_timeout;
+  WSSession* session = new WSSession(key);
+#ifdef HAS_SSL
+  session->ssl_config = ssl_config;
+#endif
+  ++entry->busy;
+  locker.unlock();
+  bool r = session->connect(uri, timeout);
+  if (!r) {
+    KLOGI(TAG, "pool connect %s failed: %s", key.c_str(),
+        session->ws.get_error()->desc);
+  }
+  locker.lock();
+
+  // entry not removed, warm() only change count
+  --entry->busy;
+  if (r) {
+    entry->failures = 0;
+    if (entry->idle.size() + entry->busy < entry->count) {
+      entry->idle.push_back(session);
+      session = nullptr;
+    }
+  } else {
+    int64_t delay = MIN_RETRY_DELAY << (entry->failures < 9
+        ? entry->failures : 9);
+    ++entry->failures;
+    entry->retry_time = steady_now_ms()
+      + (delay < MAX_RETRY_DELAY ? delay : MAX_RETRY_DELAY);
+  }
+  if (session) {
+    locker.unlock();
+    delete session;
+    locker.lock();
+  }
+  return true;
+}
+
+bool WSPool::check_once(std::unique_lock<std::mutex>& locker) {
+  int64_t now = steady_now_ms();
+  WSPoolEntry* entry = nullptr;
+  WSSession* session = nullptr;
+
+  for (auto it = entries.begin(); it != entries.end() && !session; ++it) {
+    list<WSSession*>& idle = it->second->idle;
+    for (auto sit = idle.begin(); sit != idle.end(); ++sit) {
+      if (now - (*sit)->checked >= check_interval || !(*sit)->quiet()) {
+        entry = it->second;
+        session = *sit;
+        idle.erase(sit);
+        break;
+      }
+    }
+  }
+  if (session == nullptr)
+    return false;
+
+  int32_t timeout = check_timeout;
+  ++entry->busy;
+  locker.unlock();
+  bool r = session->check(timeout);
+  if (!r) {
+    KLOGI(TAG, "pool session of %s check failed: %s", session->key.c_str(),
+        session->ws.get_error()->desc);
+  }
+  locker.lock();
+  --entry->busy;
+  if (r && entry->idle.size() < entry->count) {
+    entry->idle.push_back(session);
+    return true;
+  }
+  locker.unlock();
+  delete session;
+  locker.lock();
+  return true;
+}
+
+int64_t WSPool::next_wakeup() {
+  int64_t wakeup = 0;
+  int64_t t;
+
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    WSPoolEntry* e = it->second;
+    if (e->idle.size() + e->busy < e->count)
+      t = e->retry_time;
+    else if (!e->idle.empty())
+      t = e->idle.front()->checked + check_interval;
+    else
+      continue;
+    if (wakeup == 0 || t < wakeup)
+      wakeup = t;
+  }
+  return wakeup;
+}
+
+} // namespace lizard
+} // namespace rokid
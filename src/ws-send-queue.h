@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "buffer-pool.h"
+#include "ws-node.h"
+#include "mpsc-queue.h"
+
+namespace rokid {
+namespace lizard {
+
+// a message copied by producer, header at begin of a BufferPool block,
+// payload follows
+class WSQueuedFrame {
+public:
+  inline void* payload() { return this + 1; }
+
+  std::atomic<WSQueuedFrame*> next;
+  // size of the block
+  uint32_t cap;
+  uint32_t size;
+  uint32_t flags;
+};
+
+// bounded outbound queue of WSNode, filled by any thread and drained by
+// the writer thread of the node chain
+class WSSendQueue {
+public:
+  WSSendQueue(uint32_t max, void (*fn)(WSNode*, uint32_t, void*), void* a)
+    : max_bytes(max), notify(fn), notify_arg(a) {
+  }
+
+  ~WSSendQueue() { drop(); }
+
+  // thread safe
+  // return: 1 queued to empty queue, 0 queued, -1 queue full,
+  //         -2 out of memory
+  int32_t push(const void* data, uint32_t size, uint32_t flags) {
+    uint64_t prev = bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size > max_bytes || prev + size > max_bytes) {
+      bytes.fetch_sub(size, std::memory_order_relaxed);
+      rejected.store(true, std::memory_order_relaxed);
+      return -1;
+    }
+    uint32_t cap;
+    WSQueuedFrame* f = reinterpret_cast<WSQueuedFrame*>(
+        BufferPool::instance()->get(sizeof(WSQueuedFrame) + size, &cap));
+    if (f == nullptr) {
+      bytes.fetch_sub(size, std::memory_order_relaxed);
+      return -2;
+    }
+    f->cap = cap;
+    f->size = size;
+    f->flags = flags;
+    if (size)
+      memcpy(f->payload(), data, size);
+    // counted before push, so writer never sees more frames than counted
+    uint32_t n = frames.fetch_add(1, std::memory_order_acq_rel);
+    queue.push(f);
+    return n == 0 ? 1 : 0;
+  }
+
+  // writer thread only, frame in sending first
+  WSQueuedFrame* front() {
+    if (current)
+      return current;
+    while (frames.load(std::memory_order_acquire)) {
+      current = queue.pop();
+      if (current)
+        return current;
+      // a producer counted its frame but not linked it yet
+      std::this_thread::yield();
+    }
+    return nullptr;
+  }
+
+  // writer thread only, front frame sent
+  // return: true if queue drained to low watermark after a push rejected
+  bool pop_front() {
+    WSQueuedFrame* f = current;
+    current = nullptr;
+    uint64_t b = bytes.fetch_sub(f->size, std::memory_order_relaxed)
+      - f->size;
+    frames.fetch_sub(1, std::memory_order_acq_rel);
+    BufferPool::instance()->put(f, f->cap);
+    return b <= max_bytes / 2
+      && rejected.exchange(false, std::memory_order_relaxed);
+  }
+
+  // writer thread only
+  void drop() {
+    while (front())
+      pop_front();
+    rejected.store(false, std::memory_order_relaxed);
+  }
+
+public:
+  // payload bytes and frames queued, include frame in sending
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint32_t> frames{0};
+  // a push failed since queue last drained to low watermark
+  std::atomic<bool> rejected{false};
+  const uint32_t max_bytes;
+  void (* const notify)(WSNode*, uint32_t, void*);
+  void* const notify_arg;
+
+private:
+  MPSCQueue<WSQueuedFrame> queue;
+  // popped, not sent completely yet
+  WSQueuedFrame* current = nullptr;
+};
+
+} // namespace lizard
+} // namespace rokid